@@ -0,0 +1,167 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the arena allocator. Memory is handed out from large
+ *  chunks by just advancing a pointer and it is released only all at once
+ *  together with the arena. The chunks grow in size, thus the number of
+ *  calls to malloc() is logarithmic in the amount of memory used. The
+ *  arena is not thread-safe.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ROUND(x) (((x) + FSH_ARENA_ALIGN - 1) & ~(size_t) (FSH_ARENA_ALIGN - 1))
+// offset of the data within a chunk
+#define ARENA_HDR ARENA_ROUND(sizeof(struct fsh_arena_chunk))
+
+struct fsh_arena_chunk
+{
+   struct fsh_arena_chunk *prev; //!< previous chunk
+   size_t size;                  //!< number of bytes available for data
+   size_t used;                  //!< number of bytes in use
+};
+
+
+/*! Add a new chunk of at least len bytes to the arena. It is twice the size
+ * of the current one up to FSH_ARENA_MAX_CHUNK.
+ * @return Returns a pointer to the chunk or NULL if the memory is exhausted.
+ */
+static struct fsh_arena_chunk *arena_chunk(fsh_arena_t *a, size_t len)
+{
+   struct fsh_arena_chunk *c;
+   size_t size;
+
+   size = a->chunk != NULL ? a->chunk->size * 2 : FSH_ARENA_CHUNK;
+   if (size > FSH_ARENA_MAX_CHUNK)
+      size = FSH_ARENA_MAX_CHUNK;
+   if (size < len)
+      size = len;
+
+   if ((c = malloc(ARENA_HDR + size)) == NULL)
+      return NULL;
+   c->prev = a->chunk;
+   c->size = size;
+   c->used = 0;
+
+   a->chunk = c;
+   a->chunks++;
+   a->size += size;
+   return c;
+}
+
+
+/*! Allocate len bytes from the arena. The memory is aligned to
+ * FSH_ARENA_ALIGN bytes and it is not initialized.
+ * @return Returns a pointer to the memory or NULL if the memory is
+ * exhausted. The memory is valid until the arena is reset or freed.
+ */
+void *fsh_arena_alloc(fsh_arena_t *a, size_t len)
+{
+   struct fsh_arena_chunk *c = a->chunk;
+   void *p;
+
+   // every allocation gets its own address, see fsh_arena_grow()
+   len = ARENA_ROUND(len ? len : 1);
+   if ((c == NULL || c->size - c->used < len) && (c = arena_chunk(a, len)) == NULL)
+      return NULL;
+
+   p = (char*) c + ARENA_HDR + c->used;
+   c->used += len;
+   a->allocs++;
+   a->last = p;
+   return p;
+}
+
+
+/*! Grow the memory ptr of the arena from old to len bytes like realloc()
+ * does. If ptr is the most recent allocation it is extended in place as long
+ * as the chunk has space left. Otherwise it is copied and the old memory is
+ * lost until the arena is freed. The copy is placed into a chunk with at
+ * least the same amount of space left, thus arrays which are grown
+ * repeatedly are copied only once in a while.
+ * @param ptr Pointer to memory of the arena or NULL.
+ * @param old Size of the memory at ptr.
+ * @param len New size.
+ * @return Returns a pointer to the memory or NULL if the memory is
+ * exhausted. In the latter case ptr is still valid.
+ */
+void *fsh_arena_grow(fsh_arena_t *a, void *ptr, size_t old, size_t len)
+{
+   struct fsh_arena_chunk *c = a->chunk;
+   size_t off;
+   void *p;
+
+   if (ptr == NULL)
+      return fsh_arena_alloc(a, len);
+   if (len <= old)
+      return ptr;
+
+   // a->last always belongs to the current chunk
+   if (ptr == a->last && (off = (char*) ptr - ((char*) c + ARENA_HDR)) + ARENA_ROUND(len) <= c->size)
+   {
+      c->used = off + ARENA_ROUND(len);
+      return ptr;
+   }
+
+   if (c->size - c->used < ARENA_ROUND(len) * 2 && arena_chunk(a, ARENA_ROUND(len) * 2) == NULL)
+      return NULL;
+   if ((p = fsh_arena_alloc(a, len)) != NULL)
+      memcpy(p, ptr, old);
+   return p;
+}
+
+
+/*! Release all memory of the arena except the current chunk which is reused
+ * for the following allocations. The counters are not reset.
+ */
+void fsh_arena_reset(fsh_arena_t *a)
+{
+   struct fsh_arena_chunk *c, *prev;
+
+   if (a->chunk == NULL)
+      return;
+
+   for (c = a->chunk->prev; c != NULL; c = prev)
+   {
+      prev = c->prev;
+      free(c);
+   }
+   a->chunk->prev = NULL;
+   a->chunk->used = 0;
+   a->size = a->chunk->size;
+   a->last = NULL;
+}
+
+
+/*! Release all memory of the arena. The arena is empty afterwards. */
+void fsh_arena_free(fsh_arena_t *a)
+{
+   struct fsh_arena_chunk *c, *prev;
+
+   for (c = a->chunk; c != NULL; c = prev)
+   {
+      prev = c->prev;
+      free(c);
+   }
+   memset(a, 0, sizeof(*a));
+}
+
@@ -0,0 +1,55 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the data structures and prototypes of the arena
+ *  allocator.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// alignment of all allocations
+#define FSH_ARENA_ALIGN 16
+// size of the first chunk
+#define FSH_ARENA_CHUNK 0x10000
+// chunks are doubled in size up to this limit
+#define FSH_ARENA_MAX_CHUNK 0x400000
+
+struct fsh_arena_chunk;
+
+// arena state, an arena which is set to 0 is empty
+typedef struct fsh_arena
+{
+   struct fsh_arena_chunk *chunk;   //!< current chunk, the older ones are linked to it
+   void *last;          //!< most recent allocation, see fsh_arena_grow()
+   long allocs;         //!< number of allocations
+   long chunks;         //!< number of chunks allocated
+   size_t size;         //!< number of bytes held by the chunks
+} fsh_arena_t;
+
+
+void *fsh_arena_alloc(fsh_arena_t *, size_t );
+void *fsh_arena_grow(fsh_arena_t *, void *, size_t , size_t );
+void fsh_arena_reset(fsh_arena_t *);
+void fsh_arena_free(fsh_arena_t *);
+
+#endif
+
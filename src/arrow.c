@@ -0,0 +1,529 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains a writer for the Apache Arrow IPC streaming format
+ *  (https://arrow.apache.org/docs/format/Columnar.html). The stream consists
+ *  of a schema message, followed by any number of record batch messages and
+ *  an end-of-stream marker. The message headers are flatbuffers which are
+ *  built by a minimal builder which just supports what is needed here.
+ *  All data is written in little endian byte order, which is the byte order
+ *  of the host (see check_endian() in parsefsh.c).
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arrow.h"
+
+// Arrow metadata version V5
+#define AR_VERSION 4
+// message header types
+#define AR_MSG_SCHEMA 1
+#define AR_MSG_BATCH 3
+// type ids of the union Type
+#define AR_TYPE_INT 2
+#define AR_TYPE_FLOAT 3
+#define AR_TYPE_UTF8 5
+#define AR_TYPE_TIMESTAMP 10
+// buffers are padded to this size
+#define AR_ALIGN 8
+#define AR_PAD(x) (((x) + AR_ALIGN - 1) & ~(size_t) (AR_ALIGN - 1))
+
+
+// buffer for building flatbuffers
+typedef struct fbuf
+{
+   char *buf;
+   size_t len;
+   size_t size;
+} fbuf_t;
+
+
+/*! Allocate n zeroed bytes at the end of the flatbuffer aligned to align
+ * bytes.
+ * @return Returns the position of the bytes within the buffer.
+ */
+static size_t fb_alloc(fbuf_t *fb, size_t n, size_t align)
+{
+   size_t pos = (fb->len + align - 1) & ~(align - 1);
+
+   if (pos + n > fb->size)
+   {
+      fb->size = (pos + n) * 2;
+      if ((fb->buf = realloc(fb->buf, fb->size)) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+   }
+   memset(fb->buf + fb->len, 0, pos + n - fb->len);
+   fb->len = pos + n;
+   return pos;
+}
+
+
+static void fb_set(fbuf_t *fb, size_t pos, const void *val, size_t n)
+{
+   memcpy(fb->buf + pos, val, n);
+}
+
+
+/*! Let the offset field at pos point to the object at dst. Offsets always
+ * point forward, thus objects have to be written after the objects which
+ * refer to them.
+ */
+static void fb_ref(fbuf_t *fb, size_t pos, size_t dst)
+{
+   uint32_t off = dst - pos;
+
+   fb_set(fb, pos, &off, sizeof(off));
+}
+
+
+/*! Create a table with n fields. The vtable is placed directly in front of
+ * the table.
+ * @param size List of the sizes of the fields, 0 if the field is absent.
+ * Offsets to other objects have a size of 4.
+ * @param fpos List which receives the positions of the fields.
+ * @return Returns the position of the table.
+ */
+static size_t fb_table(fbuf_t *fb, int n, const int *size, size_t *fpos)
+{
+   size_t vt, tab;
+   uint16_t v;
+   int32_t soff;
+   int i, align;
+
+   vt = fb_alloc(fb, 4 + 2 * n, 2);
+   for (align = 4, i = 0; i < n; i++)
+      if (size[i] > align)
+         align = size[i];
+   tab = fb_alloc(fb, 4, align);
+
+   for (i = 0; i < n; i++)
+   {
+      fpos[i] = size[i] ? fb_alloc(fb, size[i], size[i]) : 0;
+      v = size[i] ? fpos[i] - tab : 0;
+      fb_set(fb, vt + 4 + 2 * i, &v, sizeof(v));
+   }
+
+   v = 4 + 2 * n;
+   fb_set(fb, vt, &v, sizeof(v));
+   v = fb->len - tab;
+   fb_set(fb, vt + 2, &v, sizeof(v));
+   soff = tab - vt;
+   fb_set(fb, tab, &soff, sizeof(soff));
+
+   return tab;
+}
+
+
+/*! Create a vector of cnt elements of elsize bytes each. The elements are
+ * aligned to align bytes.
+ * @return Returns the position of the vector. The elements start 4 bytes
+ * behind.
+ */
+static size_t fb_vec(fbuf_t *fb, int cnt, int elsize, int align)
+{
+   uint32_t n = cnt;
+   size_t pos;
+
+   if (align < 4)
+      align = 4;
+   while ((fb->len + 4) % align)
+      fb_alloc(fb, 1, 1);
+   pos = fb_alloc(fb, 4 + cnt * elsize, 4);
+   fb_set(fb, pos, &n, sizeof(n));
+   return pos;
+}
+
+
+/*! Create a \0-terminated string.
+ * @return Returns the position of the string.
+ */
+static size_t fb_str(fbuf_t *fb, const char *s)
+{
+   size_t pos;
+   int len = strlen(s);
+
+   pos = fb_vec(fb, len + 1, 1, 1);
+   fb_set(fb, pos, &len, 4);
+   fb_set(fb, pos + 4, s, len);
+   return pos;
+}
+
+
+/*! Start a message with the header type htype and a body of body_len bytes.
+ * @return Returns the position of the offset field to the header table.
+ */
+static size_t ar_msg_start(fbuf_t *fb, uint8_t htype, int64_t body_len)
+{
+   static const int size[] = {2, 1, 4, 8};
+   size_t root, fpos[4];
+   int16_t version = AR_VERSION;
+
+   memset(fb, 0, sizeof(*fb));
+   root = fb_alloc(fb, 4, 4);
+   fb_ref(fb, root, fb_table(fb, 4, size, fpos));
+   fb_set(fb, fpos[0], &version, sizeof(version));
+   fb_set(fb, fpos[1], &htype, sizeof(htype));
+   fb_set(fb, fpos[3], &body_len, sizeof(body_len));
+   return fpos[2];
+}
+
+
+/*! Write the message fb framed by the continuation marker and its length
+ * to out and free fb. The body has to be written by the caller afterwards.
+ */
+static void ar_msg_write(obuf_t *out, fbuf_t *fb)
+{
+   uint32_t hdr[2];
+
+   fb_alloc(fb, 0, AR_ALIGN);
+   hdr[0] = 0xffffffff;
+   hdr[1] = fb->len;
+   ob_write(out, hdr, sizeof(hdr));
+   ob_write(out, fb->buf, fb->len);
+   free(fb->buf);
+}
+
+
+/*! Create the type table of field f.
+ * @return Returns the position of the table.
+ */
+static size_t ar_type(fbuf_t *fb, const ar_field_t *f)
+{
+   static const int int_size[] = {4, 1}, float_size[] = {2}, ts_size[] = {2, 4};
+   size_t tab, fpos[2];
+   int32_t bits = 32;
+   uint8_t sign = 1;
+   int16_t prec = 2, unit = 0;
+
+   switch (f->type)
+   {
+      case AR_INT32:
+         tab = fb_table(fb, 2, int_size, fpos);
+         fb_set(fb, fpos[0], &bits, sizeof(bits));
+         fb_set(fb, fpos[1], &sign, sizeof(sign));
+         return tab;
+
+      case AR_DOUBLE:
+         tab = fb_table(fb, 1, float_size, fpos);
+         fb_set(fb, fpos[0], &prec, sizeof(prec));
+         return tab;
+
+      case AR_TIMESTAMP:
+         tab = fb_table(fb, 2, ts_size, fpos);
+         fb_set(fb, fpos[0], &unit, sizeof(unit));
+         fb_ref(fb, fpos[1], fb_str(fb, "UTC"));
+         return tab;
+
+      default:
+         return fb_table(fb, 0, NULL, NULL);
+   }
+}
+
+
+/*! Write the schema message of the columns f to out. This starts the
+ * stream.
+ * @param f List of column definitions.
+ * @param n Number of columns.
+ */
+void ar_schema(obuf_t *out, const ar_field_t *f, int n)
+{
+   static const int schema_size[] = {0, 4}, field_size[] = {4, 1, 1, 4, 0, 4};
+   static const uint8_t type_id[] = {AR_TYPE_INT, AR_TYPE_FLOAT, AR_TYPE_UTF8, AR_TYPE_TIMESTAMP};
+   size_t hdr, tab, vec, fpos[6];
+   fbuf_t fb;
+   uint8_t nullable;
+   int i;
+
+   hdr = ar_msg_start(&fb, AR_MSG_SCHEMA, 0);
+   fb_ref(&fb, hdr, tab = fb_table(&fb, 2, schema_size, fpos));
+   fb_ref(&fb, fpos[1], vec = fb_vec(&fb, n, 4, 4));
+
+   for (i = 0; i < n; i++)
+   {
+      fb_ref(&fb, vec + 4 + 4 * i, tab = fb_table(&fb, 6, field_size, fpos));
+      nullable = f[i].nullable;
+      fb_set(&fb, fpos[1], &nullable, sizeof(nullable));
+      fb_set(&fb, fpos[2], &type_id[f[i].type], sizeof(*type_id));
+      fb_ref(&fb, fpos[0], fb_str(&fb, f[i].name));
+      fb_ref(&fb, fpos[3], ar_type(&fb, &f[i]));
+      fb_ref(&fb, fpos[5], fb_vec(&fb, 0, 4, 4));
+   }
+
+   ar_msg_write(out, &fb);
+}
+
+
+/*! Write the end-of-stream marker to out.
+ */
+void ar_eos(obuf_t *out)
+{
+   static const uint32_t eos[] = {0xffffffff, 0};
+
+   ob_write(out, eos, sizeof(eos));
+}
+
+
+static size_t ar_width(int type)
+{
+   return type == AR_INT32 ? sizeof(int32_t) : sizeof(int64_t);
+}
+
+
+/*! Create a new record batch writer. The schema has to be written before
+ * with ar_schema().
+ * @param out Output buffer the record batches are written to.
+ * @param f List of column definitions. It must be valid as long as the
+ * writer is used.
+ * @param n Number of columns.
+ * @param max_rows Number of rows of a batch, e.g. AR_BATCH_ROWS.
+ * @return Returns a pointer to the writer. If memory allocation fails the
+ * function does not return.
+ */
+arrow_t *ar_open(obuf_t *out, const ar_field_t *f, int n, int max_rows)
+{
+   arrow_t *ar;
+   int i;
+
+   if ((ar = calloc(1, sizeof(*ar))) == NULL || (ar->col = calloc(n, sizeof(*ar->col))) == NULL)
+      perror("calloc"), exit(EXIT_FAILURE);
+   ar->out = out;
+   ar->field = f;
+   ar->ncol = n;
+   ar->max_rows = max_rows;
+
+   for (i = 0; i < n; i++)
+   {
+      if (f[i].type == AR_UTF8)
+      {
+         ar->col[i].size = max_rows * 16;
+         if ((ar->col[i].off = calloc(max_rows + 1, sizeof(*ar->col[i].off))) == NULL)
+            perror("calloc"), exit(EXIT_FAILURE);
+      }
+      else
+         ar->col[i].size = max_rows * ar_width(f[i].type);
+      if ((ar->col[i].val = calloc(1, ar->col[i].size)) == NULL)
+         perror("calloc"), exit(EXIT_FAILURE);
+      if (f[i].nullable && (ar->col[i].valid = calloc(1, (max_rows + 7) / 8)) == NULL)
+         perror("calloc"), exit(EXIT_FAILURE);
+   }
+
+   return ar;
+}
+
+
+/*! Write the pending rows and free the writer. The output buffer is not
+ * closed.
+ */
+void ar_close(arrow_t *ar)
+{
+   int i;
+
+   ar_flush(ar);
+   for (i = 0; i < ar->ncol; i++)
+   {
+      free(ar->col[i].val);
+      free(ar->col[i].off);
+      free(ar->col[i].valid);
+   }
+   free(ar->col);
+   free(ar);
+}
+
+
+/*! Add the buffer buf of len bytes to the list of buffers of a record
+ * batch.
+ * @param pos Position of the Buffer struct within fb.
+ * @param body Pointer to the variable holding the current body size.
+ */
+static void ar_buffer(fbuf_t *fb, size_t pos, int64_t *body, size_t len)
+{
+   int64_t b[2] = {*body, len};
+
+   fb_set(fb, pos, b, sizeof(b));
+   *body += AR_PAD(len);
+}
+
+
+static void ar_body(obuf_t *out, const void *buf, size_t len)
+{
+   static const char pad[AR_ALIGN];
+
+   ob_write(out, buf, len);
+   ob_write(out, pad, AR_PAD(len) - len);
+}
+
+
+/*! Write the pending rows as a record batch. Every column has a validity
+ * buffer, which is empty if it does not contain nulls, followed by the
+ * offsets and characters for strings or the values otherwise.
+ */
+void ar_flush(arrow_t *ar)
+{
+   static const int batch_size[] = {8, 4, 4};
+   size_t hdr, tab, nodes, bufs, fpos[3], len;
+   int64_t body, node[2], rows = ar->rows;
+   ar_col_t *c;
+   fbuf_t fb;
+   int i, k;
+
+   if (!ar->rows)
+      return;
+
+   // calculate the body length first because it is part of the message
+   for (body = 0, i = 0; i < ar->ncol; i++)
+   {
+      c = &ar->col[i];
+      if (c->nulls)
+         body += AR_PAD((size_t) (rows + 7) / 8);
+      if (ar->field[i].type == AR_UTF8)
+         body += AR_PAD(sizeof(*c->off) * (rows + 1)) + AR_PAD(c->len);
+      else
+         body += AR_PAD(ar_width(ar->field[i].type) * rows);
+   }
+
+   hdr = ar_msg_start(&fb, AR_MSG_BATCH, body);
+   fb_ref(&fb, hdr, tab = fb_table(&fb, 3, batch_size, fpos));
+   fb_set(&fb, fpos[0], &rows, sizeof(rows));
+   for (k = 0, i = 0; i < ar->ncol; i++)
+      k += ar->field[i].type == AR_UTF8 ? 3 : 2;
+   fb_ref(&fb, fpos[1], nodes = fb_vec(&fb, ar->ncol, 16, 8));
+   fb_ref(&fb, fpos[2], bufs = fb_vec(&fb, k, 16, 8));
+
+   for (body = 0, k = 0, i = 0; i < ar->ncol; i++)
+   {
+      c = &ar->col[i];
+      node[0] = rows;
+      node[1] = c->nulls;
+      fb_set(&fb, nodes + 4 + 16 * i, node, sizeof(node));
+
+      ar_buffer(&fb, bufs + 4 + 16 * k++, &body, c->nulls ? (size_t) (rows + 7) / 8 : 0);
+      if (ar->field[i].type == AR_UTF8)
+      {
+         ar_buffer(&fb, bufs + 4 + 16 * k++, &body, sizeof(*c->off) * (rows + 1));
+         ar_buffer(&fb, bufs + 4 + 16 * k++, &body, c->len);
+      }
+      else
+         ar_buffer(&fb, bufs + 4 + 16 * k++, &body, ar_width(ar->field[i].type) * rows);
+   }
+   ar_msg_write(ar->out, &fb);
+
+   for (i = 0; i < ar->ncol; i++)
+   {
+      c = &ar->col[i];
+      if (c->nulls)
+         ar_body(ar->out, c->valid, (rows + 7) / 8);
+      if (ar->field[i].type == AR_UTF8)
+      {
+         ar_body(ar->out, c->off, sizeof(*c->off) * (rows + 1));
+         ar_body(ar->out, c->val, c->len);
+         c->len = 0;
+      }
+      else
+      {
+         len = ar_width(ar->field[i].type) * rows;
+         ar_body(ar->out, c->val, len);
+         memset(c->val, 0, len);
+      }
+      if (c->valid != NULL)
+         memset(c->valid, 0, (rows + 7) / 8);
+      c->nulls = 0;
+   }
+
+   ar->total += rows;
+   ar->batches++;
+   ar->rows = 0;
+}
+
+
+/*! Mark the value of column col of the current row as valid.
+ */
+static void ar_valid(arrow_t *ar, int col)
+{
+   if (ar->col[col].valid != NULL)
+      ar->col[col].valid[ar->rows >> 3] |= 1 << (ar->rows & 7);
+}
+
+
+/*! Set the value of column col of the current row. Each column has to be
+ * set exactly once per row, either with the function matching its type or
+ * with ar_null(). The row is finished with ar_row().
+ */
+void ar_int(arrow_t *ar, int col, int32_t v)
+{
+   ((int32_t*) ar->col[col].val)[ar->rows] = v;
+   ar_valid(ar, col);
+}
+
+
+void ar_dbl(arrow_t *ar, int col, double v)
+{
+   ((double*) ar->col[col].val)[ar->rows] = v;
+   ar_valid(ar, col);
+}
+
+
+void ar_time(arrow_t *ar, int col, int64_t v)
+{
+   ((int64_t*) ar->col[col].val)[ar->rows] = v;
+   ar_valid(ar, col);
+}
+
+
+/*! Set the string of column col of the current row.
+ * @param s Pointer to the string.
+ * @param len Number of characters of s.
+ */
+void ar_str(arrow_t *ar, int col, const char *s, int len)
+{
+   ar_col_t *c = &ar->col[col];
+
+   if (c->len + len > c->size)
+   {
+      c->size = (c->len + len) * 2;
+      if ((c->val = realloc(c->val, c->size)) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+   }
+   memcpy(c->val + c->len, s, len);
+   c->len += len;
+   c->off[ar->rows + 1] = c->len;
+   ar_valid(ar, col);
+}
+
+
+void ar_null(arrow_t *ar, int col)
+{
+   ar_col_t *c = &ar->col[col];
+
+   if (ar->field[col].type == AR_UTF8)
+      c->off[ar->rows + 1] = c->len;
+   c->nulls++;
+}
+
+
+/*! Finish the current row. If the batch is full, it is written to the
+ * output.
+ */
+void ar_row(arrow_t *ar)
+{
+   if (++ar->rows >= ar->max_rows)
+      ar_flush(ar);
+}
@@ -0,0 +1,83 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the data structures and prototypes of the Apache
+ *  Arrow IPC stream writer.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#ifndef ARROW_H
+#define ARROW_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "obuf.h"
+
+// default number of rows of a record batch
+#define AR_BATCH_ROWS (64 * 1024)
+
+// column types
+enum {AR_INT32, AR_DOUBLE, AR_UTF8, AR_TIMESTAMP};
+
+// definition of a column
+typedef struct ar_field
+{
+   const char *name; //!< name of the column
+   int type;         //!< AR_INT32, AR_DOUBLE, AR_UTF8, or AR_TIMESTAMP (seconds, UTC)
+   int nullable;     //!< 1 if the column may contain nulls
+} ar_field_t;
+
+// data of a column of the current record batch
+typedef struct ar_col
+{
+   char *val;        //!< values, or the characters of AR_UTF8 columns
+   size_t len;       //!< number of characters in val, AR_UTF8 only
+   size_t size;      //!< number of bytes allocated for val
+   int32_t *off;     //!< string offsets into val, AR_UTF8 only
+   uint8_t *valid;   //!< validity bitmap, nullable columns only
+   int nulls;        //!< number of nulls
+} ar_col_t;
+
+// record batch writer
+typedef struct arrow
+{
+   obuf_t *out;               //!< output buffer the batches are written to
+   const ar_field_t *field;   //!< list of column definitions
+   int ncol;                  //!< number of columns
+   ar_col_t *col;             //!< list of column data
+   int rows;                  //!< number of rows in the current batch
+   int max_rows;              //!< number of rows after which a batch is written
+   long long total;           //!< total number of rows written
+   int batches;               //!< number of batches written
+} arrow_t;
+
+
+void ar_schema(obuf_t *, const ar_field_t *, int );
+void ar_eos(obuf_t *);
+arrow_t *ar_open(obuf_t *, const ar_field_t *, int , int );
+void ar_close(arrow_t *);
+void ar_flush(arrow_t *);
+void ar_int(arrow_t *, int , int32_t );
+void ar_dbl(arrow_t *, int , double );
+void ar_time(arrow_t *, int , int64_t );
+void ar_str(arrow_t *, int , const char *, int );
+void ar_null(arrow_t *, int );
+void ar_row(arrow_t *);
+
+#endif
@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# End-to-end benchmark of parsefsh. It generates synthetic ARCHIVE.FSH files
+# of several sizes with genfsh and converts each of them into every output
+# format. The results are written as tab separated values to stdout, one line
+# per size and format, which can be compared between commits.
+#
+# usage: bench.sh [REPEAT]
+#
+# Each conversion is repeated REPEAT times (default 3) and the fastest run is
+# reported.
+
+REPEAT=${1:-3}
+TMP=${TMPDIR:-/tmp}/parsefsh-bench.$$
+COMMIT=`git rev-parse --short HEAD 2>/dev/null || echo unknown`
+
+# size name and genfsh options
+SIZES="small:-t_10_-s_2_-p_500_-w_100_-r_5
+medium:-t_60_-s_4_-p_1000_-w_500_-r_20
+large:-t_200_-s_8_-p_2000_-w_2000_-r_50"
+
+mkdir -p $TMP || exit 1
+trap "rm -rf $TMP" 0
+
+# points are waypoints, track points, and route points like points/s of the
+# summary of parsefsh
+printf "commit\tsize\tformat\tbytes\tpoints\tseconds\tMB_s\tpoints_s\tpeak_rss_kB\n"
+for s in $SIZES; do
+   name=${s%%:*}
+   ./genfsh `echo ${s#*:} | tr _ ' '` > $TMP/$name.fsh 2>/dev/null || exit 1
+
+   for fmt in csv osm gpx geojsonseq arrow pbf stats; do
+      # the batch mode prints a summary line with all values needed
+      i=0
+      while [ $i -lt $REPEAT ]; do
+         ./parsefsh -q -f $fmt $TMP/$name.fsh 2>&1 >/dev/null | grep '^# files = '
+         i=$((i + 1))
+      done > $TMP/runs
+
+      awk -v commit=$COMMIT -v size=$name -v fmt=$fmt '
+         {
+            sub(/^# /, "")
+            n = split($0, item, ", ")
+            for (i = 1; i <= n; i++)
+            {
+               if ((j = index(item[i], " = ")))
+               {
+                  split(substr(item[i], j + 3), val, " ")
+                  v[substr(item[i], 1, j - 1)] = val[1]
+               }
+               else
+               {
+                  split(item[i], val, " ")
+                  v[val[2]] = val[1]
+               }
+            }
+            if (best == "" || v["time"] < best)
+            {
+               best = v["time"]
+               line = sprintf("%s\t%s\t%s\t%s\t%d\t%s\t%s\t%s\t%s", commit, size, fmt, v["bytes"],
+                  v["waypoints"] + v["trackpoints"] + v["routepoints"], v["time"], v["MB/s"], v["points/s"], v["peak RSS"])
+            }
+         }
+         END {
+            if (line == "")
+               exit 1
+            print line
+         }' $TMP/runs || { echo "parsefsh failed" >&2; exit 1; }
+   done
+done
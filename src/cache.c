@@ -0,0 +1,299 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the output cache. It maps the content hash of an item
+ *  of an archive to its converted output. The cache of the previous run is
+ *  mapped read-only and looked up with a binary search, the items which are
+ *  not found are appended to a new cache file. When the cache is closed, the
+ *  entries of the previous run which were used or not used for less than
+ *  CACHE_MAX_AGE runs are copied to the new file which then replaces the old
+ *  one.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "cache.h"
+
+#define CACHE_K1 0x9e3779b97f4a7c15ULL
+#define CACHE_K2 0xbf58476d1ce4e5b9ULL
+
+
+/*! Continue the 64 bit hash h over len bytes of buf. The data is mixed in
+ * words of 8 bytes, thus it is fast enough to hash all track points of an
+ * archive. The hash of a sequence of calls depends on the length of each
+ * piece.
+ * @param h Hash of the preceding data or an arbitrary seed.
+ * @return Returns the new hash.
+ */
+uint64_t cache_hash(uint64_t h, const void *buf, size_t len)
+{
+   const char *p = buf;
+   uint64_t v;
+
+   for (; len >= sizeof(v); p += sizeof(v), len -= sizeof(v))
+   {
+      memcpy(&v, p, sizeof(v));
+      h = (h ^ v) * CACHE_K1;
+      h ^= h >> 29;
+   }
+
+   v = (uint64_t) len << 56;
+   if (len)
+      memcpy(&v, p, len);
+   h = (h ^ v) * CACHE_K2;
+   h ^= h >> 32;
+   return h;
+}
+
+
+/*! Map the cache file of the previous run. A file which is missing or
+ * invalid is ignored, it is replaced when the cache is closed.
+ */
+static void cache_load(cache_t *c)
+{
+   const cache_header_t *hdr;
+   struct stat st;
+   long i;
+   int fd;
+
+   if ((fd = open(c->path, O_RDONLY)) == -1)
+      return;
+   if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(*hdr)
+         || (c->base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+   {
+      c->base = NULL;
+      close(fd);
+      return;
+   }
+   close(fd);
+   c->size = st.st_size;
+
+   hdr = (cache_header_t*) c->base;
+   if (memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) || hdr->version != CACHE_VERSION
+         || hdr->ent_size != sizeof(cache_ent_t) || hdr->tab % sizeof(uint64_t)
+         || hdr->tab > c->size || hdr->cnt > (c->size - hdr->tab) / sizeof(cache_ent_t))
+      goto invalid;
+
+   c->ent = (cache_ent_t*) (c->base + hdr->tab);
+   c->cnt = hdr->cnt;
+   for (i = 0; i < c->cnt; i++)
+      if (c->ent[i].off > hdr->tab || c->ent[i].len > hdr->tab - c->ent[i].off
+            || (i && c->ent[i - 1].key > c->ent[i].key))
+         goto invalid;
+
+   if ((c->used = calloc(c->cnt + 1, 1)) == NULL)
+      perror("calloc"), exit(EXIT_FAILURE);
+   return;
+
+invalid:
+   munmap(c->base, c->size);
+   c->base = NULL;
+   c->ent = NULL;
+   c->cnt = 0;
+}
+
+
+/*! Open the cache name in the directory dir. All settings which change the
+ * output of an item have to be encoded in the name.
+ * @return Returns a pointer to the cache or NULL if the new cache file could
+ * not be created. In the latter case errno is set appropriately.
+ */
+cache_t *cache_open(const char *dir, const char *name)
+{
+   cache_header_t hdr;
+   cache_t *c;
+   size_t len;
+   int fd;
+
+   if ((c = calloc(1, sizeof(*c))) == NULL)
+      perror("calloc"), exit(EXIT_FAILURE);
+   len = strlen(dir) + strlen(name) + 32;
+   if ((c->path = malloc(len)) == NULL || (c->tmp = malloc(len)) == NULL)
+      perror("malloc"), exit(EXIT_FAILURE);
+   snprintf(c->path, len, "%s/%s.cache", dir, name);
+   snprintf(c->tmp, len, "%s.%d", c->path, (int) getpid());
+
+   if ((fd = open(c->tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+   {
+      free(c->path);
+      free(c->tmp);
+      free(c);
+      return NULL;
+   }
+
+   cache_load(c);
+   pthread_mutex_init(&c->mutex, NULL);
+   c->out = ob_open(fd, OBUF_SIZE);
+   // the header is written when the cache is closed
+   memset(&hdr, 0, sizeof(hdr));
+   ob_write(c->out, &hdr, sizeof(hdr));
+   c->off = sizeof(hdr);
+
+   return c;
+}
+
+
+/*! Look up the item key in the cache of the previous run. This function is
+ * thread-safe.
+ * @param len Pointer to a variable which receives the length of the data.
+ * @return Returns a pointer to the data or NULL if it is not found. The data
+ * is valid until the cache is closed.
+ */
+const void *cache_get(cache_t *c, uint64_t key, size_t *len)
+{
+   long lo, hi, m;
+
+   for (lo = 0, hi = c->cnt; lo < hi;)
+   {
+      m = lo + (hi - lo) / 2;
+      if (c->ent[m].key < key)
+         lo = m + 1;
+      else
+         hi = m;
+   }
+
+   if (lo >= c->cnt || c->ent[lo].key != key)
+      return NULL;
+
+   __sync_lock_test_and_set(&c->used[lo], 1);
+   __sync_fetch_and_add(&c->hits, 1);
+   __sync_fetch_and_add(&c->hit_bytes, c->ent[lo].len);
+   *len = c->ent[lo].len;
+   return c->base + c->ent[lo].off;
+}
+
+
+/*! Append the entry key with len bytes of data at file offset off to the
+ * list of new entries. The caller must hold the mutex.
+ */
+static void cache_add(cache_t *c, uint64_t key, uint64_t off, size_t len, int age)
+{
+   if (!(c->add_cnt & 1023) && (c->add = realloc(c->add, sizeof(*c->add) * (c->add_cnt + 1024))) == NULL)
+      perror("realloc"), exit(EXIT_FAILURE);
+
+   c->add[c->add_cnt].key = key;
+   c->add[c->add_cnt].off = off;
+   c->add[c->add_cnt].len = len;
+   c->add[c->add_cnt].age = age;
+   c->add_cnt++;
+}
+
+
+/*! Add the data of the item key to the cache. This function is thread-safe.
+ */
+void cache_put(cache_t *c, uint64_t key, const void *data, size_t len)
+{
+   pthread_mutex_lock(&c->mutex);
+   cache_add(c, key, c->off, len, 0);
+   ob_write(c->out, data, len);
+   c->off += len;
+   c->misses++;
+   pthread_mutex_unlock(&c->mutex);
+}
+
+
+static int cmp_ent(const void *a, const void *b)
+{
+   const cache_ent_t *x = a, *y = b;
+
+   if (x->key != y->key)
+      return x->key < y->key ? -1 : 1;
+   return x->off < y->off ? -1 : x->off > y->off;
+}
+
+
+/*! Write the new cache file, replace the old one with it, and free the
+ * cache. All pointers returned by cache_get() become invalid.
+ * @return Returns 0 on success or -1 on error, errno is set appropriately.
+ */
+int cache_close(cache_t *c)
+{
+   static const char pad[sizeof(uint64_t)];
+   cache_header_t hdr;
+   long i, n;
+   int fd, err;
+
+   // the old file is still up to date if all items were found
+   for (i = 0; i < c->cnt && c->used[i]; i++);
+   if (!c->add_cnt && c->base != NULL && i == c->cnt)
+   {
+      fd = c->out->fd;
+      ob_close(c->out);
+      close(fd);
+      unlink(c->tmp);
+      err = 0;
+      goto done;
+   }
+
+   // keep the entries of the previous run which are still in use
+   for (i = 0; i < c->cnt; i++)
+   {
+      if (!c->used[i] && c->ent[i].age + 1 >= CACHE_MAX_AGE)
+         continue;
+      cache_add(c, c->ent[i].key, c->off, c->ent[i].len, c->used[i] ? 0 : c->ent[i].age + 1);
+      ob_write(c->out, c->base + c->ent[i].off, c->ent[i].len);
+      c->off += c->ent[i].len;
+   }
+
+   // the same item may have been added several times
+   qsort(c->add, c->add_cnt, sizeof(*c->add), cmp_ent);
+   for (i = 0, n = 0; i < c->add_cnt; i++)
+      if (!n || c->add[n - 1].key != c->add[i].key)
+         c->add[n++] = c->add[i];
+
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+   hdr.version = CACHE_VERSION;
+   hdr.ent_size = sizeof(cache_ent_t);
+   hdr.cnt = n;
+   hdr.tab = (c->off + sizeof(pad) - 1) & ~(uint64_t) (sizeof(pad) - 1);
+   ob_write(c->out, pad, hdr.tab - c->off);
+   ob_write(c->out, c->add, sizeof(*c->add) * n);
+
+   fd = c->out->fd;
+   ob_close(c->out);
+   err = pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr);
+   if (close(fd) == -1 || err || rename(c->tmp, c->path) == -1)
+   {
+      err = errno;
+      unlink(c->tmp);
+      errno = err;
+      err = -1;
+   }
+
+done:
+   if (c->base != NULL)
+      munmap(c->base, c->size);
+   pthread_mutex_destroy(&c->mutex);
+   free(c->used);
+   free(c->add);
+   free(c->path);
+   free(c->tmp);
+   free(c);
+   return err;
+}
+
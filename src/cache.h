@@ -0,0 +1,87 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the data structures and prototypes of the output
+ *  cache.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "obuf.h"
+
+#define CACHE_MAGIC "FSHCACH"
+#define CACHE_VERSION 1
+// number of runs an unused entry is kept in the cache
+#define CACHE_MAX_AGE 4
+
+// header of a cache file
+typedef struct cache_header
+{
+   char magic[8];       //!< CACHE_MAGIC
+   uint32_t version;    //!< CACHE_VERSION
+   uint32_t ent_size;   //!< sizeof(cache_ent_t)
+   uint64_t cnt;        //!< number of entries
+   uint64_t tab;        //!< file offset of the entry table
+} cache_header_t;
+
+// entry of the table of a cache file, the table is sorted by key
+typedef struct cache_ent
+{
+   uint64_t key;        //!< content hash of the item
+   uint64_t off;        //!< file offset of the data
+   uint32_t len;        //!< length of the data
+   uint32_t age;        //!< number of runs the entry was not used
+} cache_ent_t;
+
+// cache state
+typedef struct cache
+{
+   char *path;             //!< path of the cache file
+   char *base;             //!< mapping of the cache file of the previous run, NULL if none
+   size_t size;            //!< size of the mapping
+   const cache_ent_t *ent; //!< entries of the previous run
+   long cnt;               //!< number of entries in ent
+   char *used;             //!< flags of the entries in ent which were used
+
+   pthread_mutex_t mutex;  //!< protects the following members
+   char *tmp;              //!< path of the new cache file
+   obuf_t *out;            //!< output buffer of the new cache file
+   uint64_t off;           //!< number of bytes written to out
+   cache_ent_t *add;       //!< entries added by this run
+   long add_cnt;           //!< number of entries in add
+   long misses;            //!< number of items added
+
+   long hits;              //!< number of items found, updated atomically
+   long long hit_bytes;    //!< number of bytes reused, updated atomically
+} cache_t;
+
+
+uint64_t cache_hash(uint64_t , const void *, size_t );
+cache_t *cache_open(const char *, const char *);
+const void *cache_get(cache_t *, uint64_t , size_t *);
+void cache_put(cache_t *, uint64_t , const void *, size_t );
+int cache_close(cache_t *);
+
+#endif
+
@@ -0,0 +1,210 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the item filter. The predicates are checked against
+ *  the headers of the items (waypoint data, track meta, route header) before
+ *  any point is projected. Track segments are only looked at if the meta
+ *  data does not decide already.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "filter.h"
+
+
+#define DEG2RAD(x) ((x) * M_PI / 180.0)
+// max. latitude up to which the track length is used to bound a track
+#define BOUND_LAT 85.0
+
+
+/*! Set the bounding box of the filter. If west is greater than east the box
+ * crosses the antimeridian. The ellipsoid flt->el has to be set before.
+ */
+void fsh_filter_bbox(fsh_filter_t *flt, double south, double west, double north, double east)
+{
+   flt->bbox = 1;
+   flt->north0 = fsh_north(flt->el, south);
+   flt->north1 = fsh_north(flt->el, north);
+   flt->east0 = fsh_east(west);
+   flt->east1 = fsh_east(east);
+}
+
+
+/*! Return 1 if the point north/east is within the bounding box. */
+static int in_bbox(const fsh_filter_t *flt, int32_t north, int32_t east)
+{
+   if (north < flt->north0 || north > flt->north1)
+      return 0;
+   if (flt->east0 <= flt->east1)
+      return east >= flt->east0 && east <= flt->east1;
+   return east >= flt->east0 || east <= flt->east1;
+}
+
+
+/*! Return 1 if the name of len characters (not terminated) matches the
+ * pattern of the filter. The name ends at the first \0.
+ */
+static int name_match(const fsh_filter_t *flt, const char *name, int len)
+{
+   char buf[256];
+
+   if (len < 0)
+      len = 0;
+   len = strnlen(name, len);
+   memcpy(buf, name, len);
+   buf[len] = '\0';
+   return !regexec(flt->name, buf, 0, NULL, 0);
+}
+
+
+/*! Check if the track may intersect the bounding box by its meta data only.
+ * Any point of the track is not farther from the first and the last point
+ * than the track length, thus the track is within the intersection of two
+ * boxes around its endpoints. Since the length is only approximate it is
+ * taken with a margin.
+ * @return Returns 0 if the track is outside of the bounding box for sure,
+ * otherwise 1, i.e. also if the length is unknown or the boxes would be too
+ * large (high latitudes, antimeridian).
+ */
+static int track_near(const fsh_filter_t *flt, const fsh_track_meta_t *mta)
+{
+   double len, phi, k, dn, de, n0, n1, e0, e1;
+
+   if (mta->length <= 0 || llabs((int64_t) mta->east_start - mta->east_end) > INT32_MAX / 2)
+      return 1;
+
+   len = mta->length * 1.2 + 1000;
+   phi = fmax(fabs(phi_merc(flt->el, mta->north_start / FSH_LAT_SCALE)),
+         fabs(phi_merc(flt->el, mta->north_end / FSH_LAT_SCALE))) + len / flt->el->b;
+   if (phi >= DEG2RAD(BOUND_LAT))
+      return 1;
+
+   // scale of the Mercator projection at the highest latitude
+   k = cos(phi) / sqrt(1 - pow(flt->el->e * sin(phi), 2));
+   dn = len / k * FSH_LAT_SCALE;
+   de = len / (flt->el->a * k) / M_PI * FSH_LON_SCALE;
+
+   n0 = fmax(mta->north_start, mta->north_end) - dn;
+   n1 = fmin(mta->north_start, mta->north_end) + dn;
+   e0 = fmax(mta->east_start, mta->east_end) - de;
+   e1 = fmin(mta->east_start, mta->east_end) + de;
+   if (e0 < INT32_MIN || e1 > INT32_MAX)
+      return 1;
+
+   if (n1 < flt->north0 || n0 > flt->north1)
+      return 0;
+   if (flt->east0 <= flt->east1)
+      return e1 >= flt->east0 && e0 <= flt->east1;
+   return e1 >= flt->east0 || e0 <= flt->east1;
+}
+
+
+/*! Return 1 if any valid point of the track segment is within the bounding
+ * box.
+ */
+static int tseg_match(const fsh_filter_t *flt, const track_segment_t *tseg)
+{
+   int i;
+
+   for (i = 0; i < tseg->hdr->cnt; i++)
+      if (tseg->pt[i].c != -1 && in_bbox(flt, tseg->pt[i].north, tseg->pt[i].east))
+         return 1;
+   return 0;
+}
+
+
+/*! Check if a waypoint matches the filter.
+ * @return Returns 1 if it matches, otherwise 0.
+ */
+int fsh_filter_wpt(const fsh_filter_t *flt, const fsh_wpt_data_t *wpd)
+{
+   if (flt->bbox && !in_bbox(flt, wpd->north, wpd->east))
+      return 0;
+   if (flt->name != NULL && !name_match(flt, NAME(*wpd), wpd->name_len))
+      return 0;
+   return 1;
+}
+
+
+/*! Check if a track matches the filter. The name is checked first, then the
+ * meta data, and the segments last. Segments which do not have any point
+ * within the bounding box are removed from the track, i.e. their pointers
+ * are set to NULL like those of missing segments.
+ * @param trk Pointer to the track, its segment list is modified.
+ * @return Returns 1 if the track matches, otherwise 0.
+ */
+int fsh_filter_track(const fsh_filter_t *flt, track_t *trk)
+{
+   int i, cnt;
+
+   if (flt->name != NULL && !name_match(flt, trk->mta->name, sizeof(trk->mta->name)))
+      return 0;
+   if (flt->bbox && !track_near(flt, trk->mta))
+      return 0;
+
+   if (flt->min_pts > 0)
+   {
+      for (i = 0, cnt = 0; i < trk->mta->guid_cnt; i++)
+         if (trk->tseg[i].hdr != NULL)
+            cnt += trk->tseg[i].hdr->cnt;
+      if (cnt < flt->min_pts)
+         return 0;
+   }
+
+   if (!flt->bbox)
+      return 1;
+
+   for (i = 0, cnt = 0; i < trk->mta->guid_cnt; i++)
+   {
+      if (trk->tseg[i].hdr == NULL)
+         continue;
+      if (tseg_match(flt, &trk->tseg[i]))
+         cnt++;
+      else
+         memset(&trk->tseg[i], 0, sizeof(trk->tseg[i]));
+   }
+   return cnt > 0;
+}
+
+
+/*! Check if a route matches the filter. It is within the bounding box if any
+ * of its waypoints is.
+ * @return Returns 1 if the route matches, otherwise 0.
+ */
+int fsh_filter_route(const fsh_filter_t *flt, const route21_t *rte)
+{
+   const fsh_route_wpt_t *wpt;
+   int i;
+
+   if (flt->name != NULL && !name_match(flt, NAME(*rte->hdr), rte->hdr->name_len))
+      return 0;
+   if (!flt->bbox)
+      return 1;
+
+   for (i = 0, wpt = rte->wpt; i < rte->hdr3->wpt_cnt; i++)
+   {
+      if (in_bbox(flt, wpt->wpt.wpd.north, wpt->wpt.wpd.east))
+         return 1;
+      wpt = (const fsh_route_wpt_t*) ((const char*) wpt + sizeof(*wpt) + wpt->wpt.wpd.name_len + wpt->wpt.wpd.cmt_len);
+   }
+   return 0;
+}
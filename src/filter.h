@@ -0,0 +1,50 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the data structure and the prototypes of the item
+ *  filter.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+#include <regex.h>
+
+#include "fshfunc.h"
+#include "projection.h"
+
+// predicates which items must match, see fsh_ctx_set_filter()
+typedef struct fsh_filter
+{
+   int bbox;               //!< 1 if the bounding box is set
+   int32_t north0, east0;  //!< south-west corner in FSH units
+   int32_t north1, east1;  //!< north-east corner, east1 < east0 if the box crosses the antimeridian
+   const ellipsoid_t *el;  //!< ellipsoid of the Mercator projection
+   const regex_t *name;    //!< pattern the names have to match or NULL
+   int min_pts;            //!< min. number of points of a track
+} fsh_filter_t;
+
+
+void fsh_filter_bbox(fsh_filter_t *, double , double , double , double );
+int fsh_filter_wpt(const fsh_filter_t *, const fsh_wpt_data_t *);
+int fsh_filter_track(const fsh_filter_t *, track_t *);
+int fsh_filter_route(const fsh_filter_t *, const route21_t *);
+
+#endif
@@ -27,38 +27,104 @@
 #include <string.h>
 #include <inttypes.h>
 #include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 #include "fshfunc.h"
+#include "numfmt.h"
+#include "filter.h"
+#include "snapshot.h"
+#include "simplify.h"
 
 
-#ifdef HAVE_VLOG
-void vlog(const char*, ...) __attribute__((format (printf, 1, 2)));
-#else
-#define vlog(x...) fprintf(stderr, ## x)
-#endif
+// log function set by fsh_set_log(), the library is silent by default
+static int (*log_)(const char *, ...);
 
-char *guid_to_string(uint64_t guid)
+#define vlog(x...) (log_ != NULL ? log_(x) : 0)
+
+
+/*! Set the function which receives the informational output of the library.
+ * This is the only process-wide setting of the library and it should be set
+ * once before any archive is decoded.
+ * @param log Pointer to a printf()-like function or NULL to turn logging off.
+ */
+void fsh_set_log(int (*log)(const char *, ...))
+{
+   log_ = log;
+}
+
+
+/*! Return a string describing the error code err as returned by the library
+ * functions.
+ */
+const char *fsh_strerror(int err)
 {
-   static char buf[32];
+   switch (err)
+   {
+      case FSH_OK:
+         return "no error";
+      case FSH_ERR_HDR:
+         return "no RL90 header";
+      case FSH_ERR_IO:
+         return "I/O error";
+      case FSH_ERR_TRUNC:
+         return "file truncated";
+      case FSH_ERR_NOMEM:
+         return "out of memory";
+      case FSH_ERR_STATE:
+         return "archive not decoded";
+      case FSH_ERR_SNAP:
+         return "invalid snapshot";
+      default:
+         return "unknown error";
+   }
+}
 
-   snprintf(buf, sizeof(buf),  "%"PRIu64"-%"PRIu64"-%"PRIu64"-%"PRIu64,
+
+/*! Convert a GUID to its string representation.
+ * @param guid The GUID.
+ * @param buf Pointer to the destination buffer.
+ * @param len Length of buf, 24 bytes are always sufficient.
+ * @return Returns buf.
+ */
+char *fsh_guid_str(uint64_t guid, char *buf, int len)
+{
+   snprintf(buf, len,  "%"PRIu64"-%"PRIu64"-%"PRIu64"-%"PRIu64,
          guid >> 48, (guid >> 32) & 0xffff, (guid >> 16) & 0xffff, guid & 0xffff);
    return buf;
 }
 
 
-/*! This function converts an FSH timestamp into string representation.
+/*! Convert a GUID to a string like fsh_guid_str() but into a thread-local
+ * buffer which is overwritten by the next call of the same thread.
+ */
+char *guid_to_string(uint64_t guid)
+{
+   static __thread char buf[32];
+
+   return fsh_guid_str(guid, buf, sizeof(buf));
+}
+
+
+/*! This function converts an FSH timestamp into string representation. It
+ * is thread-safe, see fmt_time().
  * @param ts Pointer to FSH timestamp.
  * @param buf Pointer to buffer which will receive the string.
  * @paran len Length of buffer.
- * @return Returns the number of bytes placed into buf without the trailing \0.
+ * @return Returns the number of bytes placed into buf without the trailing \0
+ * or 0 if the buffer is too small.
  */
 int fsh_timetostr(const fsh_timestamp_t *ts, char *buf, int len)
 {
-   time_t t = (time_t) ts->date * 3600 * 24 + ts->timeofday;
-   struct tm *tm = gmtime(&t);
-   return strftime(buf, len, "%Y-%m-%dT%H:%M:%SZ", tm);
+   if (len <= FMT_TIME_LEN)
+      return 0;
+
+   *fmt_time(buf, (int64_t) ts->date * 3600 * 24 + ts->timeofday) = '\0';
+   return FMT_TIME_LEN;
 }
 
 
@@ -67,21 +133,24 @@ int fsh_timetostr(const fsh_timestamp_t *ts, char *buf, int len)
  *  @param fhdr Pointer to fsh_file_header_t which will be filled by this
  *  function.
  *  @return Returns 0 if it es a file header (the first one). The function returns
- *  -1 in case of error. If an I/O error occurs the function does not return.
+ *  FSH_ERR_HDR (-1) if it is not an RL90 header, FSH_ERR_IO on I/O errors, or
+ *  FSH_ERR_TRUNC if the header is truncated.
  */
 int fsh_read_file_header(int fd, fsh_file_header_t *fhdr)
 {
    int len;
 
    if ((len = read(fd, fhdr, sizeof(*fhdr))) == -1)
-      perror("read"), exit(EXIT_FAILURE);
+      return FSH_ERR_IO;
 
    if (len < (int) sizeof(*fhdr))
-      fprintf(stderr, "# file header truncated, read %d of %d\n", len, (int) sizeof(*fhdr)),
-         exit(EXIT_FAILURE);
+   {
+      vlog("file header truncated, read %d of %d\n", len, (int) sizeof(*fhdr));
+      return FSH_ERR_TRUNC;
+   }
 
    if (memcmp(fhdr->rl90, RL90_STR, strlen(RL90_STR)))
-      return -1;
+      return FSH_ERR_HDR;
 
    return 0;
 }
@@ -93,14 +162,16 @@ int fsh_read_flob_header(int fd, fsh_flob_header_t *flobhdr)
    int len;
 
    if ((len = read(fd, flobhdr, sizeof(*flobhdr))) == -1)
-      perror("read"), exit(EXIT_FAILURE);
+      return FSH_ERR_IO;
 
    if (len < (int) sizeof(*flobhdr))
-      fprintf(stderr, "# flob header truncated, read %d of %d\n", len, (int) sizeof(*flobhdr)),
-         exit(EXIT_FAILURE);
+   {
+      vlog("flob header truncated, read %d of %d\n", len, (int) sizeof(*flobhdr));
+      return FSH_ERR_TRUNC;
+   }
 
    if (memcmp(flobhdr->rflob, RFLOB_STR, strlen(RFLOB_STR)))
-      return -1;
+      return FSH_ERR_HDR;
 
    return 0;
 }
@@ -120,26 +191,38 @@ static int fsh_block_count(const fsh_block_t *blk)
 
 
 /*! This function reads all blocks into a fsh_block_t list. The type of the
- * last block (which does not contain data anymore) is set to 0xffff.
- * @return Returns a pointer to the first fsh_block_t. The list MUST be freed
- * by the caller again with a call to free and the pointer to the first block.
+ * last block (which does not contain data anymore) is set to 0xffff. The list
+ * and the block data are allocated from the arena, the list is grown by
+ * doubling its size.
+ * @param blk Pointer to a block list of the same arena to which the blocks
+ * are appended or NULL.
+ * @return Returns a pointer to the first fsh_block_t which is valid as long as
+ * the arena. In case of an error NULL is returned, errno is set
+ * appropriately.
  */
-fsh_block_t *fsh_block_read(int fd, fsh_block_t *blk)
+fsh_block_t *fsh_block_read(int fd, fsh_block_t *blk, fsh_arena_t *arena)
 {
-   int blk_cnt, len, pos, rlen;
-   //fsh_block_t *blk = NULL;
+   int blk_cnt, blk_size, len, pos, rlen;
+   fsh_block_t *b;
    off_t off;
 
-   if ((off = lseek(fd, 0, SEEK_CUR)) == -1)
-      perror("lseek"), exit(EXIT_FAILURE);
-
    blk_cnt = fsh_block_count(blk);
+   blk_size = blk != NULL ? blk_cnt + 1 : 0;
+
+   if ((off = lseek(fd, 0, SEEK_CUR)) == -1)
+      return NULL;
 
    for (pos = 0; ; blk_cnt++)   // 0x2a is the start offset after the file header
    {
-      if ((blk = realloc(blk, sizeof(*blk) * (blk_cnt + 1))) == NULL)
-         perror("realloc"), exit(EXIT_FAILURE);
+      if (blk_cnt >= blk_size)
+      {
+         if ((b = fsh_arena_grow(arena, blk, sizeof(*blk) * blk_size, sizeof(*blk) * (blk_size ? blk_size * 2 : 64))) == NULL)
+            return NULL;
+         blk = b;
+         blk_size = blk_size ? blk_size * 2 : 64;
+      }
       blk[blk_cnt].data = NULL;
+      blk[blk_cnt].mapped = 0;
 
       // check if there's enough space left in the FLOB
       if (pos + sizeof(fsh_block_header_t) + sizeof(fsh_flob_header_t) > FLOB_SIZE)
@@ -150,7 +233,7 @@ fsh_block_t *fsh_block_read(int fd, fsh_block_t *blk)
       }
 
       if ((len = read(fd, &blk[blk_cnt].hdr, sizeof(blk[blk_cnt].hdr))) == -1)
-         perror("read"), exit(EXIT_FAILURE);
+         return NULL;
 
       vlog("offset = $%08lx, pos = $%04x, block type = 0x%02x, len = %d, guid %s\n",
             pos + (long) off, pos, blk[blk_cnt].hdr.type, blk[blk_cnt].hdr.len, guid_to_string(blk[blk_cnt].hdr.guid));
@@ -169,61 +252,469 @@ fsh_block_t *fsh_block_read(int fd, fsh_block_t *blk)
       }
 
       rlen = blk[blk_cnt].hdr.len + (blk[blk_cnt].hdr.len & 1);  // pad odd blocks by 1 byte
-      if ((blk[blk_cnt].data = malloc(rlen)) == NULL)
-         perror("malloc"), exit(EXIT_FAILURE);
-
-      if ((len = read(fd, blk[blk_cnt].data, rlen)) == -1)
-         perror("read"), exit(EXIT_FAILURE);
+      if ((blk[blk_cnt].data = fsh_arena_alloc(arena, rlen)) == NULL || (len = read(fd, blk[blk_cnt].data, rlen)) == -1)
+         return NULL;
       pos += len;
 
       if (len < rlen)
       {
          vlog("block data truncated, read %d of %d\n", len, rlen);
-         // clear unfilled partition of block
+         // clear unfilled partition of block, the next header read will
+         // terminate the list
          memset(blk[blk_cnt].data + len, 0, rlen - len);
+      }
+   }
+
+   return blk;
+}
+
+
+/*! This function works like fsh_read_file_header() but takes the file header
+ * from a memory mapped FSH file. The header is copied to fhdr.
+ *  @param base Pointer to the beginning of the mapped file.
+ *  @param size Size of the mapping in bytes.
+ *  @param fhdr Pointer to fsh_file_header_t which will be filled by this
+ *  function.
+ *  @return Returns 0 on success, FSH_ERR_HDR (-1) if it is not an RL90 file
+ *  header, or FSH_ERR_TRUNC if the file is truncated.
+ */
+int fsh_map_file_header(const void *base, long size, fsh_file_header_t *fhdr)
+{
+   if (size < (long) sizeof(*fhdr))
+   {
+      vlog("file header truncated, read %ld of %d\n", size, (int) sizeof(*fhdr));
+      return FSH_ERR_TRUNC;
+   }
+
+   memcpy(fhdr, base, sizeof(*fhdr));
+   if (memcmp(fhdr->rl90, RL90_STR, strlen(RL90_STR)))
+      return FSH_ERR_HDR;
+
+   return 0;
+}
+
+
+/*! This function returns a pointer to the header of the FLOB number n within
+ * a memory mapped FSH file.
+ *  @param base Pointer to the beginning of the mapped file.
+ *  @param size Size of the mapping in bytes.
+ *  @param n Number of the FLOB, starting at 0.
+ *  @return Returns a pointer to the FLOB header within the mapping or NULL if
+ *  the FLOB is beyond the end of the file or if it has no valid FLOB header.
+ */
+const fsh_flob_header_t *fsh_map_flob_header(const void *base, long size, int n)
+{
+   const fsh_flob_header_t *flobhdr;
+   long off = sizeof(fsh_file_header_t) + (long) n * FLOB_SIZE;
+
+   if (off + (long) sizeof(*flobhdr) > size)
+   {
+      vlog("flob header truncated\n");
+      return NULL;
+   }
+
+   flobhdr = (const fsh_flob_header_t*) ((const char*) base + off);
+   if (memcmp(flobhdr->rflob, RFLOB_STR, strlen(RFLOB_STR)))
+      return NULL;
+
+   return flobhdr;
+}
+
+
+/*! This function parses all blocks of a memory mapped FLOB and appends them
+ * to the fsh_block_t list blk exactly like fsh_block_read() does. The data
+ * pointers of the blocks point directly into the mapping, thus the mapping
+ * must stay valid as long as the block list is used. The blocks are counted
+ * first, hence the list is grown only once per FLOB. The list and the copies
+ * of truncated blocks are allocated from the arena.
+ * @param flobhdr Pointer to the FLOB header within the mapping.
+ * @param size Number of bytes available at flobhdr, i.e. FLOB_SIZE or less if
+ * the file is truncated.
+ * @param blk Pointer to a block list of the same arena to which the blocks
+ * are appended or NULL.
+ * @return Returns a pointer to the first fsh_block_t which is valid as long as
+ * the arena. If the memory is exhausted NULL is returned.
+ */
+fsh_block_t *fsh_block_map(const fsh_flob_header_t *flobhdr, long size, fsh_block_t *blk, fsh_arena_t *arena)
+{
+   const fsh_block_header_t *bhdr;
+   fsh_block_t *b;
+   const char *base = (const char*) (flobhdr + 1);
+   int blk_cnt, cnt, pos, rlen, len;
+
+   if (size > FLOB_SIZE)
+      size = FLOB_SIZE;
+   len = size - sizeof(*flobhdr);
+
+   // count blocks first
+   for (cnt = 0, pos = 0; pos + sizeof(fsh_block_header_t) + sizeof(fsh_flob_header_t) <= FLOB_SIZE; cnt++)
+   {
+      if (pos + (int) sizeof(*bhdr) > len)
+         break;
+      bhdr = (const fsh_block_header_t*) (base + pos);
+      if (bhdr->type == FSH_BLK_ILL)
          break;
+      pos += sizeof(*bhdr) + bhdr->len + (bhdr->len & 1);
+      if (pos > len)
+      {
+         cnt++;
+         break;
+      }
+   }
+
+   blk_cnt = fsh_block_count(blk);
+   if ((b = fsh_arena_grow(arena, blk, blk != NULL ? sizeof(*blk) * (blk_cnt + 1) : 0, sizeof(*blk) * (blk_cnt + cnt + 1))) == NULL)
+      return NULL;
+   blk = b;
+
+   for (pos = 0; cnt; cnt--, blk_cnt++)
+   {
+      bhdr = (const fsh_block_header_t*) (base + pos);
+      memcpy(&blk[blk_cnt].hdr, bhdr, sizeof(*bhdr));
+      vlog("pos = $%04x, block type = 0x%02x, len = %d, guid %s\n",
+            pos, blk[blk_cnt].hdr.type, blk[blk_cnt].hdr.len, guid_to_string(blk[blk_cnt].hdr.guid));
+      pos += sizeof(*bhdr);
+
+      rlen = bhdr->len + (bhdr->len & 1);
+      if (pos + rlen <= len)
+      {
+         blk[blk_cnt].data = (void*) (base + pos);
+         blk[blk_cnt].mapped = 1;
+      }
+      else
+      {
+         // truncated block is copied and padded with 0
+         vlog("block data truncated, read %d of %d\n", len - pos, rlen);
+         if ((blk[blk_cnt].data = fsh_arena_alloc(arena, rlen)) == NULL)
+            return NULL;
+         memcpy(blk[blk_cnt].data, base + pos, len - pos);
+         memset((char*) blk[blk_cnt].data + len - pos, 0, rlen - (len - pos));
+         blk[blk_cnt].mapped = 0;
       }
+      pos += rlen;
    }
+
+   blk[blk_cnt].hdr.type = FSH_BLK_ILL;
+   blk[blk_cnt].data = NULL;
+   blk[blk_cnt].mapped = 0;
+
+   return blk;
+}
+
+
+static unsigned guid_hash(uint64_t guid)
+{
+   guid ^= guid >> 33;
+   guid *= 0xff51afd7ed558ccdULL;
+   guid ^= guid >> 33;
+   return guid;
+}
+
+
+/*! Insert the block blk into the hash table. A block of the same GUID and
+ * type is replaced.
+ */
+static void guid_insert(fsh_guid_index_t *idx, const fsh_block_t *blk)
+{
+   unsigned h;
+
+   for (h = guid_hash(blk->hdr.guid) & idx->mask; idx->slot[h] != NULL; h = (h + 1) & idx->mask)
+      if (idx->slot[h]->hdr.guid == blk->hdr.guid && idx->slot[h]->hdr.type == blk->hdr.type)
+         break;
+   idx->slot[h] = blk;
+}
+
+
+/*! This function builds a hash index of all blocks of the block list in a
+ * single pass. The blocks can be looked up afterwards by their GUID and type
+ * with fsh_guid_lookup(). It is used to resolve the GUIDs of the track
+ * segments of a track. If several blocks of the same type have the same GUID
+ * the last one in the list is kept.
+ * @param idx Pointer to the index structure which will be initialized.
+ * @param blk Pointer to the first block.
+ * @return Returns the number of blocks in the index or FSH_ERR_NOMEM. The
+ * index must be freed again with fsh_guid_index_free().
+ */
+int fsh_guid_index_init(fsh_guid_index_t *idx, const fsh_block_t *blk)
+{
+   unsigned size;
+   int cnt;
+
+   cnt = fsh_block_count(blk);
+   for (size = 16; size < (unsigned) cnt * 2; size <<= 1);
+
+   idx->mask = size - 1;
+   idx->cnt = cnt;
+   if ((idx->slot = calloc(size, sizeof(*idx->slot))) == NULL)
+      return FSH_ERR_NOMEM;
+
+   for (; blk != NULL && blk->hdr.type != FSH_BLK_ILL; blk++)
+      guid_insert(idx, blk);
+
+   return cnt;
+}
+
+
+/*! Add a single block to a GUID index, e.g. to an empty index created with
+ * fsh_guid_index_init(idx, NULL). The hash table is doubled if it gets half
+ * full. A block of the same GUID and type is replaced.
+ * @param blk Pointer to the block which must stay valid as long as it is in
+ * the index.
+ * @return Returns 0 on success or FSH_ERR_NOMEM.
+ */
+int fsh_guid_index_add(fsh_guid_index_t *idx, const fsh_block_t *blk)
+{
+   const fsh_block_t **slot;
+   unsigned i, mask;
+
+   if (2 * (idx->cnt + 1) > idx->mask + 1)
+   {
+      slot = idx->slot;
+      mask = idx->mask;
+      idx->mask = mask * 2 + 1;
+      if ((idx->slot = calloc(idx->mask + 1, sizeof(*idx->slot))) == NULL)
+      {
+         idx->slot = slot;
+         idx->mask = mask;
+         return FSH_ERR_NOMEM;
+      }
+      for (i = 0, idx->cnt = 0; i <= mask; i++)
+         if (slot[i] != NULL)
+         {
+            guid_insert(idx, slot[i]);
+            idx->cnt++;
+         }
+      free(slot);
+   }
+
+   guid_insert(idx, blk);
+   idx->cnt++;
+   return 0;
+}
+
+
+/*! Remove the block blk from a GUID index. The following blocks of the
+ * cluster are moved back, thus no tombstones are needed.
+ */
+void fsh_guid_index_del(fsh_guid_index_t *idx, const fsh_block_t *blk)
+{
+   unsigned h, i, k;
+
+   for (h = guid_hash(blk->hdr.guid) & idx->mask; idx->slot[h] != blk; h = (h + 1) & idx->mask)
+      if (idx->slot[h] == NULL)
+         return;
+
+   idx->slot[h] = NULL;
+   for (i = (h + 1) & idx->mask; idx->slot[i] != NULL; i = (i + 1) & idx->mask)
+   {
+      // move the block into the gap unless its home slot k is behind the gap
+      k = guid_hash(idx->slot[i]->hdr.guid) & idx->mask;
+      if (((i - k) & idx->mask) >= ((i - h) & idx->mask))
+      {
+         idx->slot[h] = idx->slot[i];
+         idx->slot[i] = NULL;
+         h = i;
+      }
+   }
+   if (idx->cnt)
+      idx->cnt--;
+}
+
+
+/*! Free the hash table of a GUID index. */
+void fsh_guid_index_free(fsh_guid_index_t *idx)
+{
+   free(idx->slot);
+   idx->slot = NULL;
+}
+
+
+/*! Look up a block by its GUID and type.
+ * @param idx Pointer to the index created with fsh_guid_index_init().
+ * @param guid GUID of the block.
+ * @param type Type of the block, e.g. FSH_BLK_TRK.
+ * @return Returns a pointer to the block or NULL if there is no such block.
+ */
+const fsh_block_t *fsh_guid_lookup(const fsh_guid_index_t *idx, uint64_t guid, uint16_t type)
+{
+   unsigned h;
+
+   for (h = guid_hash(guid) & idx->mask; idx->slot[h] != NULL; h = (h + 1) & idx->mask)
+      if (idx->slot[h]->hdr.guid == guid && idx->slot[h]->hdr.type == type)
+         return idx->slot[h];
+
+   return NULL;
+}
+
+
+// shared state of the FLOB decoder threads
+struct flob_job
+{
+   const void *base;    //!< pointer to the mapped file
+   long size;           //!< size of the mapping
+   int flobs;           //!< number of FLOBs
+   int next;            //!< next FLOB to be decoded
+   int err;             //!< set to 1 if a thread ran out of memory
+   fsh_block_t **blk;   //!< list of block lists, one per FLOB
+};
+
+// state of a single FLOB decoder thread
+struct flob_worker
+{
+   pthread_t th;
+   struct flob_job *job;
+   fsh_arena_t arena;   //!< memory of the block lists decoded by the thread
+};
+
+
+static void *flob_worker(void *p)
+{
+   struct flob_worker *w = p;
+   struct flob_job *job = w->job;
+   const fsh_flob_header_t *flob;
+   int n;
+
+   while ((n = __sync_fetch_and_add(&job->next, 1)) < job->flobs)
+   {
+      if ((flob = fsh_map_flob_header(job->base, job->size, n)) == NULL)
+         continue;
+      if ((job->blk[n] = fsh_block_map(flob, (const char*) job->base + job->size - (const char*) flob, NULL, &w->arena)) == NULL)
+         job->err = 1;
+   }
+
+   return NULL;
+}
+
+
+/*! This function decodes the blocks of all FLOBs of a memory mapped FSH file
+ * in parallel on nthreads threads. The block lists of the FLOBs are merged in
+ * FLOB order afterwards, thus the result is exactly the same as if
+ * fsh_block_map() was called for each FLOB sequentially. The calling thread
+ * is one of the nthreads threads. If a thread cannot be created the FLOBs are
+ * decoded by the threads which are already running. Each thread has its own
+ * arena, only the merged list and the copies of truncated blocks are
+ * allocated from arena.
+ * @param base Pointer to the beginning of the mapped file.
+ * @param size Size of the mapping in bytes.
+ * @param flobs Number of FLOBs as found in the file header.
+ * @param nthreads Number of threads.
+ * @return Returns a pointer to the first fsh_block_t, see fsh_block_map(), or
+ * NULL if the memory is exhausted.
+ */
+fsh_block_t *fsh_block_map_parallel(const void *base, long size, int flobs, int nthreads, fsh_arena_t *arena)
+{
+   struct flob_job job;
+   struct flob_worker *w;
+   fsh_block_t *blk = NULL, *b;
+   void *data;
+   int i, n, cnt, rlen;
+
+   job.base = base;
+   job.size = size;
+   job.flobs = flobs;
+   job.next = 0;
+   job.err = 0;
+   if ((job.blk = calloc(flobs, sizeof(*job.blk))) == NULL)
+      return NULL;
+   if ((w = calloc(nthreads, sizeof(*w))) == NULL)
+   {
+      free(job.blk);
+      return NULL;
+   }
+   for (i = 0; i < nthreads; i++)
+      w[i].job = &job;
+
+   // the calling thread is the last worker
+   for (n = 0; n < nthreads - 1; n++)
+      if ((errno = pthread_create(&w[n].th, NULL, flob_worker, &w[n])))
+      {
+         vlog("pthread_create() failed: %s\n", strerror(errno));
+         break;
+      }
+   flob_worker(&w[nthreads - 1]);
+   for (i = 0; i < n; i++)
+      pthread_join(w[i].th, NULL);
+
+   // merge lists up to the first FLOB with an invalid header
+   for (n = 0, cnt = 0; n < flobs && job.blk[n] != NULL; n++)
+      cnt += fsh_block_count(job.blk[n]);
+
+   if (!job.err && (blk = fsh_arena_alloc(arena, sizeof(*blk) * (cnt + 1))) != NULL)
+   {
+      for (i = 0, b = blk; i < n; i++)
+         for (cnt = 0; job.blk[i][cnt].hdr.type != FSH_BLK_ILL; cnt++, b++)
+         {
+            *b = job.blk[i][cnt];
+            if (b->mapped)
+               continue;
+            // truncated block, it is moved out of the thread's arena
+            rlen = b->hdr.len + (b->hdr.len & 1);
+            if ((data = fsh_arena_alloc(arena, rlen)) == NULL)
+            {
+               blk = NULL;
+               goto out;
+            }
+            b->data = memcpy(data, b->data, rlen);
+         }
+      b->hdr.type = FSH_BLK_ILL;
+      b->data = NULL;
+      b->mapped = 0;
+   }
+
+out:
+   for (i = 0; i < nthreads; i++)
+      fsh_arena_free(&w[i].arena);
+   free(job.blk);
+   free(w);
+
    return blk;
 }
 
 
 // FIXME: if GUID cross pointers in FSH file are incorrect, program will not
 // work correctly.
-static void fsh_tseg_decode0(const fsh_block_t *blk, track_t *trk)
+static void fsh_tseg_decode0(const fsh_guid_index_t *idx, track_t *trk)
 {
+   const fsh_block_t *blk;
    int i;
 
    vlog("decoding tracks\n");
-   for (; blk->hdr.type != FSH_BLK_ILL; blk++)
-      if (blk->hdr.type == FSH_BLK_TRK)
-         for (i = 0; i < trk->mta->guid_cnt; i++)
-            if (blk->hdr.guid == trk->mta->guid[i])
-            {
-               trk->tseg[i].bhdr = (fsh_block_header_t*) &blk->hdr;
-               trk->tseg[i].hdr = blk->data;
-               trk->tseg[i].pt = (fsh_track_point_t*) (trk->tseg[i].hdr + 1);
-            }
+   for (i = 0; i < trk->mta->guid_cnt; i++)
+   {
+      if ((blk = fsh_guid_lookup(idx, trk->mta->guid[i], FSH_BLK_TRK)) == NULL)
+      {
+         vlog("track segment %s not found\n", guid_to_string(trk->mta->guid[i]));
+         memset(&trk->tseg[i], 0, sizeof(trk->tseg[i]));
+         continue;
+      }
+      trk->tseg[i].bhdr = (fsh_block_header_t*) &blk->hdr;
+      trk->tseg[i].hdr = blk->data;
+      trk->tseg[i].pt = (fsh_track_point_t*) (trk->tseg[i].hdr + 1);
+      trk->tseg[i].ll = NULL;
+   }
 }
 
 
-static void fsh_tseg_decode(const fsh_block_t *blk, track_t *trk, int trk_cnt)
+static void fsh_tseg_decode(const fsh_guid_index_t *idx, track_t *trk, int trk_cnt)
 {
    for (; trk_cnt; trk_cnt--, trk++)
-      fsh_tseg_decode0(blk, trk);
+      fsh_tseg_decode0(idx, trk);
 }
 
 
 /*! This function decodes track blocks (0x0d and 0x0e) into a track_t structure.
+ * The track list and the segment lists of the tracks are allocated from the
+ * arena, the track list is grown by doubling its size.
  * @param blk Pointer to the first fsh block.
  * @param trk Pointer to a track_t pointer. This variable will receive a
- * pointer to the first track. The caller must free the track list again with a
- * pointer to the first track.
- * @return Returns the number of tracks that have been decoded.
+ * pointer to the first track which is valid as long as the arena.
+ * @return Returns the number of tracks that have been decoded or
+ * FSH_ERR_NOMEM.
  */
-static int fsh_track_decode0(const fsh_block_t *blk, track_t **trk)
+static int fsh_track_decode0(const fsh_block_t *blk, track_t **trk, fsh_arena_t *arena)
 {
-   int trk_cnt = 0;
+   track_t *t;
+   int trk_cnt = 0, trk_size = 0;
 
    vlog("decoding track metas\n");
    for (*trk = NULL; blk->hdr.type != FSH_BLK_ILL; blk++)
@@ -233,44 +724,81 @@ static int fsh_track_decode0(const fsh_block_t *blk, track_t **trk)
       {
          vlog("track meta\n");
 
-         if ((*trk = realloc(*trk, sizeof(**trk) * (trk_cnt + 1))) == NULL)
-            perror("realloc"), exit(EXIT_FAILURE);
+         if (trk_cnt >= trk_size)
+         {
+            if ((t = fsh_arena_grow(arena, *trk, sizeof(**trk) * trk_size, sizeof(**trk) * (trk_size ? trk_size * 2 : 16))) == NULL)
+               break;
+            *trk = t;
+            trk_size = trk_size ? trk_size * 2 : 16;
+         }
 
          (*trk)[trk_cnt].bhdr = (fsh_block_header_t*) &blk->hdr;
          (*trk)[trk_cnt].mta = blk->data;
 
-         if (((*trk)[trk_cnt].tseg = malloc(sizeof(*(*trk)[trk_cnt].tseg) * (*trk)[trk_cnt].mta->guid_cnt)) == NULL)
-            perror("malloc"), exit(EXIT_FAILURE);
+         if (((*trk)[trk_cnt].tseg = fsh_arena_alloc(arena, sizeof(*(*trk)[trk_cnt].tseg) * (*trk)[trk_cnt].mta->guid_cnt)) == NULL)
+            break;
 
          trk_cnt++;
       }
    }
 
+   if (blk->hdr.type != FSH_BLK_ILL)
+   {
+      *trk = NULL;
+      return FSH_ERR_NOMEM;
+   }
+
    return trk_cnt;
 }
 
 
-int fsh_track_decode(const fsh_block_t *blk, track_t **trk)
+/*! This function decodes all tracks and resolves their segments through the
+ * GUID index.
+ * @param blk Pointer to the first fsh block.
+ * @param idx Pointer to the GUID index of the block list.
+ * @param trk Pointer to a track_t pointer, see fsh_track_decode0().
+ * @param arena Arena from which the track list is allocated.
+ * @return Returns the number of tracks that have been decoded or
+ * FSH_ERR_NOMEM.
+ */
+int fsh_track_decode(const fsh_block_t *blk, const fsh_guid_index_t *idx, track_t **trk, fsh_arena_t *arena)
 {
    int trk_cnt;
 
-   trk_cnt = fsh_track_decode0(blk, trk);
-   fsh_tseg_decode(blk, *trk, trk_cnt);
+   if ((trk_cnt = fsh_track_decode0(blk, trk, arena)) > 0)
+      fsh_tseg_decode(idx, *trk, trk_cnt);
 
    return trk_cnt;
 }
 
 
+/*! Set the pointers of the route structure rte to the parts of the route
+ * block blk.
+ */
+static void fsh_route_decode0(const fsh_block_t *blk, route21_t *rte)
+{
+   rte->bhdr = (fsh_block_header_t*) &blk->hdr;
+   rte->hdr = blk->data;
+   rte->guid = (int64_t*) ((char*) (rte->hdr + 1) + rte->hdr->name_len + rte->hdr->cmt_len);
+   rte->hdr2 = (struct fsh_hdr2*) (rte->guid + rte->hdr->guid_cnt);
+   rte->pt = (struct fsh_pt*) (rte->hdr2 + 1);
+   rte->hdr3 = (struct fsh_hdr3*) (rte->pt + rte->hdr->guid_cnt);
+   rte->wpt = (fsh_route_wpt_t*) (rte->hdr3 + 1);
+}
+
+
 /*! This function decodes route blocks (0x21) into a route21_t structure.
+ * The route list is allocated from the arena and grown by doubling its size.
  * @param blk Pointer to the first fsh block.
  * @param trk Pointer to a route21_t pointer. This variable will receive a
- * pointer to the first route. The caller must free the route list again with a
- * pointer to the first route.
- * @return Returns the number of routes that have been decoded.
+ * pointer to the first route which is valid as long as the arena.
+ * @return Returns the number of routes that have been decoded or
+ * FSH_ERR_NOMEM.
  */
-int fsh_route_decode(const fsh_block_t *blk, route21_t **rte)
+int fsh_route_decode(const fsh_block_t *blk, route21_t **rte, fsh_arena_t *arena)
 {
-   int rte_cnt = 0;
+   route21_t *r;
+   int rte_cnt = 0, rte_size = 0;
 
    vlog("decoding routes\n");
    for (*rte = NULL; blk->hdr.type != FSH_BLK_ILL; blk++)
@@ -280,17 +808,17 @@ int fsh_route_decode(const fsh_block_t *blk, route21_t **rte)
       {
          case FSH_BLK_RTE:
             vlog("route21\n");
-            if ((*rte = realloc(*rte, sizeof(**rte) * (rte_cnt + 1))) == NULL)
-               perror("realloc"), exit(EXIT_FAILURE);
-
-            (*rte)[rte_cnt].bhdr = (fsh_block_header_t*) &blk->hdr;
-            (*rte)[rte_cnt].hdr = blk->data;
-            (*rte)[rte_cnt].guid = (int64_t*) ((char*) ((*rte)[rte_cnt].hdr + 1) + (*rte)[rte_cnt].hdr->name_len + (*rte)[rte_cnt].hdr->cmt_len);
-            (*rte)[rte_cnt].hdr2 = (struct fsh_hdr2*) ((*rte)[rte_cnt].guid + (*rte)[rte_cnt].hdr->guid_cnt);
-            (*rte)[rte_cnt].pt = (struct fsh_pt*) ((*rte)[rte_cnt].hdr2 + 1);
-            (*rte)[rte_cnt].hdr3 = (struct fsh_hdr3*) ((*rte)[rte_cnt].pt + (*rte)[rte_cnt].hdr->guid_cnt);
-            (*rte)[rte_cnt].wpt = (fsh_route_wpt_t*) ((*rte)[rte_cnt].hdr3 + 1);
-
+            if (rte_cnt >= rte_size)
+            {
+               if ((r = fsh_arena_grow(arena, *rte, sizeof(**rte) * rte_size, sizeof(**rte) * (rte_size ? rte_size * 2 : 16))) == NULL)
+               {
+                  *rte = NULL;
+                  return FSH_ERR_NOMEM;
+               }
+               *rte = r;
+               rte_size = rte_size ? rte_size * 2 : 16;
+            }
+            fsh_route_decode0(blk, &(*rte)[rte_cnt]);
             rte_cnt++;
             break;
       }
@@ -299,13 +827,888 @@ int fsh_route_decode(const fsh_block_t *blk, route21_t **rte)
 }
 
 
-/*! Free all data pointers within the block list. This MUST be called before
- * the block list is freed itself.
- * @param blk Pointer to the first block.
+/*** archive context and cursors ***/
+
+/*! Create a new archive context for an FSH image which is already in memory.
+ * The memory must stay valid until the context is closed again.
+ * @param ctx Pointer to a variable which receives the pointer to the context.
+ * @param base Pointer to the beginning of the FSH image.
+ * @param size Size of the image in bytes.
+ * @return Returns 0 on success or FSH_ERR_NOMEM.
+ */
+int fsh_ctx_open_mem(fsh_ctx_t **ctx, const void *base, long size)
+{
+   if ((*ctx = calloc(1, sizeof(**ctx))) == NULL)
+      return FSH_ERR_NOMEM;
+
+   (*ctx)->base = base;
+   (*ctx)->size = size;
+   return FSH_OK;
+}
+
+
+/*! Create a new archive context for the FSH file on fd. Regular files are
+ * mmap()ed unless FSH_CTX_READ is set in flags, otherwise (and if mmap()
+ * fails) the file is read into memory. Thus, the input may also be a pipe.
+ * The file descriptor is not used anymore after the function returned.
+ * @param ctx Pointer to a variable which receives the pointer to the context.
+ * @param fd Open file descriptor.
+ * @param flags 0 or FSH_CTX_READ.
+ * @return Returns 0 on success, FSH_ERR_IO (errno is set), or FSH_ERR_NOMEM.
+ */
+int fsh_ctx_open_fd(fsh_ctx_t **ctx, int fd, int flags)
+{
+   struct stat st;
+   char *buf = NULL, *b;
+   long size = 0, len;
+   ssize_t n;
+   void *base;
+   int err;
+
+   if (!(flags & FSH_CTX_READ) && fstat(fd, &st) != -1 && S_ISREG(st.st_mode) && st.st_size > 0)
+   {
+      if ((base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+      {
+         if ((err = fsh_ctx_open_mem(ctx, base, st.st_size)) < 0)
+         {
+            munmap(base, st.st_size);
+            return err;
+         }
+         (*ctx)->own = FSH_CTX_MMAP;
+         return FSH_OK;
+      }
+      vlog("mmap() failed, falling back to read(): %s\n", strerror(errno));
+   }
+
+   for (len = 0; ; len += n)
+   {
+      if (len == size)
+      {
+         size = size ? size * 2 : 4 * FLOB_SIZE;
+         if ((b = realloc(buf, size)) == NULL)
+         {
+            free(buf);
+            return FSH_ERR_NOMEM;
+         }
+         buf = b;
+      }
+      if ((n = read(fd, buf + len, size - len)) == -1)
+      {
+         if (errno == EINTR)
+         {
+            n = 0;
+            continue;
+         }
+         free(buf);
+         return FSH_ERR_IO;
+      }
+      if (!n)
+         break;
+   }
+
+   if ((err = fsh_ctx_open_mem(ctx, buf, len)) < 0)
+   {
+      free(buf);
+      return err;
+   }
+   (*ctx)->own = FSH_CTX_MALLOC;
+   return FSH_OK;
+}
+
+
+/*! Decode the block structure of the archive and build the GUID index. After
+ * this function returned successfully the context is not modified anymore
+ * until it is closed, thus any number of cursors may be used on it
+ * concurrently. If the context contains a snapshot instead of an archive,
+ * the blocks are taken from the snapshot, see fsh_snap_decode().
+ * @param ctx Pointer to the archive context.
+ * @param nthreads Number of threads used to decode the FLOBs, see
+ * fsh_block_map_parallel().
+ * @return Returns the number of blocks or a negative error code,
+ * FSH_ERR_HDR, FSH_ERR_TRUNC, FSH_ERR_SNAP, or FSH_ERR_NOMEM.
+ */
+int fsh_ctx_decode(fsh_ctx_t *ctx, int nthreads)
+{
+   const fsh_flob_header_t *flob;
+   fsh_block_t *blk = NULL;
+   int err, n;
+
+   if (ctx->blk != NULL)
+      return ctx->blk_cnt;
+
+   // snapshot of a decoded archive, see fsh_snap_write()
+   if (ctx->size >= (long) sizeof(FSH_SNAP_MAGIC) && !memcmp(ctx->base, FSH_SNAP_MAGIC, sizeof(FSH_SNAP_MAGIC)))
+      return fsh_snap_decode(ctx);
+
+   if ((err = fsh_map_file_header(ctx->base, ctx->size, &ctx->fhdr)) < 0)
+      return err;
+   vlog("filer header values 0x%04x\n", ctx->fhdr.flobs);
+
+   if (nthreads > 1)
+   {
+      vlog("decoding %d flobs on %d threads\n", ctx->fhdr.flobs, nthreads);
+      if ((blk = fsh_block_map_parallel(ctx->base, ctx->size, ctx->fhdr.flobs, nthreads, &ctx->arena)) == NULL)
+      {
+         fsh_arena_free(&ctx->arena);
+         return FSH_ERR_NOMEM;
+      }
+   }
+   else
+   {
+      for (n = 0; n < ctx->fhdr.flobs; n++)
+      {
+         vlog("reading flob %d\n", n);
+         if ((flob = fsh_map_flob_header(ctx->base, ctx->size, n)) == NULL)
+            break;
+         vlog("flob header values 0x%04x\n", flob->h & 0xffff);
+         if ((blk = fsh_block_map(flob, ctx->base + ctx->size - (const char*) flob, blk, &ctx->arena)) == NULL)
+         {
+            fsh_arena_free(&ctx->arena);
+            return FSH_ERR_NOMEM;
+         }
+      }
+   }
+
+   // archive without any valid FLOB
+   if (blk == NULL)
+   {
+      if ((blk = fsh_arena_alloc(&ctx->arena, sizeof(*blk))) == NULL)
+         return FSH_ERR_NOMEM;
+      memset(blk, 0, sizeof(*blk));
+      blk->hdr.type = FSH_BLK_ILL;
+   }
+
+   if ((err = fsh_guid_index_init(&ctx->idx, blk)) < 0)
+   {
+      fsh_arena_free(&ctx->arena);
+      return err;
+   }
+
+   ctx->blk = blk;
+   ctx->blk_cnt = err;
+   return err;
+}
+
+
+/*! Close an archive context and free all of its resources. All pointers
+ * retrieved from the context and its cursors become invalid.
+ */
+void fsh_ctx_close(fsh_ctx_t *ctx)
+{
+   if (ctx == NULL)
+      return;
+
+   if (ctx->blk != NULL)
+   {
+      fsh_guid_index_free(&ctx->idx);
+      vlog("arena: %ld allocations in %ld chunks, %ld kB\n",
+            ctx->arena.allocs, ctx->arena.chunks, (long) (ctx->arena.size / 1024));
+      fsh_arena_free(&ctx->arena);
+   }
+
+   switch (ctx->own)
+   {
+      case FSH_CTX_MMAP:
+         if (munmap((void*) ctx->base, ctx->size) == -1)
+            vlog("munmap() failed: %s\n", strerror(errno));
+         break;
+      case FSH_CTX_MALLOC:
+         free((void*) ctx->base);
+         break;
+   }
+   free(ctx);
+}
+
+
+/*! Set the filter of the context. Items which do not match are skipped by
+ * the fsh_next_...() functions of all cursors of the context, thus they are
+ * never projected or output. The filter must stay valid as long as the
+ * context is used.
+ * @param flt Pointer to the filter or NULL to remove it.
+ */
+void fsh_ctx_set_filter(fsh_ctx_t *ctx, const fsh_filter_t *flt)
+{
+   ctx->flt = flt;
+}
+
+
+/*! Initialize a cursor to iterate over the items of an archive context from
+ * the beginning. The items are decoded lazily by the fsh_next_...()
+ * functions, which skip the items not matching the filter of the context.
+ * A cursor must be released again with fsh_cursor_free().
+ * @param cur Pointer to the cursor.
+ * @param ctx Pointer to a decoded archive context, see fsh_ctx_decode().
+ */
+void fsh_cursor_init(fsh_cursor_t *cur, const fsh_ctx_t *ctx)
+{
+   memset(cur, 0, sizeof(*cur));
+   cur->ctx = ctx;
+   cur->blk = ctx->blk;
+}
+
+
+/*! Free the resources of a cursor. */
+void fsh_cursor_free(fsh_cursor_t *cur)
+{
+   free(cur->tseg);
+   cur->tseg = NULL;
+   cur->tseg_size = 0;
+}
+
+
+/*! Advance the cursor to the next block of the given type.
+ * @return Returns a pointer to the block or NULL if there are no more blocks.
+ */
+static const fsh_block_t *fsh_cursor_next(fsh_cursor_t *cur, uint16_t type)
+{
+   for (; cur->blk->hdr.type != FSH_BLK_ILL; cur->blk++)
+      if (cur->blk->hdr.type == type)
+         return cur->blk++;
+   return NULL;
+}
+
+
+/*! Retrieve the next waypoint (block type 0x01).
+ * @param cur Pointer to the cursor.
+ * @param wpt Pointer to a variable which receives a pointer to the waypoint.
+ * @return Returns 1 if a waypoint was found, 0 if there are no more
+ * waypoints, or FSH_ERR_STATE if the context was not decoded.
+ */
+int fsh_next_wpt(fsh_cursor_t *cur, const fsh_wpt01_t **wpt)
+{
+   const fsh_block_t *blk;
+
+   if (cur->blk == NULL)
+      return FSH_ERR_STATE;
+
+   do
+   {
+      if ((blk = fsh_cursor_next(cur, FSH_BLK_WPT)) == NULL)
+         return 0;
+      *wpt = blk->data;
+   }
+   while (cur->ctx->flt != NULL && !fsh_filter_wpt(cur->ctx->flt, &(*wpt)->wpd));
+
+   return 1;
+}
+
+
+/*! Retrieve the next track. Its segments are resolved through the GUID index
+ * of the context. Segments which are not found have all pointers set to NULL.
+ * @param cur Pointer to the cursor.
+ * @param trk Pointer to a track_t which is filled by the function. The
+ * segment list trk->tseg belongs to the cursor and is valid until the next
+ * call.
+ * @return Returns 1 if a track was found, 0 if there are no more tracks, or a
+ * negative error code (FSH_ERR_STATE, FSH_ERR_NOMEM).
+ */
+int fsh_next_track(fsh_cursor_t *cur, track_t *trk)
+{
+   const fsh_block_t *blk;
+   track_segment_t *tseg;
+
+   if (cur->blk == NULL)
+      return FSH_ERR_STATE;
+
+   do
+   {
+      if ((blk = fsh_cursor_next(cur, FSH_BLK_MTA)) == NULL)
+         return 0;
+
+      trk->bhdr = (fsh_block_header_t*) &blk->hdr;
+      trk->mta = blk->data;
+      if (trk->mta->guid_cnt > cur->tseg_size)
+      {
+         if ((tseg = realloc(cur->tseg, sizeof(*tseg) * trk->mta->guid_cnt)) == NULL)
+            return FSH_ERR_NOMEM;
+         cur->tseg = tseg;
+         cur->tseg_size = trk->mta->guid_cnt;
+      }
+      trk->tseg = cur->tseg;
+      if (cur->ctx->snap != NULL)
+         fsh_snap_tseg(cur->ctx, blk - cur->ctx->blk, trk);
+      else
+         fsh_tseg_decode0(&cur->ctx->idx, trk);
+   }
+   while (cur->ctx->flt != NULL && !fsh_filter_track(cur->ctx->flt, trk));
+
+   return 1;
+}
+
+
+/*! Retrieve the next route (block type 0x21).
+ * @param cur Pointer to the cursor.
+ * @param rte Pointer to a route21_t which is filled by the function.
+ * @return Returns 1 if a route was found, 0 if there are no more routes, or
+ * FSH_ERR_STATE if the context was not decoded.
  */
-void fsh_free_block_data(fsh_block_t *blk)
+int fsh_next_route(fsh_cursor_t *cur, route21_t *rte)
 {
-   for (; blk->hdr.type != FSH_BLK_ILL; blk++)
-      free(blk->data);
+   const fsh_block_t *blk;
+
+   if (cur->blk == NULL)
+      return FSH_ERR_STATE;
+
+   do
+   {
+      if ((blk = fsh_cursor_next(cur, FSH_BLK_RTE)) == NULL)
+         return 0;
+      fsh_route_decode0(blk, rte);
+   }
+   while (cur->ctx->flt != NULL && !fsh_filter_route(cur->ctx->flt, rte));
+
+   return 1;
 }
 
+
+
+// pending track segment of a stream
+struct fsh_stream_seg
+{
+   fsh_block_t blk;     //!< copy of the segment block
+   int ref;             //!< number of pending tracks referring to it
+};
+
+// track meta of a stream which is waiting for segments or to be returned
+struct fsh_stream_trk
+{
+   fsh_block_t blk;     //!< copy of the meta block
+   int missing;         //!< number of segments not read yet
+   int pos;             //!< position within the list of pending tracks or -1
+};
+
+// list of the tracks waiting for a missing segment, it is kept in the index
+// with the GUID of the segment and the type FSH_BLK_MTA
+struct fsh_stream_wait
+{
+   fsh_block_t blk;     //!< header with the GUID of the segment
+   struct fsh_stream_trk **trk;
+   int cnt;
+};
+
+
+/*! Read len bytes from fd. In contrast to a single read() this works on
+ * pipes as well.
+ * @return Returns the number of bytes read, which is less than len only at
+ * the end of the file, or -1 on error.
+ */
+static long read_full(int fd, void *buf, long len)
+{
+   long pos, n;
+
+   for (pos = 0; pos < len; pos += n)
+      if ((n = read(fd, (char*) buf + pos, len - pos)) == -1)
+      {
+         if (errno != EINTR)
+            return -1;
+         n = 0;
+      }
+      else if (!n)
+         break;
+   return pos;
+}
+
+
+/*! Return a copy of the block blk embedded at the beginning of a new
+ * structure of size bytes, or NULL if out of memory. The data is copied
+ * because the arena of the FLOB is reset with the next FLOB.
+ */
+static void *fsh_stream_copy(const fsh_block_t *blk, size_t size)
+{
+   fsh_block_t *b;
+   int rlen;
+
+   rlen = blk->hdr.len + (blk->hdr.len & 1);
+   if ((b = calloc(1, size)) == NULL)
+      return NULL;
+   if ((b->data = malloc(rlen)) == NULL)
+   {
+      free(b);
+      return NULL;
+   }
+   b->hdr = blk->hdr;
+   memcpy(b->data, blk->data, rlen);
+   return b;
+}
+
+
+/*! Return the pending block of type type with the GUID guid, i.e. a
+ * struct fsh_stream_seg or a struct fsh_stream_wait, or NULL.
+ */
+static void *fsh_stream_lookup(const fsh_stream_t *st, uint64_t guid, int type)
+{
+   return (void*) fsh_guid_lookup(&st->idx, guid, type);
+}
+
+
+static void fsh_stream_seg_free(fsh_stream_t *st, struct fsh_stream_seg *seg)
+{
+   fsh_guid_index_del(&st->idx, &seg->blk);
+   free(seg->blk.data);
+   free(seg);
+   st->seg_cnt--;
+}
+
+
+static void fsh_stream_pending(fsh_stream_t *st)
+{
+   if (st->pend_cnt + st->seg_cnt > st->max_pending)
+      st->max_pending = st->pend_cnt + st->seg_cnt;
+}
+
+
+/*! Return 1 if segment i of the meta mta appears already before, otherwise
+ * 0. Every track refers to each segment only once.
+ */
+static int fsh_guid_dup(const fsh_track_meta_t *mta, int i)
+{
+   int j;
+
+   for (j = 0; j < i; j++)
+      if (mta->guid[j] == mta->guid[i])
+         return 1;
+   return 0;
+}
+
+
+/*! Release the segments of the track trk and free it. Segments to which no
+ * other pending track refers are freed.
+ */
+static void fsh_stream_trk_free(fsh_stream_t *st, struct fsh_stream_trk *trk)
+{
+   const fsh_track_meta_t *mta = trk->blk.data;
+   struct fsh_stream_seg *seg;
+   int i;
+
+   for (i = 0; i < mta->guid_cnt; i++)
+      if (!fsh_guid_dup(mta, i) && (seg = fsh_stream_lookup(st, mta->guid[i], FSH_BLK_TRK)) != NULL && --seg->ref <= 0)
+         fsh_stream_seg_free(st, seg);
+   free(trk->blk.data);
+   free(trk);
+}
+
+
+/*! Move the track trk to the end of the queue of tracks which are ready to
+ * be returned, and remove it from the list of pending tracks.
+ * @return Returns 0 on success or FSH_ERR_NOMEM.
+ */
+static int fsh_stream_done(fsh_stream_t *st, struct fsh_stream_trk *trk)
+{
+   struct fsh_stream_trk **done;
+
+   if (st->done_cnt >= st->done_size)
+   {
+      if ((done = realloc(st->done, sizeof(*done) * (st->done_size + 16))) == NULL)
+         return FSH_ERR_NOMEM;
+      st->done = done;
+      st->done_size += 16;
+   }
+   st->done[st->done_cnt++] = trk;
+
+   if (trk->pos >= 0)
+   {
+      st->pend[trk->pos] = st->pend[--st->pend_cnt];
+      st->pend[trk->pos]->pos = trk->pos;
+      trk->pos = -1;
+   }
+   return 0;
+}
+
+
+/*! Add the pending track trk to the list of tracks waiting for the segment
+ * guid.
+ * @return Returns 0 on success or FSH_ERR_NOMEM.
+ */
+static int fsh_stream_wait_add(fsh_stream_t *st, uint64_t guid, struct fsh_stream_trk *trk)
+{
+   struct fsh_stream_wait *w;
+   struct fsh_stream_trk **t;
+
+   if ((w = fsh_stream_lookup(st, guid, FSH_BLK_MTA)) == NULL)
+   {
+      if ((w = calloc(1, sizeof(*w))) == NULL)
+         return FSH_ERR_NOMEM;
+      w->blk.hdr.type = FSH_BLK_MTA;
+      w->blk.hdr.guid = guid;
+      if (fsh_guid_index_add(&st->idx, &w->blk) < 0)
+      {
+         free(w);
+         return FSH_ERR_NOMEM;
+      }
+   }
+   if ((t = realloc(w->trk, sizeof(*t) * (w->cnt + 1))) == NULL)
+      return FSH_ERR_NOMEM;
+   w->trk = t;
+   w->trk[w->cnt++] = trk;
+   return 0;
+}
+
+
+/*! Process a track meta. The track is ready immediately if all of its
+ * segments are pending already, otherwise it is kept until they are read.
+ * @return Returns 0 on success or FSH_ERR_NOMEM.
+ */
+static int fsh_stream_mta_add(fsh_stream_t *st, const fsh_block_t *blk)
+{
+   const fsh_track_meta_t *mta = blk->data;
+   struct fsh_stream_seg *seg;
+   struct fsh_stream_trk *trk, **pend;
+   int i, err;
+
+   if ((trk = fsh_stream_copy(blk, sizeof(*trk))) == NULL)
+      return FSH_ERR_NOMEM;
+   trk->pos = -1;
+   for (i = 0; i < mta->guid_cnt; i++)
+      if (!fsh_guid_dup(mta, i) && fsh_stream_lookup(st, mta->guid[i], FSH_BLK_TRK) == NULL)
+         trk->missing++;
+
+   if (trk->missing)
+   {
+      if ((pend = realloc(st->pend, sizeof(*pend) * (st->pend_cnt + 1))) == NULL)
+      {
+         free(trk->blk.data);
+         free(trk);
+         return FSH_ERR_NOMEM;
+      }
+      st->pend = pend;
+      trk->pos = st->pend_cnt;
+      st->pend[st->pend_cnt++] = trk;
+      fsh_stream_pending(st);
+   }
+
+   for (i = 0; i < mta->guid_cnt; i++)
+   {
+      if (fsh_guid_dup(mta, i))
+         continue;
+      if ((seg = fsh_stream_lookup(st, mta->guid[i], FSH_BLK_TRK)) != NULL)
+         seg->ref++;
+      else if ((err = fsh_stream_wait_add(st, mta->guid[i], trk)) < 0)
+         return err;
+   }
+
+   return trk->missing ? 0 : fsh_stream_done(st, trk);
+}
+
+
+/*! Process a track segment. All pending tracks which are complete with this
+ * segment are moved to the queue of tracks which are ready.
+ * @return Returns 0 on success or FSH_ERR_NOMEM.
+ */
+static int fsh_stream_seg_add(fsh_stream_t *st, fsh_block_t *blk)
+{
+   struct fsh_stream_seg *seg;
+   struct fsh_stream_wait *w;
+   int i, err = 0;
+
+   if (st->sp != NULL && st->sp->tol > 0 && (err = fsh_tseg_simplify(blk, st->sp, &st->arena)) < 0)
+      return err;
+
+   // the last of several segments with the same GUID is kept like
+   // fsh_guid_index_init() does, unless the first one is in use already
+   if ((seg = fsh_stream_lookup(st, blk->hdr.guid, FSH_BLK_TRK)) != NULL)
+   {
+      if (seg->ref)
+      {
+         vlog("duplicate track segment %s ignored\n", guid_to_string(blk->hdr.guid));
+         return 0;
+      }
+      fsh_stream_seg_free(st, seg);
+   }
+
+   if ((seg = fsh_stream_copy(blk, sizeof(*seg))) == NULL)
+      return FSH_ERR_NOMEM;
+   if (fsh_guid_index_add(&st->idx, &seg->blk) < 0)
+   {
+      free(seg->blk.data);
+      free(seg);
+      return FSH_ERR_NOMEM;
+   }
+   st->seg_cnt++;
+   fsh_stream_pending(st);
+
+   if ((w = fsh_stream_lookup(st, blk->hdr.guid, FSH_BLK_MTA)) == NULL)
+      return 0;
+   fsh_guid_index_del(&st->idx, &w->blk);
+
+   seg->ref += w->cnt;
+   for (i = 0; i < w->cnt && !err; i++)
+      if (!--w->trk[i]->missing)
+         err = fsh_stream_done(st, w->trk[i]);
+
+   free(w->trk);
+   free(w);
+   return err;
+}
+
+
+/*! Read the next FLOB of the stream and map its blocks.
+ * @return Returns 1 if a FLOB was read, 0 if there are no more FLOBs, or a
+ * negative error code (FSH_ERR_IO, FSH_ERR_NOMEM).
+ */
+static int fsh_stream_read_flob(fsh_stream_t *st)
+{
+   long len;
+
+   if (st->flob_cnt >= st->fhdr.flobs)
+      return 0;
+
+   // the FLOBs are read completely, thus the padding at the end of a FLOB
+   // is skipped without seeking
+   if ((len = read_full(st->fd, st->flob, FLOB_SIZE)) == -1)
+      return FSH_ERR_IO;
+   if (len < (long) sizeof(*st->flob))
+   {
+      vlog("flob header truncated, read %ld of %ld bytes\n", len, (long) sizeof(*st->flob));
+      return 0;
+   }
+   if (memcmp(st->flob->rflob, RFLOB_STR, strlen(RFLOB_STR)))
+   {
+      vlog("%s\n", fsh_strerror(FSH_ERR_HDR));
+      return 0;
+   }
+
+   vlog("streaming flob %d\n", st->flob_cnt);
+   fsh_arena_reset(&st->arena);
+   if ((st->blk = fsh_block_map(st->flob, len, NULL, &st->arena)) == NULL)
+      return FSH_ERR_NOMEM;
+   st->flob_cnt++;
+   return 1;
+}
+
+
+/*! Open a stream to read the archive on fd sequentially FLOB by FLOB. In
+ * contrast to a context, the file is not kept in memory and it is not
+ * seeked, hence it may be a pipe. The memory usage is bound by the size of a
+ * FLOB and the blocks of the tracks which are not complete yet. A stream
+ * which was opened successfully must be closed with fsh_stream_close().
+ * @param st Pointer to the stream.
+ * @param fd File descriptor positioned at the beginning of the archive.
+ * @return Returns 0 on success, FSH_ERR_SNAP if the input is a snapshot, or
+ * another negative error code (FSH_ERR_HDR, FSH_ERR_IO, FSH_ERR_TRUNC,
+ * FSH_ERR_NOMEM).
+ */
+int fsh_stream_open(fsh_stream_t *st, int fd)
+{
+   int err;
+
+   memset(st, 0, sizeof(*st));
+   st->fd = fd;
+   if ((err = fsh_read_file_header(fd, &st->fhdr)) < 0)
+   {
+      // snapshots are random access only
+      if (err == FSH_ERR_HDR && !memcmp(st->fhdr.rl90, FSH_SNAP_MAGIC, sizeof(FSH_SNAP_MAGIC)))
+         return FSH_ERR_SNAP;
+      return err;
+   }
+   vlog("filer header values 0x%04x\n", st->fhdr.flobs);
+
+   if ((st->flob = malloc(FLOB_SIZE)) == NULL)
+      return FSH_ERR_NOMEM;
+   if (fsh_guid_index_init(&st->idx, NULL) < 0)
+   {
+      free(st->flob);
+      return FSH_ERR_NOMEM;
+   }
+   return FSH_OK;
+}
+
+
+/*! Set the filter of a stream. Items not matching it are skipped by
+ * fsh_stream_next().
+ * @param st Pointer to the stream.
+ * @param flt Pointer to the filter or NULL to disable filtering. It has to
+ * stay valid as long as the stream is used.
+ */
+void fsh_stream_set_filter(fsh_stream_t *st, const struct fsh_filter *flt)
+{
+   st->flt = flt;
+}
+
+
+/*! Set the simplification of the track segments of a stream, see
+ * fsh_tseg_simplify().
+ * @param st Pointer to the stream.
+ * @param sp Pointer to the simplification parameters or NULL to disable it.
+ * The point counters are incremented while the stream is read.
+ */
+void fsh_stream_set_simplify(fsh_stream_t *st, struct fsh_simplify *sp)
+{
+   st->sp = sp;
+}
+
+
+/*! Fill the track trk with the meta of the ready track t and its pending
+ * segments. Segments which were not read have all pointers set to NULL.
+ * @return Returns 0 on success or FSH_ERR_NOMEM.
+ */
+static int fsh_stream_track(fsh_stream_t *st, struct fsh_stream_trk *t, track_t *trk)
+{
+   struct fsh_stream_seg *seg;
+   track_segment_t *tseg;
+   int i;
+
+   trk->bhdr = &t->blk.hdr;
+   trk->mta = t->blk.data;
+   if (trk->mta->guid_cnt > st->tseg_size)
+   {
+      if ((tseg = realloc(st->tseg, sizeof(*tseg) * trk->mta->guid_cnt)) == NULL)
+         return FSH_ERR_NOMEM;
+      st->tseg = tseg;
+      st->tseg_size = trk->mta->guid_cnt;
+   }
+   trk->tseg = st->tseg;
+
+   for (i = 0; i < trk->mta->guid_cnt; i++)
+   {
+      if ((seg = fsh_stream_lookup(st, trk->mta->guid[i], FSH_BLK_TRK)) == NULL)
+      {
+         memset(&trk->tseg[i], 0, sizeof(trk->tseg[i]));
+         continue;
+      }
+      trk->tseg[i].bhdr = &seg->blk.hdr;
+      trk->tseg[i].hdr = seg->blk.data;
+      trk->tseg[i].pt = (fsh_track_point_t*) (trk->tseg[i].hdr + 1);
+      trk->tseg[i].ll = NULL;
+   }
+   return 0;
+}
+
+
+/*! Retrieve the next item of a stream. Waypoints and routes are returned in
+ * the order of the archive as soon as their block is read. A track is
+ * returned as soon as all of its segments were read, thus tracks may come
+ * out of order. At the end of the input, tracks with missing segments are
+ * returned with the segments read.
+ * @param st Pointer to the stream.
+ * @param item Pointer to an item which receives the waypoint, the track, or
+ * the route depending on the return value. The item refers to memory of the
+ * stream which is valid until the next call.
+ * @return Returns FSH_BLK_WPT, FSH_BLK_MTA (track), or FSH_BLK_RTE, 0 if
+ * there are no more items, or a negative error code (FSH_ERR_IO,
+ * FSH_ERR_NOMEM).
+ */
+int fsh_stream_next(fsh_stream_t *st, fsh_item_t *item)
+{
+   fsh_block_t *blk;
+   int err;
+
+   if (st->cur != NULL)
+   {
+      fsh_stream_trk_free(st, st->cur);
+      st->cur = NULL;
+   }
+
+   for (;;)
+   {
+      if (st->done_pos < st->done_cnt)
+      {
+         st->cur = st->done[st->done_pos++];
+         if ((err = fsh_stream_track(st, st->cur, &item->trk)) < 0)
+            return err;
+         if (st->flt == NULL || fsh_filter_track(st->flt, &item->trk))
+            return FSH_BLK_MTA;
+         fsh_stream_trk_free(st, st->cur);
+         st->cur = NULL;
+         continue;
+      }
+      st->done_pos = st->done_cnt = 0;
+
+      if (st->blk == NULL || st->blk->hdr.type == FSH_BLK_ILL)
+      {
+         if (st->eof)
+            return 0;
+         if ((err = fsh_stream_read_flob(st)) < 0)
+            return err;
+         if (err)
+            continue;
+
+         // tracks with missing segments are returned with the segments read
+         st->eof = 1;
+         st->blk = NULL;
+         while (st->pend_cnt)
+         {
+            vlog("track %s incomplete, %d segments missing\n", guid_to_string(st->pend[0]->blk.hdr.guid), st->pend[0]->missing);
+            if ((err = fsh_stream_done(st, st->pend[0])) < 0)
+               return err;
+         }
+         continue;
+      }
+
+      blk = st->blk++;
+      switch (blk->hdr.type)
+      {
+         case FSH_BLK_WPT:
+            item->wpt = blk->data;
+            if (st->flt == NULL || fsh_filter_wpt(st->flt, &item->wpt->wpd))
+               return FSH_BLK_WPT;
+            break;
+
+         case FSH_BLK_RTE:
+            fsh_route_decode0(blk, &item->rte);
+            if (st->flt == NULL || fsh_filter_route(st->flt, &item->rte))
+               return FSH_BLK_RTE;
+            break;
+
+         case FSH_BLK_MTA:
+            if ((err = fsh_stream_mta_add(st, blk)) < 0)
+               return err;
+            break;
+
+         case FSH_BLK_TRK:
+            if ((err = fsh_stream_seg_add(st, blk)) < 0)
+               return err;
+            break;
+      }
+   }
+}
+
+
+/*! Return 1 if all items of the current FLOB were returned, i.e. the next
+ * call of fsh_stream_next() reads the next FLOB, otherwise 0. A consumer may
+ * pass on its output at this point.
+ */
+int fsh_stream_flob_done(const fsh_stream_t *st)
+{
+   return st->done_pos >= st->done_cnt && (st->blk == NULL || st->blk->hdr.type == FSH_BLK_ILL);
+}
+
+
+/*! Free all resources of a stream. The file descriptor is not closed. */
+void fsh_stream_close(fsh_stream_t *st)
+{
+   struct fsh_stream_wait *w;
+   unsigned i;
+   int j;
+
+   if (st->cur != NULL)
+      fsh_stream_trk_free(st, st->cur);
+   for (; st->done_pos < st->done_cnt; st->done_pos++)
+      fsh_stream_trk_free(st, st->done[st->done_pos]);
+   for (j = 0; j < st->pend_cnt; j++)
+   {
+      free(st->pend[j]->blk.data);
+      free(st->pend[j]);
+   }
+
+   for (i = 0; i <= st->idx.mask; i++)
+   {
+      if (st->idx.slot[i] == NULL)
+         continue;
+      if (st->idx.slot[i]->hdr.type == FSH_BLK_MTA)
+      {
+         w = (void*) st->idx.slot[i];
+         free(w->trk);
+      }
+      else
+         free(st->idx.slot[i]->data);
+      free((void*) st->idx.slot[i]);
+   }
+   fsh_guid_index_free(&st->idx);
+
+   free(st->pend);
+   free(st->done);
+   free(st->tseg);
+   free(st->flob);
+   fsh_arena_free(&st->arena);
+   memset(st, 0, sizeof(*st));
+}
@@ -30,6 +30,8 @@
 
 #include <stdint.h>
 
+#include "arena.h"
+
 #define RL90_STR "RL90 FLASH FILE"
 #define RFLOB_STR "RAYFLOB1"
 #define FLOB_SIZE 0x10000
@@ -58,6 +60,18 @@
 #define FSH_BLK_GRP ((uint16_t) 0x0022)
 #define FSH_BLK_ILL ((uint16_t) 0xffff)
 
+// error codes returned by the library functions
+#define FSH_OK 0
+#define FSH_ERR_HDR -1     //!< no valid RL90 file header
+#define FSH_ERR_IO -2      //!< I/O error, see errno
+#define FSH_ERR_TRUNC -3   //!< file truncated
+#define FSH_ERR_NOMEM -4   //!< out of memory
+#define FSH_ERR_STATE -5   //!< archive context not decoded yet
+#define FSH_ERR_SNAP -6    //!< invalid snapshot
+
+// flags for fsh_ctx_open_fd()
+#define FSH_CTX_READ 1     //!< use read() instead of mmap()
+
 
 /*** file structures of the ARCHIVE.FSH ***/
 
@@ -258,13 +272,15 @@ typedef struct fsh_block
 {
    fsh_block_header_t hdr;
    void *data;
-} __attribute__ ((packed)) fsh_block_t; 
+   int mapped;       //!< data points into the file mapping, 0 if it is a copy in an arena
+} __attribute__ ((packed)) fsh_block_t;
 
 typedef struct track_segment
 {
    fsh_block_header_t *bhdr;
    fsh_track_header_t *hdr;
    fsh_track_point_t *pt;
+   const double *ll;    //!< projected coordinates of the points (cnt latitudes followed by cnt longitudes), NULL if not available, see fsh_snap_projection()
 } track_segment_t;
 
 // memory structure for keeping a track
@@ -273,8 +289,6 @@ typedef struct track
    fsh_block_header_t *bhdr;
    fsh_track_meta_t *mta;
    track_segment_t *tseg;
-
-   int first_id, last_id;     //!< IDs, used for OSM output (FIXME: unclean impl.)
 } track_t;
 
 // mem struct for keeping a route
@@ -291,19 +305,111 @@ typedef struct route21
    fsh_route_wpt_t *wpt;   //!< pointer to the first waypoint. Note, it does
                            //!< not increase linearly because fsh_wpt_t
                            //!< contains a variable length array if name_len length.
-
-   int first_id, last_id;     //!< IDs, used for OSM output
 } route21_t;
 
+// hash index to look up blocks by their GUID
+typedef struct fsh_guid_index
+{
+   unsigned mask;             //!< number of hash slots - 1 (power of 2)
+   unsigned cnt;              //!< number of blocks added, upper bound of the used slots
+   const fsh_block_t **slot;  //!< open addressing hash table
+} fsh_guid_index_t;
 
+// context of a single archive, see fsh_ctx_open_fd()
+typedef struct fsh_ctx
+{
+   const char *base;          //!< pointer to the archive data
+   long size;                 //!< size of the archive data in bytes
+   int own;                   //!< 0 if base belongs to the caller, FSH_CTX_MMAP or FSH_CTX_MALLOC otherwise
+#define FSH_CTX_MMAP 1
+#define FSH_CTX_MALLOC 2
+   fsh_file_header_t fhdr;    //!< copy of the file header
+   fsh_block_t *blk;          //!< list of all blocks, NULL before fsh_ctx_decode()
+   int blk_cnt;               //!< number of blocks in blk
+   fsh_guid_index_t idx;      //!< GUID index of blk
+   const struct fsh_filter *flt; //!< items skipped by the cursors, see fsh_ctx_set_filter()
+   const struct fsh_snap_blk *snap; //!< block table if base is a snapshot, see snapshot.c
+   int snap_ll;               //!< 1 if the projected coordinates of the snapshot are used
+   fsh_arena_t arena;         //!< memory of blk and of the block data which is not mapped
+} fsh_ctx_t;
+
+// cursor to iterate over the items of an archive context
+typedef struct fsh_cursor
+{
+   const fsh_ctx_t *ctx;      //!< context the cursor belongs to
+   const fsh_block_t *blk;    //!< next block to be looked at
+   track_segment_t *tseg;     //!< segment list of the current track
+   int tseg_size;             //!< number of elements allocated for tseg
+} fsh_cursor_t;
+
+// item returned by fsh_stream_next()
+typedef struct fsh_item
+{
+   const fsh_wpt01_t *wpt;    //!< waypoint if the type is FSH_BLK_WPT
+   track_t trk;               //!< track if the type is FSH_BLK_MTA
+   route21_t rte;             //!< route if the type is FSH_BLK_RTE
+} fsh_item_t;
+
+// sequential reader of an archive, see fsh_stream_open()
+typedef struct fsh_stream
+{
+   int fd;                    //!< input, it is read without seeking
+   fsh_file_header_t fhdr;    //!< copy of the file header
+   fsh_flob_header_t *flob;   //!< buffer of the current FLOB
+   int flob_cnt;              //!< number of FLOBs read
+   fsh_block_t *blk;          //!< next block of the current FLOB
+   int eof;                   //!< 1 after the last FLOB was read
+   const struct fsh_filter *flt; //!< items skipped, see fsh_stream_set_filter()
+   struct fsh_simplify *sp;   //!< simplification of the segments or NULL
+   fsh_guid_index_t idx;      //!< pending segments and lists of waiting tracks by GUID
+   struct fsh_stream_trk **pend; //!< tracks with missing segments
+   int pend_cnt;              //!< number of elements in pend
+   struct fsh_stream_trk **done; //!< queue of tracks ready to be returned
+   int done_pos, done_cnt, done_size;
+   struct fsh_stream_trk *cur;   //!< track returned last, freed by the next call
+   track_segment_t *tseg;     //!< segment list of the current track
+   int tseg_size;             //!< number of elements allocated for tseg
+   int seg_cnt;               //!< number of pending segments
+   int max_pending;           //!< max. number of track blocks kept at once
+   fsh_arena_t arena;         //!< memory of the current FLOB, reset with the next one
+} fsh_stream_t;
+
+
+void fsh_set_log(int (*)(const char *, ...));
+const char *fsh_strerror(int );
+char *fsh_guid_str(uint64_t , char *, int );
 char *guid_to_string(uint64_t );
 int fsh_read_file_header(int , fsh_file_header_t *);
 int fsh_read_flob_header(int , fsh_flob_header_t *);
-fsh_block_t *fsh_block_read(int , fsh_block_t *);
-int fsh_track_decode(const fsh_block_t *, track_t **);
-int fsh_route_decode(const fsh_block_t *, route21_t **);
-void fsh_free_block_data(fsh_block_t *);
+fsh_block_t *fsh_block_read(int , fsh_block_t *, fsh_arena_t *);
+int fsh_map_file_header(const void *, long , fsh_file_header_t *);
+const fsh_flob_header_t *fsh_map_flob_header(const void *, long , int );
+fsh_block_t *fsh_block_map(const fsh_flob_header_t *, long , fsh_block_t *, fsh_arena_t *);
+fsh_block_t *fsh_block_map_parallel(const void *, long , int , int , fsh_arena_t *);
+int fsh_guid_index_init(fsh_guid_index_t *, const fsh_block_t *);
+void fsh_guid_index_free(fsh_guid_index_t *);
+int fsh_guid_index_add(fsh_guid_index_t *, const fsh_block_t *);
+void fsh_guid_index_del(fsh_guid_index_t *, const fsh_block_t *);
+const fsh_block_t *fsh_guid_lookup(const fsh_guid_index_t *, uint64_t , uint16_t );
+int fsh_track_decode(const fsh_block_t *, const fsh_guid_index_t *, track_t **, fsh_arena_t *);
+int fsh_route_decode(const fsh_block_t *, route21_t **, fsh_arena_t *);
 int fsh_timetostr(const fsh_timestamp_t *, char *, int );
+int fsh_ctx_open_mem(fsh_ctx_t **, const void *, long );
+int fsh_ctx_open_fd(fsh_ctx_t **, int , int );
+int fsh_ctx_decode(fsh_ctx_t *, int );
+void fsh_ctx_close(fsh_ctx_t *);
+void fsh_ctx_set_filter(fsh_ctx_t *, const struct fsh_filter *);
+void fsh_cursor_init(fsh_cursor_t *, const fsh_ctx_t *);
+void fsh_cursor_free(fsh_cursor_t *);
+int fsh_next_wpt(fsh_cursor_t *, const fsh_wpt01_t **);
+int fsh_next_track(fsh_cursor_t *, track_t *);
+int fsh_next_route(fsh_cursor_t *, route21_t *);
+int fsh_stream_open(fsh_stream_t *, int );
+void fsh_stream_set_filter(fsh_stream_t *, const struct fsh_filter *);
+void fsh_stream_set_simplify(fsh_stream_t *, struct fsh_simplify *);
+int fsh_stream_next(fsh_stream_t *, fsh_item_t *);
+int fsh_stream_flob_done(const fsh_stream_t *);
+void fsh_stream_close(fsh_stream_t *);
 
 #endif
 
@@ -0,0 +1,877 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This program builds a persistent spatial index over the track points and
+ *  waypoints of a collection of ARCHIVE.FSH files and answers bounding box
+ *  and time window queries from it. The index is bucketed by tiles of the
+ *  Mercator plane. Each entry references a run of points of a track segment
+ *  (or a single waypoint) by the source file, the block GUID, and the file
+ *  offset of the block, thus a query reads and decodes only the blocks it
+ *  needs.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "fshfunc.h"
+#include "projection.h"
+#include "numfmt.h"
+#include "obuf.h"
+
+
+#define CELSIUS(x) ((double) (x) / 100.0 - 273.15)
+
+#define IDX_MAGIC "FSHIDX1"
+#define IDX_VERSION 1
+// number of bits per tile coordinate, i.e. 4096 x 4096 tiles of approx. 10 km
+// at the equator
+#define TILE_BITS 12
+// max. number of points of a track segment referenced by one index entry
+#define RUN_MAX 256
+// max. size of a formatted output line
+#define LBUFLEN 4096
+
+#define COPYLEFT "FSH spatial index (c) 2013-2019 by Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>, License GPLv3"
+
+
+/*** file structures of the index ***/
+
+// The index file consists of the header followed by file_cnt idx_file_t,
+// tile_cnt idx_tile_t, entry_cnt idx_entry_t, and the string table of
+// str_size bytes.
+typedef struct idx_header
+{
+   char magic[8];       //!< IDX_MAGIC
+   int32_t version;     //!< IDX_VERSION
+   int32_t tile_bits;   //!< TILE_BITS of the index
+   int32_t file_cnt;    //!< number of indexed files
+   int32_t tile_cnt;    //!< number of tiles which contain entries
+   int64_t entry_cnt;   //!< number of entries
+   int64_t str_size;    //!< size of the string table
+} __attribute__ ((packed)) idx_header_t;
+
+// indexed archive
+typedef struct idx_file
+{
+   int64_t size;        //!< size of the file when it was indexed
+   int64_t mtime;       //!< modification time in ns when it was indexed
+   uint32_t name;       //!< offset of the absolute path in the string table
+} __attribute__ ((packed)) idx_file_t;
+
+// tile directory, sorted by key
+typedef struct idx_tile
+{
+   uint32_t key;        //!< tile row << TILE_BITS | tile column
+   uint32_t cnt;        //!< number of entries within the tile
+   int64_t first;       //!< index of the first entry of the tile
+} __attribute__ ((packed)) idx_tile_t;
+
+// reference to a run of points or a waypoint
+typedef struct idx_entry
+{
+   uint64_t guid;       //!< GUID of the block
+   uint64_t trk;        //!< GUID of the track (0x0e) of a segment, 0 for waypoints
+   int64_t off;         //!< file offset of the block header
+   uint32_t t0, t1;     //!< time window in seconds since 1970, 0 if unknown
+   int32_t file;        //!< index of the file
+   int32_t north0, east0, north1, east1;  //!< bounding box in FSH units
+   uint16_t type;       //!< block type, FSH_BLK_TRK or FSH_BLK_WPT
+   int16_t seg;         //!< number of the segment within the track
+   int16_t first, last; //!< range of points within the segment
+} __attribute__ ((packed)) idx_entry_t;
+
+
+/*** memory structures ***/
+
+// entry during index construction
+typedef struct ix_entry
+{
+   uint32_t key;
+   idx_entry_t e;
+} ix_entry_t;
+
+// index under construction
+typedef struct ix
+{
+   ix_entry_t *ent;
+   long cnt, size;
+   idx_file_t *file;
+   int file_cnt;
+   char *str;
+   long str_size;
+   long trkpt, wpt;     //!< number of points indexed
+} ix_t;
+
+// mapped index
+typedef struct idx
+{
+   const idx_header_t *hdr;
+   const idx_file_t *file;
+   const idx_tile_t *tile;
+   const idx_entry_t *ent;
+   const char *str;
+   size_t size;
+} idx_t;
+
+// query window
+typedef struct query
+{
+   int32_t north0, east0, north1, east1;
+   uint32_t t0, t1;     //!< time window, both 0 if no time is given
+} query_t;
+
+
+static FILE *logout_;
+
+
+static void __attribute__((constructor)) init_log_output(void)
+{
+   logout_ = stderr;
+}
+
+
+int vlog(const char *fmt, ...)
+{
+   va_list ap;
+   int ret;
+
+   if (logout_ == NULL || fmt == NULL)
+      return 0;
+
+   fputs("# ", logout_);
+   va_start(ap, fmt);
+   ret = vfprintf(logout_, fmt, ap);
+   va_end(ap);
+
+   return ret;
+}
+
+
+static double now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+
+/*! Return the tile key of a point given in FSH units. */
+static uint32_t tile_key(int32_t north, int32_t east)
+{
+   return ((uint32_t) north ^ 0x80000000) >> (32 - TILE_BITS) << TILE_BITS
+      | ((uint32_t) east ^ 0x80000000) >> (32 - TILE_BITS);
+}
+
+
+/*! Return the time of the FSH timestamp ts in seconds since 1970. */
+static uint32_t fsh_time(const fsh_timestamp_t *ts)
+{
+   return (uint32_t) ts->date * 86400 + ts->timeofday;
+}
+
+
+/*! Append a new entry to the index and return a pointer to it. */
+static idx_entry_t *ix_add(ix_t *ix, uint32_t key)
+{
+   if (ix->cnt >= ix->size)
+   {
+      ix->size = ix->size ? ix->size * 2 : 4096;
+      if ((ix->ent = realloc(ix->ent, sizeof(*ix->ent) * ix->size)) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+   }
+   memset(&ix->ent[ix->cnt], 0, sizeof(*ix->ent));
+   ix->ent[ix->cnt].key = key;
+   return &ix->ent[ix->cnt++].e;
+}
+
+
+/*! Extend the bounding box of the entry e by the point north/east. */
+static void entry_extend(idx_entry_t *e, int32_t north, int32_t east)
+{
+   if (north < e->north0)
+      e->north0 = north;
+   if (north > e->north1)
+      e->north1 = north;
+   if (east < e->east0)
+      e->east0 = east;
+   if (east > e->east1)
+      e->east1 = east;
+}
+
+
+/*! Return the file offset of the block header of the block data p or -1 if
+ * the data is not part of the archive mapping (truncated blocks are copied).
+ */
+static int64_t block_off(const fsh_ctx_t *ctx, const void *p)
+{
+   const char *d = p;
+
+   if (d < ctx->base + sizeof(fsh_block_header_t) || d >= ctx->base + ctx->size)
+      return -1;
+   return d - ctx->base - sizeof(fsh_block_header_t);
+}
+
+
+/*! Add the points of the track segment tseg to the index. The points are
+ * split into runs of at most RUN_MAX consecutive points within the same tile.
+ */
+static void index_tseg(ix_t *ix, int file, const track_t *trk, int seg, int64_t off)
+{
+   const track_segment_t *tseg = &trk->tseg[seg];
+   idx_entry_t *e = NULL;
+   uint32_t key = 0, k;
+   int i;
+
+   for (i = 0; i < tseg->hdr->cnt; i++)
+   {
+      if (tseg->pt[i].c == -1)
+         continue;
+
+      k = tile_key(tseg->pt[i].north, tseg->pt[i].east);
+      if (e != NULL && (k != key || i - e->first >= RUN_MAX))
+         e = NULL;
+
+      if (e == NULL)
+      {
+         key = k;
+         e = ix_add(ix, key);
+         e->guid = tseg->bhdr->guid;
+         e->trk = trk->bhdr->guid;
+         e->off = off;
+         e->file = file;
+         e->type = FSH_BLK_TRK;
+         e->seg = seg;
+         e->first = i;
+         e->north0 = e->north1 = tseg->pt[i].north;
+         e->east0 = e->east1 = tseg->pt[i].east;
+      }
+      entry_extend(e, tseg->pt[i].north, tseg->pt[i].east);
+      e->last = i;
+      ix->trkpt++;
+   }
+}
+
+
+/*! Add all track points and waypoints of the archive path to the index.
+ * @return Returns 0 on success or a negative value on error.
+ */
+static int index_file(ix_t *ix, const char *path)
+{
+   char rpath[PATH_MAX];
+   const fsh_block_t *blk;
+   const fsh_wpt01_t *wpt;
+   fsh_cursor_t cur;
+   fsh_ctx_t *ctx;
+   track_t trk;
+   struct stat st;
+   idx_entry_t *e;
+   int64_t off;
+   int fd, err, i, file, len;
+
+   if (realpath(path, rpath) == NULL || (fd = open(rpath, O_RDONLY)) == -1)
+   {
+      fprintf(stderr, "# %s: %s\n", path, strerror(errno));
+      return -1;
+   }
+   if (fstat(fd, &st) == -1)
+      perror("fstat"), exit(EXIT_FAILURE);
+   err = fsh_ctx_open_fd(&ctx, fd, 0);
+   close(fd);
+   if (!err && (err = fsh_ctx_decode(ctx, 1)) < 0)
+      fsh_ctx_close(ctx);
+   if (err < 0)
+   {
+      fprintf(stderr, "# %s: %s\n", path, err == FSH_ERR_IO ? strerror(errno) : fsh_strerror(err));
+      return err;
+   }
+
+   file = ix->file_cnt++;
+   if ((ix->file = realloc(ix->file, sizeof(*ix->file) * ix->file_cnt)) == NULL)
+      perror("realloc"), exit(EXIT_FAILURE);
+   ix->file[file].size = st.st_size;
+   ix->file[file].mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+   ix->file[file].name = ix->str_size;
+   len = strlen(rpath) + 1;
+   if ((ix->str = realloc(ix->str, ix->str_size + len)) == NULL)
+      perror("realloc"), exit(EXIT_FAILURE);
+   memcpy(ix->str + ix->str_size, rpath, len);
+   ix->str_size += len;
+
+   // waypoints are taken from the block list directly for the block GUID
+   for (blk = ctx->blk; blk->hdr.type != FSH_BLK_ILL; blk++)
+   {
+      if (blk->hdr.type != FSH_BLK_WPT || blk->hdr.len < sizeof(*wpt) || (off = block_off(ctx, blk->data)) == -1)
+         continue;
+      wpt = blk->data;
+      e = ix_add(ix, tile_key(wpt->wpd.north, wpt->wpd.east));
+      e->guid = blk->hdr.guid;
+      e->off = off;
+      e->file = file;
+      e->type = FSH_BLK_WPT;
+      e->t0 = e->t1 = fsh_time(&wpt->wpd.ts);
+      e->north0 = e->north1 = wpt->wpd.north;
+      e->east0 = e->east1 = wpt->wpd.east;
+      ix->wpt++;
+   }
+
+   fsh_cursor_init(&cur, ctx);
+   while ((err = fsh_next_track(&cur, &trk)) > 0)
+      for (i = 0; i < trk.mta->guid_cnt; i++)
+      {
+         if (trk.tseg[i].hdr == NULL)
+            continue;
+         if ((off = block_off(ctx, trk.tseg[i].hdr)) == -1)
+         {
+            vlog("%s: truncated segment %s not indexed\n", path, guid_to_string(trk.tseg[i].bhdr->guid));
+            continue;
+         }
+         index_tseg(ix, file, &trk, i, off);
+      }
+   fsh_cursor_free(&cur);
+   fsh_ctx_close(ctx);
+
+   if (err < 0)
+      fprintf(stderr, "# %s: %s\n", path, fsh_strerror(err)), exit(EXIT_FAILURE);
+   return 0;
+}
+
+
+static int cmp_ix_entry(const void *a, const void *b)
+{
+   const ix_entry_t *x = a, *y = b;
+
+   if (x->key != y->key)
+      return x->key < y->key ? -1 : 1;
+   if (x->e.file != y->e.file)
+      return x->e.file < y->e.file ? -1 : 1;
+   if (x->e.off != y->e.off)
+      return x->e.off < y->e.off ? -1 : 1;
+   return x->e.first - y->e.first;
+}
+
+
+/*! Sort the entries by tile and write the index to the file path. The index
+ * is written to a temporary file first which is renamed afterwards, thus a
+ * concurrent query always sees a complete index.
+ */
+static void ix_write(ix_t *ix, const char *path)
+{
+   char tmp[PATH_MAX];
+   idx_header_t hdr;
+   idx_tile_t tile;
+   obuf_t *out;
+   long i, j;
+   int fd;
+
+   qsort(ix->ent, ix->cnt, sizeof(*ix->ent), cmp_ix_entry);
+
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, IDX_MAGIC, sizeof(hdr.magic));
+   hdr.version = IDX_VERSION;
+   hdr.tile_bits = TILE_BITS;
+   hdr.file_cnt = ix->file_cnt;
+   hdr.entry_cnt = ix->cnt;
+   hdr.str_size = ix->str_size;
+   for (i = 0; i < ix->cnt; i++)
+      if (!i || ix->ent[i].key != ix->ent[i - 1].key)
+         hdr.tile_cnt++;
+
+   snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+   if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+      fprintf(stderr, "# cannot create %s: %s\n", tmp, strerror(errno)), exit(EXIT_FAILURE);
+   out = ob_open(fd, OBUF_SIZE);
+
+   ob_write(out, &hdr, sizeof(hdr));
+   ob_write(out, ix->file, sizeof(*ix->file) * ix->file_cnt);
+   for (i = 0; i < ix->cnt; i = j)
+   {
+      for (j = i + 1; j < ix->cnt && ix->ent[j].key == ix->ent[i].key; j++);
+      tile.key = ix->ent[i].key;
+      tile.cnt = j - i;
+      tile.first = i;
+      ob_write(out, &tile, sizeof(tile));
+   }
+   for (i = 0; i < ix->cnt; i++)
+      ob_write(out, &ix->ent[i].e, sizeof(ix->ent[i].e));
+   ob_write(out, ix->str, ix->str_size);
+
+   if (ob_flush(out) == -1)
+      perror("write"), exit(EXIT_FAILURE);
+   ob_close(out);
+   close(fd);
+   if (rename(tmp, path) == -1)
+      perror("rename"), exit(EXIT_FAILURE);
+}
+
+
+/*! Map the index file path into memory and check its structure.
+ * @return Returns 0 on success, otherwise -1 with an error message printed.
+ */
+static int idx_open(idx_t *idx, const char *path)
+{
+   struct stat st;
+   const char *base;
+   size_t size;
+   int fd;
+
+   if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+   {
+      fprintf(stderr, "# %s: %s\n", path, strerror(errno));
+      return -1;
+   }
+   if ((size_t) st.st_size < sizeof(*idx->hdr)
+         || (base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+   {
+      fprintf(stderr, "# %s: no index\n", path);
+      close(fd);
+      return -1;
+   }
+   close(fd);
+
+   idx->size = st.st_size;
+   idx->hdr = (const idx_header_t*) base;
+   if (memcmp(idx->hdr->magic, IDX_MAGIC, sizeof(idx->hdr->magic)) || idx->hdr->version != IDX_VERSION
+         || idx->hdr->tile_bits != TILE_BITS)
+   {
+      fprintf(stderr, "# %s: no index or incompatible version, rebuild it\n", path);
+      munmap((void*) base, idx->size);
+      return -1;
+   }
+
+   size = sizeof(*idx->hdr) + sizeof(*idx->file) * idx->hdr->file_cnt + sizeof(*idx->tile) * idx->hdr->tile_cnt
+      + sizeof(*idx->ent) * idx->hdr->entry_cnt + idx->hdr->str_size;
+   if (idx->hdr->file_cnt < 0 || idx->hdr->tile_cnt < 0 || idx->hdr->entry_cnt < 0 || idx->hdr->str_size < 0
+         || size != idx->size)
+   {
+      fprintf(stderr, "# %s: index corrupt\n", path);
+      munmap((void*) base, idx->size);
+      return -1;
+   }
+
+   idx->file = (const idx_file_t*) (idx->hdr + 1);
+   idx->tile = (const idx_tile_t*) (idx->file + idx->hdr->file_cnt);
+   idx->ent = (const idx_entry_t*) (idx->tile + idx->hdr->tile_cnt);
+   idx->str = (const char*) (idx->ent + idx->hdr->entry_cnt);
+   return 0;
+}
+
+
+/*! Return the index of the first tile with a key greater or equal key. */
+static int tile_find(const idx_t *idx, uint32_t key)
+{
+   int l = 0, r = idx->hdr->tile_cnt, m;
+
+   while (l < r)
+   {
+      m = l + (r - l) / 2;
+      if (idx->tile[m].key < key)
+         l = m + 1;
+      else
+         r = m;
+   }
+   return l;
+}
+
+
+/*! Return 1 if the bounding box and the time window of the entry e intersect
+ * the query window q. Entries without time never match a time window.
+ */
+static int entry_match(const idx_entry_t *e, const query_t *q)
+{
+   if (e->north1 < q->north0 || e->north0 > q->north1 || e->east1 < q->east0 || e->east0 > q->east1)
+      return 0;
+   if (q->t1 && (!e->t0 || e->t1 < q->t0 || e->t0 > q->t1))
+      return 0;
+   return 1;
+}
+
+
+/*! Collect the entries which match the query window q. Only the tiles which
+ * intersect the window are looked at.
+ * @param list Pointer to the list of matching entries, which is reallocated.
+ * @param cnt Number of entries in the list.
+ * @param scanned Pointer to a counter of the entries looked at.
+ * @return Returns the new number of entries in the list.
+ */
+static long idx_collect(const idx_t *idx, const query_t *q, const idx_entry_t ***list, long cnt, long *scanned)
+{
+   uint32_t tx0, tx1, ty, ty1;
+   int t;
+   long i;
+
+   tx0 = tile_key(0, q->east0) & ((1 << TILE_BITS) - 1);
+   tx1 = tile_key(0, q->east1) & ((1 << TILE_BITS) - 1);
+   ty = tile_key(q->north0, 0) >> TILE_BITS;
+   ty1 = tile_key(q->north1, 0) >> TILE_BITS;
+
+   for (; ty <= ty1; ty++)
+      for (t = tile_find(idx, ty << TILE_BITS | tx0); t < idx->hdr->tile_cnt; t++)
+      {
+         if (idx->tile[t].key > (ty << TILE_BITS | tx1))
+            break;
+         for (i = idx->tile[t].first; i < idx->tile[t].first + idx->tile[t].cnt; i++)
+         {
+            (*scanned)++;
+            if (!entry_match(&idx->ent[i], q))
+               continue;
+            if (!(cnt & 1023) && (*list = realloc(*list, sizeof(**list) * (cnt + 1024))) == NULL)
+               perror("realloc"), exit(EXIT_FAILURE);
+            (*list)[cnt++] = &idx->ent[i];
+         }
+      }
+
+   return cnt;
+}
+
+
+static int cmp_entry_pos(const void *a, const void *b)
+{
+   const idx_entry_t *x = *(const idx_entry_t* const*) a, *y = *(const idx_entry_t* const*) b;
+
+   if (x->file != y->file)
+      return x->file < y->file ? -1 : 1;
+   if (x->off != y->off)
+      return x->off < y->off ? -1 : 1;
+   return x->first - y->first;
+}
+
+
+/*! Read the block referenced by the entry e from the archive fd into buf.
+ * The block is checked against the GUID and the type of the entry.
+ * @return Returns a pointer to the block data or NULL if the block does not
+ * match, i.e. the archive was modified.
+ */
+static const void *block_pread(int fd, const idx_entry_t *e, char *buf)
+{
+   fsh_block_header_t *bhdr = (fsh_block_header_t*) buf;
+   ssize_t len;
+
+   if (pread(fd, bhdr, sizeof(*bhdr), e->off) != sizeof(*bhdr) || bhdr->guid != e->guid || bhdr->type != e->type)
+      return NULL;
+   // truncated blocks are padded with 0 like fsh_block_map() does
+   if ((len = pread(fd, bhdr + 1, bhdr->len, e->off + sizeof(*bhdr))) == -1)
+      return NULL;
+   memset((char*) (bhdr + 1) + len, 0, bhdr->len - len);
+   return bhdr + 1;
+}
+
+
+/*! Output a CSV line of a point. */
+static void output_point(obuf_t *out, const char *path, const idx_entry_t *e, int pt, int32_t north, int32_t east,
+      int depth, uint16_t tempr, const fsh_wpt_data_t *wpd, const ellipsoid_t *el)
+{
+   char tbuf[FMT_TIME_LEN + 1], *p;
+
+   p = fmt_str(ob_reserve(out, LBUFLEN), path);
+   p = fmt_str(p, wpd != NULL ? ", wpt, " : ", trkpt, ");
+   p = fmt_str(p, guid_to_string(e->guid));
+   p = fmt_str(p, ", ");
+   if (wpd == NULL)
+   {
+      p = fmt_str(p, guid_to_string(e->trk));
+      p = fmt_str(p, ", ");
+      p = fmt_int(p, e->seg);
+      p = fmt_str(p, ", ");
+      p = fmt_int(p, pt);
+   }
+   else
+      p = fmt_str(p, ", , ");
+   p = fmt_str(p, ", ");
+   p = fmt_dbl(p, phi_merc(el, north / FSH_LAT_SCALE) * 180 / M_PI, 7);
+   p = fmt_str(p, ", ");
+   p = fmt_dbl(p, east / FSH_LON_SCALE * 180.0, 7);
+   p = fmt_str(p, ", ");
+   if (depth != DEPTH_NA)
+      p = fmt_int(p, depth);
+   p = fmt_str(p, ", ");
+   if (tempr != TEMPR_NA)
+      p = fmt_dbl(p, CELSIUS(tempr), 1);
+   p = fmt_str(p, ", ");
+   if (wpd != NULL)
+   {
+      fsh_timetostr(&wpd->ts, tbuf, sizeof(tbuf));
+      p = fmt_str(p, tbuf);
+      p = fmt_str(p, ", ");
+      p = fmt_strn(p, NAME(*wpd), wpd->name_len);
+   }
+   else
+      p = fmt_str(p, ", ");
+   *p++ = '\n';
+   ob_commit(out, p);
+}
+
+
+/*! Look up all entries of the index which match the query window(s) q, read
+ * the referenced blocks from the archives, and output the points within the
+ * window as CSV. Files which were modified since they were indexed are
+ * skipped.
+ * @param q List of query windows, a window crossing the antimeridian is split
+ * into two.
+ * @param qcnt Number of query windows.
+ * @return Returns the number of points written.
+ */
+static long idx_query(const idx_t *idx, const query_t *q, int qcnt, obuf_t *out, const ellipsoid_t *el)
+{
+   char buf[sizeof(fsh_block_header_t) + FLOB_SIZE];
+   const idx_entry_t **list = NULL, *e;
+   const fsh_track_header_t *thdr;
+   const fsh_track_point_t *pt;
+   const fsh_wpt01_t *wpt;
+   const void *data = NULL;
+   const char *path = NULL;
+   long cnt = 0, scanned = 0, points = 0, i;
+   int64_t off = -1;
+   int file = -1, fd = -1, blocks = 0, j, k;
+   struct stat st;
+   double t = now();
+
+   for (j = 0; j < qcnt; j++)
+      cnt = idx_collect(idx, &q[j], &list, cnt, &scanned);
+   // read every file only once and sequentially
+   qsort(list, cnt, sizeof(*list), cmp_entry_pos);
+
+   ob_puts(out, "# file, kind, guid, track, segment, point, lat, lon, depth [cm], tempr [C], time, name\n");
+   for (i = 0; i < cnt; i++)
+   {
+      e = list[i];
+      if (i && e == list[i - 1])
+         continue;
+
+      if (e->file != file)
+      {
+         if (fd != -1)
+            close(fd);
+         file = e->file;
+         path = idx->str + idx->file[file].name;
+         off = -1;
+         if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+            vlog("%s: %s\n", path, strerror(errno));
+         else if (st.st_size != idx->file[file].size || st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec != idx->file[file].mtime)
+         {
+            vlog("%s: modified since indexing, skipped\n", path);
+            close(fd);
+            fd = -1;
+         }
+      }
+      if (fd == -1)
+         continue;
+
+      if (e->off != off)
+      {
+         off = e->off;
+         blocks++;
+         if ((data = block_pread(fd, e, buf)) == NULL)
+            vlog("%s: block %s not found at offset %lld\n", path, guid_to_string(e->guid), (long long) off);
+      }
+      if (data == NULL)
+         continue;
+
+      if (e->type == FSH_BLK_WPT)
+      {
+         wpt = data;
+         output_point(out, path, e, 0, wpt->wpd.north, wpt->wpd.east, wpt->wpd.depth, wpt->wpd.tempr, &wpt->wpd, el);
+         points++;
+         continue;
+      }
+
+      thdr = data;
+      pt = (const fsh_track_point_t*) (thdr + 1);
+      for (k = e->first; k <= e->last && k < thdr->cnt; k++)
+      {
+         if (pt[k].c == -1)
+            continue;
+         for (j = 0; j < qcnt; j++)
+            if (pt[k].north >= q[j].north0 && pt[k].north <= q[j].north1 && pt[k].east >= q[j].east0 && pt[k].east <= q[j].east1)
+               break;
+         if (j == qcnt)
+            continue;
+         output_point(out, path, e, k, pt[k].north, pt[k].east, pt[k].depth, pt[k].tempr, NULL, el);
+         points++;
+      }
+   }
+   if (fd != -1)
+      close(fd);
+   free(list);
+
+   vlog("%ld of %ld entries matched, %d blocks read, %ld points, %.3f ms\n",
+         cnt, scanned, blocks, points, (now() - t) * 1E3);
+   return points;
+}
+
+
+/*! Parse a time given as seconds since 1970 or as date YYYY-MM-DD with an
+ * optional time THH:MM:SS (UTC).
+ * @param end 1 if the time is the end of a window, a date without time then
+ * means the end of the day.
+ * @return Returns the time in seconds since 1970 or -1 on error.
+ */
+static int64_t parse_time(const char *s, int end)
+{
+   struct tm tm;
+   char *e;
+   long v;
+   int n = 0;
+
+   memset(&tm, 0, sizeof(tm));
+   if (sscanf(s, "%d-%d-%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &n) == 3)
+   {
+      tm.tm_year -= 1900;
+      tm.tm_mon--;
+      if (s[n] == 'T' && sscanf(s + n + 1, "%d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 3)
+         end = 0;
+      return timegm(&tm) + (end ? 86399 : 0);
+   }
+
+   v = strtol(s, &e, 10);
+   return e != s && v >= 0 ? v : -1;
+}
+
+
+static void usage(const char *s)
+{
+   printf(
+         "%s\n"
+         "usage: %s [OPTIONS] FILE ...    build the index of the FSH files\n"
+         "       %s [OPTIONS] -b|-t ...   query the index\n"
+         "   -b <s>,<w>,<n>,<e>\n"
+         "                    Output track points and waypoints within this bounding\n"
+         "                    box (degrees).\n"
+         "   -h ............. This help.\n"
+         "   -i <file> ...... Index file (default fsh.idx).\n"
+         "   -q ............. Quiet. No informational output.\n"
+         "   -t <from>,<to> . Output waypoints within this time window, given as\n"
+         "                    seconds since 1970 or YYYY-MM-DD[THH:MM:SS] (UTC).\n"
+         "                    Track points have no time and never match.\n",
+         COPYLEFT, s, s);
+}
+
+
+int main(int argc, char **argv)
+{
+   ellipsoid_t el = WGS84;
+   const char *ipath = "fsh.idx";
+   double s, w, n, e, t;
+   int64_t t0 = 0, t1 = 0;
+   query_t q[2];
+   int c, qcnt, bbox = 0, twin = 0, failed = 0;
+   char *p;
+   idx_t idx;
+   ix_t ix;
+   obuf_t *out;
+
+   while ((c = getopt(argc, argv, "b:hi:qt:")) != -1)
+      switch (c)
+      {
+         case 'b':
+            if (sscanf(optarg, "%lf,%lf,%lf,%lf", &s, &w, &n, &e) != 4 || s > n)
+               fprintf(stderr, "# illegal bounding box '%s'\n", optarg), exit(EXIT_FAILURE);
+            bbox = 1;
+            break;
+
+         case 'h':
+            usage(argv[0]);
+            return 0;
+
+         case 'i':
+            ipath = optarg;
+            break;
+
+         case 'q':
+            logout_ = NULL;
+            break;
+
+         case 't':
+            if ((p = strchr(optarg, ',')) == NULL || (t0 = parse_time(optarg, 0)) == -1
+                  || (t1 = parse_time(p + 1, 1)) == -1 || t0 > t1)
+               fprintf(stderr, "# illegal time window '%s'\n", optarg), exit(EXIT_FAILURE);
+            twin = 1;
+            break;
+      }
+
+   init_ellipsoid(&el);
+
+   if (optind < argc)
+   {
+      t = now();
+      memset(&ix, 0, sizeof(ix));
+      for (; optind < argc; optind++)
+         if (index_file(&ix, argv[optind]) < 0)
+            failed++;
+      ix_write(&ix, ipath);
+      vlog("%d files indexed, %d failed, %ld entries, %ld track points, %ld waypoints, %.3f s\n",
+            ix.file_cnt, failed, ix.cnt, ix.trkpt, ix.wpt, now() - t);
+      free(ix.ent);
+      free(ix.file);
+      free(ix.str);
+      return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+   }
+
+   if (!bbox && !twin)
+      fprintf(stderr, "# neither input files nor a query given, see -h\n"), exit(EXIT_FAILURE);
+   if (idx_open(&idx, ipath) == -1)
+      exit(EXIT_FAILURE);
+
+   memset(q, 0, sizeof(q));
+   if (bbox)
+   {
+      q[0].north0 = fsh_north(&el, s);
+      q[0].north1 = fsh_north(&el, n);
+      q[0].east0 = fsh_east(w);
+      q[0].east1 = fsh_east(e);
+   }
+   else
+   {
+      q[0].north0 = q[0].east0 = INT32_MIN;
+      q[0].north1 = q[0].east1 = INT32_MAX;
+   }
+   if (twin)
+   {
+      q[0].t0 = t0;
+      q[0].t1 = t1;
+   }
+   q[1] = q[0];
+   qcnt = 1;
+   // the bounding box crosses the antimeridian
+   if (bbox && w > e)
+   {
+      q[0].east1 = INT32_MAX;
+      q[1].east0 = INT32_MIN;
+      qcnt = 2;
+   }
+
+   out = ob_open(STDOUT_FILENO, OBUF_SIZE);
+   idx_query(&idx, q, qcnt, out, &el);
+   ob_close(out);
+   munmap((void*) idx.hdr, idx.size);
+
+   return EXIT_SUCCESS;
+}
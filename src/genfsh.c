@@ -0,0 +1,413 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This program generates synthetic ARCHIVE.FSH files with random waypoints,
+ *  tracks, and routes. They are used as test and benchmark data for parsefsh.
+ *  The output is deterministic for a given seed.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+
+#include "fshfunc.h"
+#include "projection.h"
+
+
+#define DEG2RAD(x) ((x) * M_PI / 180.0)
+// max. number of points of a track segment that it still fits into a FLOB
+#define MAX_SEG_PTS ((FLOB_SIZE - sizeof(fsh_flob_header_t) - 2 * sizeof(fsh_block_header_t) - sizeof(fsh_track_header_t)) / sizeof(fsh_track_point_t))
+// max. number of waypoints of a route
+#define MAX_RTE_WPTS 400
+
+
+// FSH image in memory
+typedef struct image
+{
+   char *buf;        //!< pointer to the image
+   int flobs;        //!< number of FLOBs in the image
+   int pos;          //!< write position within the last FLOB (after its header)
+   uint64_t guid;    //!< last GUID used
+} image_t;
+
+
+static uint64_t rnd_state_ = 1;
+
+
+/*! Return a pseudo random number (xorshift64*). */
+static uint64_t rnd(void)
+{
+   rnd_state_ ^= rnd_state_ >> 12;
+   rnd_state_ ^= rnd_state_ << 25;
+   rnd_state_ ^= rnd_state_ >> 27;
+   return rnd_state_ * 0x2545f4914f6cdd1dULL;
+}
+
+
+/*! Return a pseudo random number within [a, b). */
+static double rnd_uni(double a, double b)
+{
+   return a + (b - a) * (rnd() >> 11) / (double) (1ULL << 53);
+}
+
+
+/*! Return a new unique GUID. */
+static uint64_t new_guid(image_t *img)
+{
+   img->guid++;
+   return img->guid << 48 | (rnd() & 0xffffffffffffULL);
+}
+
+
+/*! Append a new empty FLOB to the image. */
+static void new_flob(image_t *img)
+{
+   fsh_flob_header_t *flob;
+
+   if ((img->buf = realloc(img->buf, sizeof(fsh_file_header_t) + (size_t) (img->flobs + 1) * FLOB_SIZE)) == NULL)
+      perror("realloc"), exit(EXIT_FAILURE);
+
+   flob = (fsh_flob_header_t*) (img->buf + sizeof(fsh_file_header_t) + (size_t) img->flobs * FLOB_SIZE);
+   // unused flash memory is 0xff, which is also the end mark of the block list
+   memset(flob, 0xff, FLOB_SIZE);
+   memcpy(flob->rflob, RFLOB_STR, sizeof(flob->rflob));
+   flob->f = 1;
+   flob->g = 1;
+   flob->h = (int16_t) 0xfffe;
+
+   img->flobs++;
+   img->pos = 0;
+}
+
+
+/*! Append a new block to the image. A new FLOB is started if the block does
+ * not fit into the current one.
+ * @param img Pointer to the image.
+ * @param guid GUID of the block.
+ * @param type Type of the block.
+ * @param len Length of the block data.
+ * @return Returns a pointer to the zeroed block data.
+ */
+static void *new_block(image_t *img, uint64_t guid, uint16_t type, int len)
+{
+   fsh_block_header_t *bhdr;
+   int rlen = len + (len & 1);
+
+   if (sizeof(fsh_flob_header_t) + sizeof(*bhdr) + rlen > FLOB_SIZE)
+      fprintf(stderr, "# block of %d bytes does not fit into a FLOB\n", len), exit(EXIT_FAILURE);
+
+   if (!img->flobs || img->pos + sizeof(fsh_flob_header_t) + sizeof(*bhdr) + rlen > FLOB_SIZE)
+      new_flob(img);
+
+   bhdr = (fsh_block_header_t*) (img->buf + sizeof(fsh_file_header_t)
+         + (size_t) (img->flobs - 1) * FLOB_SIZE + sizeof(fsh_flob_header_t) + img->pos);
+   bhdr->len = len;
+   bhdr->guid = guid;
+   bhdr->type = type;
+   bhdr->unknown = 0x4000;
+   memset(bhdr + 1, 0, rlen);
+
+   img->pos += sizeof(*bhdr) + rlen;
+   return bhdr + 1;
+}
+
+
+/*! Fill the common waypoint data wpd which is followed by the name and the
+ * comment.
+ */
+static void fill_wpd(const ellipsoid_t *el, fsh_wpt_data_t *wpd, double lat, double lon, const char *name, const char *cmt)
+{
+   wpd->north = fsh_north(el, lat);
+   wpd->east = fsh_east(lon);
+   wpd->sym = rnd() % 32;
+   wpd->tempr = rnd() % 4 ? 27315 + rnd() % 3000 : TEMPR_NA;
+   wpd->depth = rnd() % 4 ? (int32_t) (rnd() % 10000) : DEPTH_NA;
+   wpd->ts.timeofday = rnd() % 86400;
+   wpd->ts.date = 16000 + rnd() % 4000;
+   wpd->name_len = strlen(name);
+   wpd->cmt_len = strlen(cmt);
+   memcpy(wpd->txt_data, name, wpd->name_len);
+   memcpy(wpd->txt_data + wpd->name_len, cmt, wpd->cmt_len);
+}
+
+
+static void gen_waypoints(image_t *img, const ellipsoid_t *el, int cnt)
+{
+   fsh_wpt01_t *wpt;
+   char name[32], cmt[32];
+   uint64_t guid;
+   int i;
+
+   for (i = 0; i < cnt; i++)
+   {
+      snprintf(name, sizeof(name), "WPT %d", i);
+      snprintf(cmt, sizeof(cmt), "comment <%d> & more", i);
+      guid = new_guid(img);
+      wpt = new_block(img, guid, FSH_BLK_WPT, sizeof(*wpt) + strlen(name) + strlen(cmt));
+      wpt->guid = guid;
+      fill_wpd(el, &wpt->wpd, rnd_uni(-80, 80), rnd_uni(-180, 180), name, cmt);
+   }
+}
+
+
+/*! Generate cnt tracks of seg_cnt segments of pt_cnt points each. The
+ * segments of a track are written before its meta block, like the chart
+ * plotter does.
+ */
+static void gen_tracks(image_t *img, const ellipsoid_t *el, int cnt, int seg_cnt, int pt_cnt)
+{
+   fsh_track_header_t *thdr;
+   fsh_track_point_t *pt;
+   fsh_track_meta_t *mta;
+   fsh_track_point_t first, last;
+   uint64_t guid[255];
+   double lat, lon, crs;
+   char name[32];
+   int i, j, k;
+
+   memset(&first, 0, sizeof(first));
+   memset(&last, 0, sizeof(last));
+   for (i = 0; i < cnt; i++)
+   {
+      lat = rnd_uni(-75, 75);
+      lon = rnd_uni(-175, 175);
+      crs = rnd_uni(0, 2 * M_PI);
+
+      for (j = 0; j < seg_cnt; j++)
+      {
+         guid[j] = new_guid(img);
+         thdr = new_block(img, guid[j], FSH_BLK_TRK, sizeof(*thdr) + sizeof(*pt) * pt_cnt);
+         thdr->cnt = pt_cnt;
+         pt = (fsh_track_point_t*) (thdr + 1);
+         for (k = 0; k < pt_cnt; k++)
+         {
+            // random walk of approx. 20m per point
+            crs += rnd_uni(-0.2, 0.2);
+            lat += cos(crs) * 0.0002;
+            lon += sin(crs) * 0.0002 / cos(DEG2RAD(lat));
+            if (lat > 80 || lat < -80)
+               crs += M_PI;
+            if (lon > 180)
+               lon -= 360;
+            if (lon < -180)
+               lon += 360;
+            pt[k].north = fsh_north(el, lat);
+            pt[k].east = fsh_east(lon);
+            pt[k].tempr = 28315 + rnd() % 1000;
+            pt[k].depth = rnd() % 5000;
+            // few points are marked as invalid
+            pt[k].c = rnd() % 64 ? 0 : -1;
+         }
+         // keep copies, new_block() may move the image
+         if (!j)
+            first = pt[0];
+         last = pt[pt_cnt - 1];
+      }
+
+      mta = new_block(img, new_guid(img), FSH_BLK_MTA, sizeof(*mta) + sizeof(*mta->guid) * seg_cnt);
+      mta->a = 1;
+      mta->cnt = mta->_cnt = seg_cnt * pt_cnt;
+      mta->length = seg_cnt * pt_cnt * 20;
+      mta->north_start = first.north;
+      mta->east_start = first.east;
+      mta->tempr_start = first.tempr;
+      mta->depth_start = first.depth;
+      mta->north_end = last.north;
+      mta->east_end = last.east;
+      mta->tempr_end = last.tempr;
+      mta->depth_end = last.depth;
+      mta->col = i % 6;
+      // the name is not terminated if it has 16 characters
+      snprintf(name, sizeof(name), "Track %d", i);
+      memcpy(mta->name, name, strlen(name) < sizeof(mta->name) ? strlen(name) : sizeof(mta->name));
+      mta->guid_cnt = seg_cnt;
+      memcpy(mta->guid, guid, sizeof(*guid) * seg_cnt);
+   }
+}
+
+
+static void gen_routes(image_t *img, const ellipsoid_t *el, int cnt, int wpt_cnt)
+{
+   fsh_route21_header_t *rhdr;
+   struct fsh_hdr2 *hdr2;
+   struct fsh_pt *rpt;
+   struct fsh_hdr3 *hdr3;
+   fsh_route_wpt_t *wpt;
+   int64_t *guid;
+   char name[32], wname[32];
+   double lat, lon;
+   int i, j, len;
+
+   for (i = 0; i < cnt; i++)
+   {
+      snprintf(name, sizeof(name), "Route %d", i);
+      len = sizeof(*rhdr) + strlen(name) + (sizeof(*guid) + sizeof(*rpt)) * wpt_cnt + sizeof(*hdr2) + sizeof(*hdr3);
+      for (j = 0; j < wpt_cnt; j++)
+         len += sizeof(*wpt) + snprintf(wname, sizeof(wname), "RP %d/%d", i, j);
+
+      rhdr = new_block(img, new_guid(img), FSH_BLK_RTE, len);
+      rhdr->name_len = strlen(name);
+      rhdr->guid_cnt = wpt_cnt;
+      memcpy(rhdr->txt_data, name, rhdr->name_len);
+
+      guid = (int64_t*) (rhdr->txt_data + rhdr->name_len);
+      hdr2 = (struct fsh_hdr2*) (guid + wpt_cnt);
+      rpt = (struct fsh_pt*) (hdr2 + 1);
+      hdr3 = (struct fsh_hdr3*) (rpt + wpt_cnt);
+      wpt = (fsh_route_wpt_t*) (hdr3 + 1);
+      hdr3->wpt_cnt = wpt_cnt;
+
+      lat = rnd_uni(-60, 60);
+      lon = rnd_uni(-170, 170);
+      for (j = 0; j < wpt_cnt; j++)
+      {
+         lat += rnd_uni(-0.05, 0.05);
+         lon += rnd_uni(-0.05, 0.05);
+         wpt->guid = new_guid(img);
+         // the GUID list is not aligned
+         memcpy(&guid[j], &wpt->guid, sizeof(*guid));
+         wpt->wpt.lat = lat * 1E7;
+         wpt->wpt.lon = lon * 1E7;
+         snprintf(wname, sizeof(wname), "RP %d/%d", i, j);
+         fill_wpd(el, &wpt->wpt.wpd, lat, lon, wname, "");
+         rpt[j].sym = wpt->wpt.wpd.sym;
+         if (!j)
+         {
+            hdr2->lat0 = wpt->wpt.lat;
+            hdr2->lon0 = wpt->wpt.lon;
+         }
+         hdr2->lat1 = wpt->wpt.lat;
+         hdr2->lon1 = wpt->wpt.lon;
+         wpt = (fsh_route_wpt_t*) ((char*) wpt + sizeof(*wpt) + wpt->wpt.wpd.name_len + wpt->wpt.wpd.cmt_len);
+      }
+   }
+}
+
+
+static void usage(const char *s)
+{
+   printf(
+         "usage: %s [OPTIONS] > ARCHIVE.FSH\n"
+         "   -f <n> ......... Number of FLOBs (default: as many as needed).\n"
+         "   -h ............. This help.\n"
+         "   -p <n> ......... Number of points per track segment (default 500, max. %d).\n"
+         "   -r <n> ......... Number of routes (default 5).\n"
+         "   -R <n> ......... Number of waypoints per route (default 10, max. %d).\n"
+         "   -s <n> ......... Number of segments per track (default 3, max. 255).\n"
+         "   -S <n> ......... Seed of the random number generator (default 1).\n"
+         "   -t <n> ......... Number of tracks (default 10).\n"
+         "   -w <n> ......... Number of waypoints (default 100).\n",
+         s, (int) MAX_SEG_PTS, MAX_RTE_WPTS);
+}
+
+
+int main(int argc, char **argv)
+{
+   ellipsoid_t el = WGS84;
+   fsh_file_header_t *fhdr;
+   image_t img;
+   int flobs = 0, trk_cnt = 10, seg_cnt = 3, pt_cnt = 500, wpt_cnt = 100, rte_cnt = 5, rte_wpts = 10;
+   size_t size, off;
+   ssize_t len;
+   int c;
+
+   while ((c = getopt(argc, argv, "f:hp:r:R:s:S:t:w:")) != -1)
+      switch (c)
+      {
+         case 'f':
+            flobs = atoi(optarg);
+            break;
+
+         case 'h':
+            usage(argv[0]);
+            return 0;
+
+         case 'p':
+            pt_cnt = atoi(optarg);
+            break;
+
+         case 'r':
+            rte_cnt = atoi(optarg);
+            break;
+
+         case 'R':
+            rte_wpts = atoi(optarg);
+            break;
+
+         case 's':
+            seg_cnt = atoi(optarg);
+            break;
+
+         case 'S':
+            rnd_state_ = strtoull(optarg, NULL, 0) * 0x9e3779b97f4a7c15ULL + 1;
+            break;
+
+         case 't':
+            trk_cnt = atoi(optarg);
+            break;
+
+         case 'w':
+            wpt_cnt = atoi(optarg);
+            break;
+      }
+
+   if (pt_cnt < 1 || pt_cnt > (int) MAX_SEG_PTS || seg_cnt < 1 || seg_cnt > 255
+         || rte_wpts < 1 || rte_wpts > MAX_RTE_WPTS || trk_cnt < 0 || rte_cnt < 0 || wpt_cnt < 0)
+      fprintf(stderr, "# parameter out of range, see -h\n"), exit(EXIT_FAILURE);
+
+   if (isatty(STDOUT_FILENO))
+      fprintf(stderr, "# refusing to write binary data to a terminal\n"), exit(EXIT_FAILURE);
+
+   init_ellipsoid(&el);
+   memset(&img, 0, sizeof(img));
+   if ((img.buf = malloc(sizeof(*fhdr))) == NULL)
+      perror("malloc"), exit(EXIT_FAILURE);
+
+   gen_waypoints(&img, &el, wpt_cnt);
+   gen_tracks(&img, &el, trk_cnt, seg_cnt, pt_cnt);
+   gen_routes(&img, &el, rte_cnt, rte_wpts);
+
+   if (flobs && img.flobs > flobs)
+      fprintf(stderr, "# data needs %d FLOBs, more than %d\n", img.flobs, flobs), exit(EXIT_FAILURE);
+   while (img.flobs < flobs || !img.flobs)
+      new_flob(&img);
+   if (img.flobs > INT16_MAX)
+      fprintf(stderr, "# too many FLOBs: %d\n", img.flobs), exit(EXIT_FAILURE);
+
+   fhdr = (fsh_file_header_t*) img.buf;
+   memset(fhdr, 0, sizeof(*fhdr));
+   memcpy(fhdr->rl90, RL90_STR, sizeof(RL90_STR));
+   fhdr->flobs = img.flobs;
+   fhdr->c = fhdr->d = fhdr->e = 1;
+
+   size = sizeof(*fhdr) + (size_t) img.flobs * FLOB_SIZE;
+   for (off = 0; off < size; off += len)
+      if ((len = write(STDOUT_FILENO, img.buf + off, size - off)) == -1)
+         perror("write"), exit(EXIT_FAILURE);
+
+   fprintf(stderr, "# %d FLOBs, %d waypoints, %d tracks, %d points, %d routes\n",
+         img.flobs, wpt_cnt, trk_cnt, trk_cnt * seg_cnt * pt_cnt, rte_cnt);
+
+   free(img.buf);
+   return 0;
+}
+
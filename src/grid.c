@@ -0,0 +1,245 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the gridding of soundings, i.e. the depths of track
+ *  points and waypoints, into a raster of square cells. Each cell keeps the
+ *  count, mean, minimum, maximum, and variance of its soundings which are
+ *  updated with Welford's algorithm, thus the memory depends only on the
+ *  number of cells. The cells are squares of the Mercator projection, which
+ *  is the projection of the FSH coordinates, hence the soundings are binned
+ *  without projecting them.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "grid.h"
+
+
+#define DEG2RAD(x) ((x) * M_PI / 180.0)
+// Mercator coordinates in m of FSH easting and northing
+#define GRID_X(el, east) ((east) / FSH_LON_SCALE * M_PI * (el)->a)
+#define GRID_Y(north) ((north) / FSH_LAT_SCALE)
+
+typedef void (*grid_fn_t)(void *, double , double , int );
+
+
+/*! Call fn for each sounding of the decoded archive ctx, i.e. for each
+ * waypoint and track point with a depth, with its Mercator coordinates and
+ * its depth in cm. Items which do not match the filter of the context are
+ * skipped.
+ * @return Returns the number of soundings or a negative error code, see
+ * fsh_next_track().
+ */
+static long grid_scan(const fsh_ctx_t *ctx, const ellipsoid_t *el, grid_fn_t fn, void *arg)
+{
+   const fsh_wpt01_t *wpt;
+   const fsh_track_point_t *pt;
+   fsh_cursor_t cur;
+   track_t trk;
+   long n = 0;
+   int i, k, err;
+
+   fsh_cursor_init(&cur, ctx);
+   while ((err = fsh_next_wpt(&cur, &wpt)) > 0)
+      if (wpt->wpd.depth != DEPTH_NA)
+      {
+         fn(arg, GRID_X(el, wpt->wpd.east), GRID_Y(wpt->wpd.north), wpt->wpd.depth);
+         n++;
+      }
+   if (err < 0)
+      return err;
+
+   fsh_cursor_init(&cur, ctx);
+   while ((err = fsh_next_track(&cur, &trk)) > 0)
+      for (k = 0; k < trk.mta->guid_cnt; k++)
+      {
+         if (trk.tseg[k].hdr == NULL)
+            continue;
+         for (i = 0, pt = trk.tseg[k].pt; i < trk.tseg[k].hdr->cnt; i++, pt++)
+            if (pt->c != -1 && pt->depth != DEPTH_NA)
+            {
+               fn(arg, GRID_X(el, pt->east), GRID_Y(pt->north), pt->depth);
+               n++;
+            }
+      }
+   fsh_cursor_free(&cur);
+
+   return err < 0 ? err : n;
+}
+
+
+/*! Convert a bounding box in degrees to Mercator coordinates.
+ * The box must not cross the antimeridian, i.e. west <= east.
+ * @param ext Array which receives south, west, north, and east in m.
+ */
+void fsh_grid_bbox(const ellipsoid_t *el, double south, double west, double north, double east, double *ext)
+{
+   ext[0] = northing(el, DEG2RAD(south));
+   ext[1] = DEG2RAD(west) * el->a;
+   ext[2] = northing(el, DEG2RAD(north));
+   ext[3] = DEG2RAD(east) * el->a;
+}
+
+
+static void grid_ext(void *p, double x, double y, int depth)
+{
+   double *ext = p;
+
+   (void) depth;
+   ext[0] = fmin(ext[0], y);
+   ext[1] = fmin(ext[1], x);
+   ext[2] = fmax(ext[2], y);
+   ext[3] = fmax(ext[3], x);
+}
+
+
+/*! Enlarge the extent ext by all soundings of the archive ctx.
+ * @param ext Array of south, west, north, and east in Mercator m. An empty
+ * extent is initialized with HUGE_VAL for south and west and -HUGE_VAL for
+ * north and east.
+ * @return Returns the number of soundings or a negative error code.
+ */
+int fsh_grid_extent(const fsh_ctx_t *ctx, const ellipsoid_t *el, double *ext)
+{
+   return grid_scan(ctx, el, grid_ext, ext);
+}
+
+
+/*! Initialize a grid which covers the extent ext. The size of the cells is
+ * given in m at the mean latitude of the extent and converted to the scale
+ * of the Mercator projection.
+ * @param ext Array of south, west, north, and east in Mercator m, see
+ * fsh_grid_bbox() and fsh_grid_extent(). It must not be empty.
+ * @param size Edge length of the cells in m.
+ * @return Returns 0 on success or FSH_ERR_NOMEM if the grid has more than
+ * FSH_GRID_MAX_CELLS cells or the memory is exhausted.
+ */
+int fsh_grid_init(fsh_grid_t *g, const ellipsoid_t *el, const double *ext, double size)
+{
+   double phi, w, h;
+
+   memset(g, 0, sizeof(*g));
+
+   phi = phi_merc(el, (ext[0] + ext[2]) / 2);
+   g->size = size / (cos(phi) / sqrt(1 - pow(el->e * sin(phi), 2)));
+   g->x0 = ext[1];
+   g->y0 = ext[0];
+
+   // soundings on the north and east edge are within the grid
+   w = floor((ext[3] - ext[1]) / g->size) + 1;
+   h = floor((ext[2] - ext[0]) / g->size) + 1;
+   if (w * h > FSH_GRID_MAX_CELLS)
+      return FSH_ERR_NOMEM;
+   g->ncols = w;
+   g->nrows = h;
+
+   if ((g->cell = calloc((long) g->ncols * g->nrows, sizeof(*g->cell))) == NULL)
+      return FSH_ERR_NOMEM;
+   return 0;
+}
+
+
+/*! Add a sounding to the grid. Soundings outside of the grid are counted
+ * but otherwise ignored.
+ * @param x Mercator easting in m.
+ * @param y Mercator northing in m.
+ * @param depth Depth in cm.
+ */
+void fsh_grid_add(fsh_grid_t *g, double x, double y, int depth)
+{
+   fsh_grid_cell_t *c;
+   double col, row, d;
+
+   col = (x - g->x0) / g->size;
+   row = (y - g->y0) / g->size;
+   if (!(col >= 0 && col < g->ncols && row >= 0 && row < g->nrows))
+   {
+      g->outside++;
+      return;
+   }
+
+   c = &g->cell[(long) (g->nrows - 1 - (int) row) * g->ncols + (int) col];
+   if (!c->cnt)
+      c->min = c->max = depth;
+   else if (depth < c->min)
+      c->min = depth;
+   else if (depth > c->max)
+      c->max = depth;
+
+   c->cnt++;
+   d = depth - c->mean;
+   c->mean += d / c->cnt;
+   c->m2 += d * (depth - c->mean);
+   g->pts++;
+}
+
+
+static void grid_add(void *p, double x, double y, int depth)
+{
+   fsh_grid_add(p, x, y, depth);
+}
+
+
+/*! Add all soundings of the decoded archive ctx to the grid. Thus, several
+ * archives may be accumulated into one grid.
+ * @return Returns the number of soundings or a negative error code.
+ */
+int fsh_grid_ctx(fsh_grid_t *g, const fsh_ctx_t *ctx, const ellipsoid_t *el)
+{
+   return grid_scan(ctx, el, grid_add, g);
+}
+
+
+/*! Return a statistic of a grid cell.
+ * @param stat One of FSH_GRID_COUNT, FSH_GRID_MEAN, FSH_GRID_MIN,
+ * FSH_GRID_MAX, or FSH_GRID_VAR (population variance).
+ * @return Returns the value, depths in m and variances in m^2. All values
+ * but the count are NAN if the cell is empty.
+ */
+double fsh_grid_value(const fsh_grid_cell_t *c, int stat)
+{
+   if (stat == FSH_GRID_COUNT)
+      return c->cnt;
+   if (!c->cnt)
+      return NAN;
+
+   switch (stat)
+   {
+      case FSH_GRID_MEAN:
+         return c->mean / 100;
+      case FSH_GRID_MIN:
+         return c->min / 100.0;
+      case FSH_GRID_MAX:
+         return c->max / 100.0;
+      case FSH_GRID_VAR:
+         return c->m2 / c->cnt / 10000;
+   }
+   return NAN;
+}
+
+
+/*! Free the cells of the grid. */
+void fsh_grid_free(fsh_grid_t *g)
+{
+   free(g->cell);
+   g->cell = NULL;
+}
+
@@ -0,0 +1,69 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the data structures and prototypes of the gridding of
+ *  soundings.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#ifndef GRID_H
+#define GRID_H
+
+#include <stdint.h>
+
+#include "fshfunc.h"
+#include "projection.h"
+
+// max. number of cells of a grid
+#define FSH_GRID_MAX_CELLS (1L << 28)
+
+// statistics of a grid cell, see fsh_grid_value()
+enum {FSH_GRID_COUNT, FSH_GRID_MEAN, FSH_GRID_MIN, FSH_GRID_MAX, FSH_GRID_VAR, FSH_GRID_STATS};
+
+// accumulated soundings of a grid cell
+typedef struct fsh_grid_cell
+{
+   double mean;         //!< mean depth in cm
+   double m2;           //!< sum of the squared deviations from the mean
+   uint32_t cnt;        //!< number of soundings
+   int32_t min, max;    //!< depth in cm, valid if cnt > 0
+} fsh_grid_cell_t;
+
+// grid of square cells in the Mercator projection of the ellipsoid, i.e.
+// World Mercator (EPSG:3395) for WGS84
+typedef struct fsh_grid
+{
+   double x0, y0;       //!< Mercator coordinates of the lower left corner in m
+   double size;         //!< edge length of the cells in Mercator m
+   int ncols, nrows;    //!< number of cells
+   fsh_grid_cell_t *cell;  //!< cells row by row from north to south
+   long pts;            //!< number of soundings added
+   long outside;        //!< number of soundings outside of the grid
+} fsh_grid_t;
+
+
+void fsh_grid_bbox(const ellipsoid_t *, double , double , double , double , double *);
+int fsh_grid_extent(const fsh_ctx_t *, const ellipsoid_t *, double *);
+int fsh_grid_init(fsh_grid_t *, const ellipsoid_t *, const double *, double );
+void fsh_grid_add(fsh_grid_t *, double , double , int );
+int fsh_grid_ctx(fsh_grid_t *, const fsh_ctx_t *, const ellipsoid_t *);
+double fsh_grid_value(const fsh_grid_cell_t *, int );
+void fsh_grid_free(fsh_grid_t *);
+
+#endif
+
@@ -0,0 +1,303 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains fast number formatting functions which replace
+ * printf("%.*f") and printf("%d") in the output functions. All functions
+ * write to a character buffer, which must be large enough, and return a
+ * pointer to the end of the written string. The result is not \0-terminated.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "numfmt.h"
+
+
+// maximum precision of the fast path of fmt_dbl()
+#define FMT_MAX_PREC 17
+
+
+static const uint64_t pow10_[] =
+{
+   1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+   100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+   1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+   1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL
+};
+
+
+/*! Write the unsigned integer v with at least width digits (padded with 0).
+ */
+static char *fmt_uint(char *p, uint64_t v, int width)
+{
+   char buf[24], *s = buf + sizeof(buf);
+
+   do
+   {
+      *--s = '0' + v % 10;
+      v /= 10;
+      width--;
+   }
+   while (v);
+
+   for (; width > 0; width--)
+      *--s = '0';
+
+   memcpy(p, s, buf + sizeof(buf) - s);
+   return p + (buf + sizeof(buf) - s);
+}
+
+
+/*! This function formats the double x with prec digits after the decimal
+ * point exactly like printf("%.*f", prec, x) does. The number is scaled
+ * with integer arithmetic on the exact binary value of x, thus it is
+ * correctly rounded (round half to even). Numbers which are out of the range
+ * of the fast path (|x| * 10^prec >= 2^64, |x| >= 2^53, infinity, NaN) are
+ * formatted with snprintf().
+ * @param p Pointer to the destination buffer.
+ * @param x Number to format.
+ * @param prec Number of digits after the decimal point.
+ * @return Returns a pointer to the first byte after the formatted number.
+ */
+char *fmt_dbl(char *p, double x, int prec)
+{
+   union { double d; uint64_t u; } v = {x};
+   unsigned __int128 prod, rem, half;
+   uint64_t m, q;
+   int e;
+
+   e = (v.u >> 52) & 0x7ff;
+   m = v.u & ((1ULL << 52) - 1);
+
+   // Inf, NaN, large numbers, large precision
+   if (e == 0x7ff || e >= 1075 || prec < 0 || prec > FMT_MAX_PREC)
+      return p + sprintf(p, "%.*f", prec, x);
+
+   // normalized or subnormal, x = m * 2^-e
+   if (e)
+      m |= 1ULL << 52;
+   else
+      e = 1;
+   e = 1075 - e;
+
+   prod = (unsigned __int128) m * pow10_[prec];
+   if (e >= 128)
+      q = 0;
+   else
+   {
+      if ((prod >> e) >> 64)
+         return p + sprintf(p, "%.*f", prec, x);
+      q = prod >> e;
+      rem = prod - ((unsigned __int128) q << e);
+      half = (unsigned __int128) 1 << (e - 1);
+      if (rem > half || (rem == half && (q & 1)))
+         q++;
+   }
+
+   if (v.u >> 63)
+      *p++ = '-';
+   p = fmt_uint(p, q / pow10_[prec], 1);
+   if (prec)
+   {
+      *p++ = '.';
+      p = fmt_uint(p, q % pow10_[prec], prec);
+   }
+   return p;
+}
+
+
+/*! This function formats the integer v like printf("%ld").
+ */
+char *fmt_int(char *p, long v)
+{
+   if (v < 0)
+   {
+      *p++ = '-';
+      return fmt_uint(p, -(uint64_t) v, 1);
+   }
+   return fmt_uint(p, v, 1);
+}
+
+
+/*! Copy the \0-terminated string s to p.
+ */
+char *fmt_str(char *p, const char *s)
+{
+   int len = strlen(s);
+
+   memcpy(p, s, len);
+   return p + len;
+}
+
+
+/*! Copy the string s of at most len bytes to p like printf("%.*s") does,
+ * i.e. the string ends at the first \0. If len is negative, at most 255
+ * bytes are copied.
+ */
+char *fmt_strn(char *p, const char *s, int len)
+{
+   len = strnlen(s, len < 0 ? 255 : len);
+   memcpy(p, s, len);
+   return p + len;
+}
+
+
+/*! This function formats the Unix time t as ISO-8601 string
+ * "YYYY-MM-DDTHH:MM:SSZ" exactly like strftime() with gmtime() would do.
+ * The date is calculated with integer arithmetic from the day number and it
+ * is cached per thread, thus only the time of day has to be formatted for
+ * consecutive timestamps of the same day. The function is thread-safe.
+ * @param p Pointer to the destination buffer of at least FMT_TIME_LEN bytes.
+ * @param t Seconds since 1970-01-01T00:00:00Z.
+ * @return Returns a pointer to the first byte after the string.
+ */
+char *fmt_time(char *p, int64_t t)
+{
+   static __thread int64_t day_ = INT64_MIN;
+   static __thread char date_[11];
+   int64_t day, sec, era, doe, yoe, y, doy, mp, m, d;
+   char *s;
+
+   day = t / 86400;
+   sec = t % 86400;
+   if (sec < 0)
+   {
+      sec += 86400;
+      day--;
+   }
+
+   if (day != day_)
+   {
+      // civil date from day number (proleptic Gregorian calendar)
+      day += 719468;
+      era = (day >= 0 ? day : day - 146096) / 146097;
+      doe = day - era * 146097;
+      yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+      doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+      mp = (5 * doy + 2) / 153;
+      d = doy - (153 * mp + 2) / 5 + 1;
+      m = mp < 10 ? mp + 3 : mp - 9;
+      y = yoe + era * 400 + (m <= 2);
+
+      s = fmt_uint(date_, y, 4);
+      *s++ = '-';
+      s = fmt_uint(s, m, 2);
+      *s++ = '-';
+      fmt_uint(s, d, 2);
+      day_ = day - 719468;
+   }
+
+   memcpy(p, date_, 10);
+   p[10] = 'T';
+   fmt_uint(p + 11, sec / 3600, 2);
+   p[13] = ':';
+   fmt_uint(p + 14, sec / 60 % 60, 2);
+   p[16] = ':';
+   fmt_uint(p + 17, sec % 60, 2);
+   p[19] = 'Z';
+
+   return p + FMT_TIME_LEN;
+}
+
+
+//#define TEST_NUMFMT
+#ifdef TEST_NUMFMT
+
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+static double rnd_dbl(void)
+{
+   union { double d; uint64_t u; } v;
+
+   switch (rand() % 5)
+   {
+      // arbitrary bit pattern with a small exponent
+      case 0:
+         v.u = (uint64_t) rand() << 33 ^ (uint64_t) rand() << 11 ^ rand();
+         v.u = (v.u & ~(0x7ffULL << 52)) | (uint64_t) (1023 - 40 + rand() % 70) << 52;
+         return v.d;
+      // coordinates
+      case 1:
+         return (double) rand() / RAND_MAX * 360.0 - 180.0;
+      // exact decimal ties
+      case 2:
+         return (rand() % 2000000 - 1000000) / pow(2, rand() % 12);
+      // numbers close to zero
+      case 3:
+         return ((double) rand() / RAND_MAX - 0.5) * 1E-7;
+      default:
+         return (rand() % 20000 - 10000) / 100.0 - 273.15;
+   }
+}
+
+
+int main(int argc, char **argv)
+{
+   static const double fix[] = {0.0, -0.0, 0.5, 1.5, 2.5, -0.05, 0.125, 1E15, 1E300, 5E-324, INFINITY, -INFINITY, NAN};
+   const int nfix = sizeof(fix) / sizeof(*fix) * 10;
+   char buf0[512], buf1[512];
+   long i, n = argc > 1 ? atol(argv[1]) : 10000000, err = 0;
+   double x;
+   int prec;
+
+   srand(n);
+   for (i = 0; i < n + nfix; i++)
+   {
+      if (i < nfix)
+      {
+         x = fix[i / 10];
+         prec = i % 10;
+      }
+      else
+      {
+         x = rnd_dbl();
+         prec = rand() % 10;
+      }
+      snprintf(buf0, sizeof(buf0), "%.*f", prec, x);
+      *fmt_dbl(buf1, x, prec) = '\0';
+      if (strcmp(buf0, buf1))
+      {
+         printf("%.17g, %d: \"%s\" != \"%s\"\n", x, prec, buf0, buf1);
+         err++;
+      }
+   }
+
+   printf("%ld numbers tested, %ld errors\n", n + nfix, err);
+
+   for (i = 0; i < n; i++)
+   {
+      time_t t = i < n / 2 ? (time_t) rand() * 128 % 4102444800 : i * 37;
+      strftime(buf0, sizeof(buf0), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+      *fmt_time(buf1, t) = '\0';
+      if (strcmp(buf0, buf1))
+      {
+         printf("%ld: \"%s\" != \"%s\"\n", (long) t, buf0, buf1);
+         err++;
+      }
+   }
+
+   printf("%ld timestamps tested, %ld errors\n", n, err);
+   return err != 0;
+}
+
+#endif
+
@@ -0,0 +1,38 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the prototypes of the number formatting functions.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#ifndef NUMFMT_H
+#define NUMFMT_H
+
+#include <stdint.h>
+
+// length of the string produced by fmt_time()
+#define FMT_TIME_LEN 20
+
+char *fmt_dbl(char *, double , int );
+char *fmt_int(char *, long );
+char *fmt_str(char *, const char *);
+char *fmt_strn(char *, const char *, int );
+char *fmt_time(char *, int64_t );
+
+#endif
+
@@ -0,0 +1,700 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the buffered output writer. Output is collected in a
+ *  large user-space buffer which is written with write() or writev() if it
+ *  is full. The output functions may also format their data directly into
+ *  the buffer with ob_reserve() and ob_commit(). Optionally, the output is
+ *  compressed on several threads, see ob_compress().
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "obuf.h"
+
+// state of a compression job
+enum {OBZ_FREE, OBZ_QUEUED, OBZ_DONE};
+
+// chunk of the output which is compressed independently of the others
+typedef struct ob_zjob
+{
+   char *in;         //!< uncompressed data
+   size_t in_len;    //!< number of bytes in in
+   size_t in_size;   //!< size of in
+   char *out;        //!< compressed data
+   size_t out_len;   //!< number of bytes in out
+   size_t out_size;  //!< size of out
+   int state;        //!< OBZ_FREE, OBZ_QUEUED, or OBZ_DONE
+} ob_zjob_t;
+
+// compression state of an output buffer
+struct ob_zctx
+{
+   int method;             //!< OB_GZIP or OB_ZSTD
+   int level;              //!< compression level
+   int nthreads;           //!< number of threads, 0 if compressed by the caller
+   pthread_t *th;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;    //!< signals state changes of the jobs
+   ob_zjob_t *job;         //!< ring buffer of jobs
+   int njobs;              //!< number of jobs in the ring buffer
+   long head;              //!< number of jobs submitted
+   long next;              //!< next job to be compressed
+   long tail;              //!< next job to be written
+   int quit;               //!< tells the threads to terminate
+};
+
+
+/*! Create a new output buffer.
+ * @param fd File descriptor to write to.
+ * @param size Size of the buffer in bytes.
+ * @return Returns a pointer to the output buffer. If memory allocation fails
+ * the function does not return.
+ */
+obuf_t *ob_open(int fd, size_t size)
+{
+   obuf_t *ob;
+
+   if ((ob = calloc(1, sizeof(*ob))) == NULL)
+      perror("calloc"), exit(EXIT_FAILURE);
+   if ((ob->buf = malloc(size)) == NULL)
+      perror("malloc"), exit(EXIT_FAILURE);
+
+   ob->fd = fd;
+   ob->size = size;
+   return ob;
+}
+
+
+/*! Write iovcnt buffers completely to fd.
+ * @return Returns 0 on success. In case of error the function does not
+ * return.
+ */
+static int ob_writev(obuf_t *ob, struct iovec *iov, int iovcnt)
+{
+   ssize_t len;
+
+   while (iovcnt)
+   {
+      if ((len = writev(ob->fd, iov, iovcnt)) == -1)
+      {
+         if (errno == EINTR)
+            continue;
+         perror("writev"), exit(EXIT_FAILURE);
+      }
+
+      ob->total += len;
+      for (; iovcnt && (size_t) len >= iov->iov_len; iov++, iovcnt--)
+         len -= iov->iov_len;
+      if (iovcnt)
+      {
+         iov->iov_base = (char*) iov->iov_base + len;
+         iov->iov_len -= len;
+      }
+   }
+   return 0;
+}
+
+
+/*! Compress the data of job j into a complete gzip member or zstd frame.
+ * In case of error the function does not return.
+ */
+static void ob_zcompress(const struct ob_zctx *z, ob_zjob_t *j)
+{
+   z_stream zs;
+   size_t bound;
+
+   switch (z->method)
+   {
+      case OB_GZIP:
+         memset(&zs, 0, sizeof(zs));
+         // windowBits + 16 writes a gzip header and trailer
+         if (deflateInit2(&zs, z->level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            fprintf(stderr, "deflateInit2() failed\n"), exit(EXIT_FAILURE);
+         bound = deflateBound(&zs, j->in_len);
+         break;
+#ifdef HAVE_ZSTD
+      case OB_ZSTD:
+         bound = ZSTD_compressBound(j->in_len);
+         break;
+#endif
+      default:
+         fprintf(stderr, "unsupported compression method %d\n", z->method), exit(EXIT_FAILURE);
+   }
+
+   if (bound > j->out_size)
+   {
+      free(j->out);
+      if ((j->out = malloc(bound)) == NULL)
+         perror("malloc"), exit(EXIT_FAILURE);
+      j->out_size = bound;
+   }
+
+   switch (z->method)
+   {
+      case OB_GZIP:
+         zs.next_in = (Bytef*) j->in;
+         zs.avail_in = j->in_len;
+         zs.next_out = (Bytef*) j->out;
+         zs.avail_out = j->out_size;
+         if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+            fprintf(stderr, "deflate() failed\n"), exit(EXIT_FAILURE);
+         j->out_len = zs.total_out;
+         deflateEnd(&zs);
+         break;
+#ifdef HAVE_ZSTD
+      case OB_ZSTD:
+         j->out_len = ZSTD_compress(j->out, j->out_size, j->in, j->in_len, z->level);
+         if (ZSTD_isError(j->out_len))
+            fprintf(stderr, "ZSTD_compress(): %s\n", ZSTD_getErrorName(j->out_len)), exit(EXIT_FAILURE);
+         break;
+#endif
+   }
+}
+
+
+static void *ob_zworker(void *p)
+{
+   struct ob_zctx *z = p;
+   ob_zjob_t *j;
+
+   pthread_mutex_lock(&z->mutex);
+   for (;;)
+   {
+      while (!z->quit && z->next == z->head)
+         pthread_cond_wait(&z->cond, &z->mutex);
+      if (z->next == z->head)
+         break;
+
+      j = &z->job[z->next++ % z->njobs];
+      pthread_mutex_unlock(&z->mutex);
+      ob_zcompress(z, j);
+      pthread_mutex_lock(&z->mutex);
+      j->state = OBZ_DONE;
+      pthread_cond_broadcast(&z->cond);
+   }
+   pthread_mutex_unlock(&z->mutex);
+
+   return NULL;
+}
+
+
+/*! Write the compressed jobs to the file descriptor in the order they were
+ * submitted. All jobs which are done already are written. Additionally, the
+ * function waits until at least the jobs up to number min_tail are written.
+ */
+static void ob_zwrite(obuf_t *ob, long min_tail)
+{
+   struct ob_zctx *z = ob->z;
+   struct iovec iov;
+   ob_zjob_t *j;
+
+   pthread_mutex_lock(&z->mutex);
+   while (z->tail < z->head)
+   {
+      j = &z->job[z->tail % z->njobs];
+      if (j->state != OBZ_DONE)
+      {
+         if (z->tail >= min_tail)
+            break;
+         pthread_cond_wait(&z->cond, &z->mutex);
+         continue;
+      }
+
+      pthread_mutex_unlock(&z->mutex);
+      iov.iov_base = j->out;
+      iov.iov_len = j->out_len;
+      ob_writev(ob, &iov, 1);
+      pthread_mutex_lock(&z->mutex);
+      j->state = OBZ_FREE;
+      z->tail++;
+   }
+   pthread_mutex_unlock(&z->mutex);
+}
+
+
+/*! Hand over the contents of the buffer to the compression threads. The
+ * buffer is swapped with the one of a free job, thus it is not copied.
+ */
+static void ob_zsubmit(obuf_t *ob)
+{
+   struct ob_zctx *z = ob->z;
+   ob_zjob_t *j;
+   size_t size;
+   char *buf;
+
+   // wait for the oldest job if all of them are in use
+   ob_zwrite(ob, z->head - z->njobs + 1);
+
+   j = &z->job[z->head % z->njobs];
+   if (j->in == NULL)
+   {
+      if ((j->in = malloc(ob->size)) == NULL)
+         perror("malloc"), exit(EXIT_FAILURE);
+      j->in_size = ob->size;
+   }
+   buf = j->in;
+   size = j->in_size;
+   j->in = ob->buf;
+   j->in_size = ob->size;
+   j->in_len = ob->len;
+   ob->buf = buf;
+   ob->size = size;
+   ob->raw += ob->len;
+   ob->len = 0;
+
+   if (!z->nthreads)
+   {
+      ob_zcompress(z, j);
+      j->state = OBZ_DONE;
+      z->head++;
+      ob_zwrite(ob, z->head);
+      return;
+   }
+
+   pthread_mutex_lock(&z->mutex);
+   j->state = OBZ_QUEUED;
+   z->head++;
+   pthread_cond_broadcast(&z->cond);
+   pthread_mutex_unlock(&z->mutex);
+}
+
+
+/*! Pass the bytes of the buffer which were written since the tap was set
+ * or since the last call to the tap callback.
+ */
+static void ob_tap_out(obuf_t *ob)
+{
+   if (ob->tap != NULL && ob->len > ob->tap_off)
+      ob->tap(ob->tap_arg, ob->buf + ob->tap_off, ob->len - ob->tap_off);
+   ob->tap_off = 0;
+}
+
+
+/*! Pass on the contents of the buffer. It is either written to the file
+ * descriptor or handed over to the compression. This function does not wait
+ * for the compression to finish.
+ * @return Returns 0 on success. In case of error the function does not
+ * return.
+ */
+static int ob_emit(obuf_t *ob)
+{
+   struct iovec iov;
+
+   ob_tap_out(ob);
+   if (!ob->len)
+      return 0;
+
+   if (ob->z != NULL)
+   {
+      ob_zsubmit(ob);
+      return 0;
+   }
+
+   iov.iov_base = ob->buf;
+   iov.iov_len = ob->len;
+   ob->raw += ob->len;
+   ob->len = 0;
+   return ob_writev(ob, &iov, 1);
+}
+
+
+/*! Write the contents of the buffer to the file descriptor. If the output
+ * is compressed, the function waits until all pending data is compressed
+ * and written.
+ * @return Returns 0 on success. In case of error the function does not
+ * return.
+ */
+int ob_flush(obuf_t *ob)
+{
+   ob_emit(ob);
+   if (ob->z != NULL)
+      ob_zwrite(ob, ob->z->head);
+   return 0;
+}
+
+
+/*! Return the range of the compression levels of a method.
+ * @param method OB_GZIP or OB_ZSTD.
+ * @param min Pointer which receives the lowest level.
+ * @param max Pointer which receives the highest level.
+ * @return Returns 0 on success or -1 if the method is not supported.
+ */
+int ob_zlevels(int method, int *min, int *max)
+{
+   switch (method)
+   {
+      case OB_GZIP:
+         *min = Z_NO_COMPRESSION;
+         *max = Z_BEST_COMPRESSION;
+         return 0;
+#ifdef HAVE_ZSTD
+      case OB_ZSTD:
+         *min = 1;
+         *max = ZSTD_maxCLevel();
+         return 0;
+#endif
+   }
+   return -1;
+}
+
+
+/*! Enable the compression of the output. The output is split into chunks
+ * of the size of the buffer which are compressed independently of each
+ * other on nthreads threads, similar to pigz. The chunks are written in
+ * order, each one as a complete gzip member or zstd frame. Decompressors
+ * handle such concatenated members transparently. Data which is in the
+ * buffer already is written uncompressed.
+ * @param method OB_GZIP or OB_ZSTD. OB_ZSTD is only available if compiled
+ * with HAVE_ZSTD.
+ * @param level Compression level.
+ * @param nthreads Number of compression threads. If it is 0, the data is
+ * compressed by the calling thread.
+ * @return Returns 0 on success or -1 if the method is not supported.
+ */
+int ob_compress(obuf_t *ob, int method, int level, int nthreads)
+{
+   struct ob_zctx *z;
+   int i;
+
+#ifdef HAVE_ZSTD
+   if (method != OB_GZIP && method != OB_ZSTD)
+#else
+   if (method != OB_GZIP)
+#endif
+      return -1;
+
+   ob_flush(ob);
+   if ((z = calloc(1, sizeof(*z))) == NULL)
+      perror("calloc"), exit(EXIT_FAILURE);
+   z->method = method;
+   z->level = level;
+   z->nthreads = nthreads < 0 ? 0 : nthreads;
+   // two jobs per thread keep the threads busy while the output is written
+   z->njobs = z->nthreads ? 2 * z->nthreads : 1;
+   if ((z->job = calloc(z->njobs, sizeof(*z->job))) == NULL || (z->th = calloc(z->nthreads + 1, sizeof(*z->th))) == NULL)
+      perror("calloc"), exit(EXIT_FAILURE);
+   pthread_mutex_init(&z->mutex, NULL);
+   pthread_cond_init(&z->cond, NULL);
+
+   for (i = 0; i < z->nthreads; i++)
+      if ((errno = pthread_create(&z->th[i], NULL, ob_zworker, z)))
+         perror("pthread_create"), exit(EXIT_FAILURE);
+
+   ob->z = z;
+   return 0;
+}
+
+
+/*! Terminate the compression threads and free the compression state.
+ */
+static void ob_zfree(struct ob_zctx *z)
+{
+   int i;
+
+   pthread_mutex_lock(&z->mutex);
+   z->quit = 1;
+   pthread_cond_broadcast(&z->cond);
+   pthread_mutex_unlock(&z->mutex);
+   for (i = 0; i < z->nthreads; i++)
+      pthread_join(z->th[i], NULL);
+
+   for (i = 0; i < z->njobs; i++)
+   {
+      free(z->job[i].in);
+      free(z->job[i].out);
+   }
+   pthread_cond_destroy(&z->cond);
+   pthread_mutex_destroy(&z->mutex);
+   free(z->th);
+   free(z->job);
+   free(z);
+}
+
+
+/*! Flush and free the output buffer. The file descriptor is not closed.
+ */
+int ob_close(obuf_t *ob)
+{
+   int ret;
+
+   ret = ob_flush(ob);
+   if (ob->z != NULL)
+      ob_zfree(ob->z);
+   free(ob->buf);
+   free(ob);
+   return ret;
+}
+
+
+/*! This function returns a pointer to the buffer with at least n bytes of
+ * free space. The caller may write up to n bytes to it and has to call
+ * ob_commit() with a pointer to the end of the written data afterwards.
+ */
+char *ob_reserve(obuf_t *ob, size_t n)
+{
+   if (ob->len + n > ob->size)
+      ob_emit(ob);
+
+   if (n > ob->size)
+   {
+      if ((ob->buf = realloc(ob->buf, n)) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+      ob->size = n;
+   }
+
+   return ob->buf + ob->len;
+}
+
+
+/*! Commit the data which was written to the buffer returned by
+ * ob_reserve().
+ * @param end Pointer to the first byte after the written data.
+ */
+void ob_commit(obuf_t *ob, const char *end)
+{
+   ob->len = end - ob->buf;
+}
+
+
+/*! Write len bytes of buf. Blocks which are larger than the free space
+ * are written together with the buffer contents with a single writev()
+ * without copying them.
+ */
+void ob_write(obuf_t *ob, const void *buf, size_t len)
+{
+   struct iovec iov[2];
+   size_t n;
+
+   if (ob->len + len <= ob->size)
+   {
+      memcpy(ob->buf + ob->len, buf, len);
+      ob->len += len;
+      return;
+   }
+
+   // compressed output is always passed on in chunks of the buffer size
+   if (ob->z != NULL)
+   {
+      for (; len; buf = (const char*) buf + n, len -= n)
+      {
+         if (ob->len >= ob->size)
+            ob_emit(ob);
+         n = ob->size - ob->len < len ? ob->size - ob->len : len;
+         memcpy(ob->buf + ob->len, buf, n);
+         ob->len += n;
+      }
+      return;
+   }
+
+   ob_tap_out(ob);
+   if (ob->tap != NULL)
+      ob->tap(ob->tap_arg, buf, len);
+   iov[0].iov_base = ob->buf;
+   iov[0].iov_len = ob->len;
+   iov[1].iov_base = (void*) buf;
+   iov[1].iov_len = len;
+   ob->raw += ob->len + len;
+   ob->len = 0;
+   ob_writev(ob, iov, 2);
+}
+
+
+/*! Tap the output buffer. A copy of all data which is written to the
+ * buffer from now on is passed to the callback function fn before it leaves
+ * the buffer. The data may be passed in several pieces. This is used to
+ * record the output of a single item.
+ * @param fn Callback function or NULL to remove the tap. All data which is
+ * pending for the previous callback is passed to it before.
+ * @param arg Argument passed to fn.
+ */
+void ob_tap(obuf_t *ob, ob_tap_t fn, void *arg)
+{
+   ob_tap_out(ob);
+   ob->tap = fn;
+   ob->tap_arg = arg;
+   ob->tap_off = ob->len;
+}
+
+
+void ob_puts(obuf_t *ob, const char *s)
+{
+   ob_write(ob, s, strlen(s));
+}
+
+
+/*! This function works like fprintf() but writes to the output buffer.
+ */
+int ob_printf(obuf_t *ob, const char *fmt, ...)
+{
+   va_list ap;
+   size_t avail;
+   int len;
+   char *p;
+
+   p = ob_reserve(ob, 256);
+   avail = ob->size - ob->len;
+   va_start(ap, fmt);
+   len = vsnprintf(p, avail, fmt, ap);
+   va_end(ap);
+
+   if (len < 0)
+      return len;
+
+   if ((size_t) len >= avail)
+   {
+      p = ob_reserve(ob, len + 1);
+      va_start(ap, fmt);
+      vsnprintf(p, len + 1, fmt, ap);
+      va_end(ap);
+   }
+
+   ob->len += len;
+   return len;
+}
+
+
+// escape sequences of the characters escaped by ob_esc()
+static const char *esc_seq_(int c)
+{
+   switch (c)
+   {
+      case '\0': return "&#0;";
+      case '&': return "&#38;";
+      case '<': return "&#60;";
+      case '>': return "&#62;";
+      case '"': return "&#34;";
+   }
+   return NULL;
+}
+
+
+/*! This function copies the string src of len bytes to dst and escapes the
+ * XML special characters &, <, >, \0, and optionally " as numeric
+ * character references. On SSE2 capable CPUs the string is scanned 16 bytes
+ * at once. The string is never truncated, thus dst must have room for
+ * OB_ESC_MAX * len bytes. A negative len is treated as 0.
+ * @param dst Destination pointer.
+ * @param src Source string.
+ * @param len Length of source string.
+ * @param quot Escape also " if not 0.
+ * @return Returns a pointer to the first byte after the result in dst.
+ */
+char *ob_esc(char *dst, const char *src, int len, int quot)
+{
+   const char *s;
+   int n;
+
+#ifdef __SSE2__
+   const __m128i amp = _mm_set1_epi8('&'), lt = _mm_set1_epi8('<'),
+         gt = _mm_set1_epi8('>'), qu = _mm_set1_epi8(quot ? '"' : '&'),
+         nul = _mm_setzero_si128();
+   __m128i v, m;
+   unsigned mask;
+
+   while (len >= 16)
+   {
+      v = _mm_loadu_si128((const __m128i*) src);
+      m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_cmpeq_epi8(v, qu)),
+               _mm_cmpeq_epi8(v, nul)));
+      if (!(mask = _mm_movemask_epi8(m)))
+      {
+         _mm_storeu_si128((__m128i*) dst, v);
+         src += 16;
+         dst += 16;
+         len -= 16;
+         continue;
+      }
+
+      n = __builtin_ctz(mask);
+      memcpy(dst, src, n);
+      dst += n;
+      s = esc_seq_(src[n]);
+      n++;
+      src += n;
+      len -= n;
+      for (; *s; s++)
+         *dst++ = *s;
+   }
+#endif
+
+   for (; len > 0; len--, src++)
+   {
+      if ((*src == '"' && !quot) || (s = esc_seq_(*src)) == NULL)
+      {
+         *dst++ = *src;
+         continue;
+      }
+      for (; *s; s++)
+         *dst++ = *s;
+   }
+
+   return dst;
+}
+
+
+
+/*! This function copies the string src of len bytes to dst and escapes it
+ * to be used within a JSON string, i.e. " and \ are prepended by a
+ * backslash and the control characters are written as \uXXXX. dst must
+ * have room for OB_JESC_MAX * len bytes. A negative len is treated as 0.
+ * @param dst Destination pointer.
+ * @param src Source string.
+ * @param len Length of source string.
+ * @return Returns a pointer to the first byte after the result in dst.
+ */
+char *ob_jesc(char *dst, const char *src, int len)
+{
+   static const char hex[] = "0123456789abcdef";
+
+   for (; len > 0; len--, src++)
+   {
+      if (*src == '"' || *src == '\\')
+      {
+         *dst++ = '\\';
+         *dst++ = *src;
+      }
+      else if ((unsigned char) *src < 0x20)
+      {
+         memcpy(dst, "\\u00", 4);
+         dst[4] = hex[*src >> 4];
+         dst[5] = hex[*src & 0xf];
+         dst += 6;
+      }
+      else
+         *dst++ = *src;
+   }
+
+   return dst;
+}
@@ -0,0 +1,77 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the data structures and prototypes of the buffered
+ *  output writer.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#ifndef OBUF_H
+#define OBUF_H
+
+#include <stddef.h>
+
+// default size of the output buffer
+#define OBUF_SIZE (1024 * 1024)
+// max. length of an escaped character, see ob_esc()
+#define OB_ESC_MAX 5
+// max. length of a character escaped by ob_jesc()
+#define OB_JESC_MAX 6
+
+// compression methods, see ob_compress()
+enum {OB_PLAIN, OB_GZIP, OB_ZSTD};
+
+struct ob_zctx;
+
+/*! Callback which receives a copy of the data written to a tapped output
+ * buffer, see ob_tap().
+ */
+typedef void (*ob_tap_t)(void *, const void *, size_t );
+
+// output buffer
+typedef struct obuf
+{
+   int fd;           //!< file descriptor to write to
+   char *buf;        //!< pointer to the buffer
+   size_t len;       //!< number of bytes in the buffer
+   size_t size;      //!< total size of the buffer
+   long long total;  //!< total number of bytes written to fd
+   long long raw;    //!< total number of bytes before compression
+   struct ob_zctx *z;//!< compression state, NULL if uncompressed
+   ob_tap_t tap;     //!< tap callback, NULL if the buffer is not tapped
+   void *tap_arg;    //!< argument passed to tap
+   size_t tap_off;   //!< offset of the first byte in buf not yet passed to tap
+} obuf_t;
+
+
+obuf_t *ob_open(int , size_t );
+int ob_close(obuf_t *);
+int ob_zlevels(int , int *, int *);
+int ob_compress(obuf_t *, int , int , int );
+int ob_flush(obuf_t *);
+char *ob_reserve(obuf_t *, size_t );
+void ob_commit(obuf_t *, const char *);
+void ob_write(obuf_t *, const void *, size_t );
+void ob_tap(obuf_t *, ob_tap_t , void *);
+void ob_puts(obuf_t *, const char *);
+int ob_printf(obuf_t *, const char *, ...) __attribute__((format (printf, 2, 3)));
+char *ob_esc(char *, const char *, int , int );
+char *ob_jesc(char *, const char *, int );
+
+#endif
+
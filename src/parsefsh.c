@@ -24,16 +24,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 #include <math.h>
 #include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
 #include <errno.h>
 
 #include "fshfunc.h"
 #include "projection.h"
+#include "numfmt.h"
+#include "obuf.h"
+#include "arrow.h"
+#include "pbf.h"
+#include "simplify.h"
+#include "filter.h"
+#include "cache.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "grid.h"
 
 
 #define DEGSCALE (M_PI / 180.0)
@@ -43,19 +60,54 @@
 #define CELSIUS(x) ((double) (x) / 100.0 - 273.15)
 
 #define TBUFLEN 24
+// max. size of a record formatted directly into the output buffer
+#define LBUFLEN 4096
 
 #define COPYLEFT "ARCHIVE.FSH decoder (c) 2013-2019 by Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>, License GPLv3"
 
 
-enum {FMT_CSV, FMT_OSM, FMT_GPX};
+enum {FMT_CSV, FMT_OSM, FMT_GPX, FMT_ARROW, FMT_GEOJSONSEQ, FMT_STATS, FMT_STATSJSON, FMT_ASC, FMT_FLT, FMT_PBF};
+// file name extensions of the formats
+static const char *fmt_ext_[] = {"csv", "osm", "gpx", "arrow", "geojsons", "tsv", "json", "asc", "flt", "osm.pbf"};
+// file name extensions of the compression methods
+static const char *z_ext_[] = {"", ".gz", ".zst"};
+// names of the statistics of the grid output, see fsh_grid_value()
+static const char *grid_stat_[FSH_GRID_STATS] = {"count", "mean", "min", "max", "var"};
+// no-data value of the grid output
+#define GRID_NODATA -9999
+// projection of the grid output (ESRI WKT of WGS84 World Mercator, EPSG:3395)
+#define GRID_PRJ "PROJCS[\"WGS_1984_World_Mercator\",GEOGCS[\"GCS_WGS_1984\"," \
+   "DATUM[\"D_WGS_1984\",SPHEROID[\"WGS_1984\",6378137.0,298.257223563]]," \
+   "PRIMEM[\"Greenwich\",0.0],UNIT[\"Degree\",0.0174532925199433]]," \
+   "PROJECTION[\"Mercator\"],PARAMETER[\"False_Easting\",0.0]," \
+   "PARAMETER[\"False_Northing\",0.0],PARAMETER[\"Central_Meridian\",0.0]," \
+   "PARAMETER[\"Standard_Parallel_1\",0.0],UNIT[\"Meter\",1.0]]"
+
+// columns of the Arrow output
+enum {AC_KIND, AC_ITEM, AC_NAME, AC_SEG, AC_PT, AC_LAT, AC_LON, AC_DEPTH, AC_TEMPR, AC_TIME, AC_CNT};
+static const ar_field_t ar_field_[AC_CNT] =
+{
+   {"kind", AR_UTF8, 0},         // "wpt", "trkpt", or "rtept"
+   {"item", AR_INT32, 0},        // number of the waypoint, track, or route
+   {"name", AR_UTF8, 0},         // name of the waypoint, track, or route
+   {"segment", AR_INT32, 0},     // number of the track segment
+   {"point", AR_INT32, 0},       // number of the point within the segment or route
+   {"lat", AR_DOUBLE, 0},
+   {"lon", AR_DOUBLE, 0},
+   {"depth_cm", AR_INT32, 1},
+   {"temperature", AR_DOUBLE, 1},// degrees Celsius
+   {"time", AR_TIMESTAMP, 1},
+};
 
 
 static FILE *logout_;
+static struct timespec start_;
 
 
 static void __attribute__((constructor)) init_log_output(void)
 {
    logout_ = stderr;
+   clock_gettime(CLOCK_MONOTONIC, &start_);
 }
 
 
@@ -68,10 +120,12 @@ int vlog(const char *fmt, ...)
    if (logout_ == NULL || fmt == NULL)
       return 0;
 
+   flockfile(logout_);
    fputs("# ", logout_);
    va_start(ap, fmt);
    ret = vfprintf(logout_, fmt, ap);
    va_end(ap);
+   funlockfile(logout_);
 
    return ret;
 }
@@ -92,6 +146,32 @@ static void raycoord_norm(int32_t lat0, int32_t lon0, double *lat, double *lon)
 }
 
 
+/*! This function projects all points of a track segment to geographic
+ * coordinates at once using fsh_tseg_project(). The coordinates of a segment
+ * loaded from a snapshot are returned directly.
+ * @param tseg Pointer to the track segment.
+ * @param el Pointer to the ellipsoid.
+ * @param buf Pointer to a buffer pointer as set by a previous call or NULL.
+ * The buffer is reallocated as needed and must be freed by the caller.
+ * @return Returns a pointer to the coordinates. The first tseg->hdr->cnt
+ * elements contain the latitudes, the following ones the longitudes, both
+ * in degrees.
+ */
+static const double *tseg_project(const track_segment_t *tseg, const ellipsoid_t *el, double **buf)
+{
+   int cnt = tseg->hdr->cnt;
+
+   if (tseg->ll != NULL)
+      return tseg->ll;
+
+   if ((*buf = realloc(*buf, sizeof(**buf) * 2 * (cnt > 0 ? cnt : 1))) == NULL)
+      perror("realloc"), exit(EXIT_FAILURE);
+   fsh_tseg_project(tseg, el, *buf, *buf + cnt);
+
+   return *buf;
+}
+
+
 // only used for debugging and reverse engineering
 #define REVENG
 #ifdef REVENG
@@ -99,20 +179,20 @@ static const char hex_[] = "0123456789abcdef";
 
 /*! This function output len bytes starting at buf in hexadecimal numbers.
  */
-static void hexdump(const void *buf, int len)
+static void hexdump(obuf_t *out, const void *buf, int len)
 {
    int i;
 
    for (i = 0; i < len; i++)
-      printf("%c%c ", hex_[(((char*) buf)[i] >> 4) & 15], hex_[((char*) buf)[i] & 15]);
-   printf("\n");
+      ob_printf(out, "%c%c ", hex_[(((char*) buf)[i] >> 4) & 15], hex_[((char*) buf)[i] & 15]);
+   ob_printf(out, "\n");
 }
 #endif
 
 
-static void gpx_start(FILE *out)
+static void gpx_start(obuf_t *out)
 {
-   fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+   ob_printf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
          "<gpx xmlns=\"http://www.topografix.com/GPX/1/1\" creator=\"parsefsh\" version=\"1.1\"\n"
          "   xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n"
          "   xsi:schemaLocation=\"http://www.topografix.com/GPX/1/1 http://www.topografix.com/GPX/1/1/gpx.xsd\">\n"
@@ -120,600 +200,2814 @@ static void gpx_start(FILE *out)
 }
 
 
-static void gpx_end(FILE *out)
+static void gpx_end(obuf_t *out)
 {
-   fprintf(out, "</gpx>\n");
+   ob_printf(out, "</gpx>\n");
 }
 
 
-static void osm_start(FILE *out)
+static void osm_start(obuf_t *out)
 {
-   fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\" generator=\"parsefsh\">\n");
+   ob_printf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\" generator=\"parsefsh\">\n");
 }
 
 
-static void osm_end(FILE *out)
+static void osm_end(obuf_t *out)
 {
-   fprintf(out, "</osm>\n");
+   ob_printf(out, "</osm>\n");
 }
 
 
-static int get_id(void)
-{
-   static int id = 0;
-   return --id;
-}
+// counter of the negative OSM IDs, one per thread
+static __thread int osm_id_;
 
 
-/*! This is a universal XML character escape function. It escapes all
- * characters of src string with length slen which are listed in esc. The
- * result string is written to dst of at most dstlen bytes including the
- * terminating \0.
- */
-static void esc_txt(const char *src, int slen, char *dst, int dstlen, const char *esc)
+static int get_id(void)
 {
-   int wlen;
-
-   // safety check
-   if (src == NULL || dst == NULL)
-      return;
-
-   for (dstlen--; slen && dstlen; slen--, src++)
-   {
-      if (strchr(esc, *src) != NULL)
-      {
-         wlen = snprintf(dst, dstlen + 1, "&#%d;", *src);
-         if (wlen >= dstlen + 1)
-            return;
-         dstlen -= wlen;
-         dst += wlen;
-         continue;
-      }
-
-      *dst++ = *src;
-      dstlen--;
-   }
-
-   *dst = '\0';
+   return --osm_id_;
 }
 
 
-void output_wpt(FILE *out, const fsh_wpt_data_t *wpd, const ellipsoid_t *el, int64_t guid)
+void output_wpt(obuf_t *out, const fsh_wpt_data_t *wpd, const ellipsoid_t *el, int64_t guid)
 {
-   char tbuf[TBUFLEN];
+   char tbuf[TBUFLEN], *p;
    struct coord cd;
 
    raycoord_norm(wpd->north, wpd->east, &cd.lat, &cd.lon);
-   cd.lat = phi_iterate_merc(el, cd.lat) * 180 / M_PI;
+   cd.lat = phi_merc(el, cd.lat) * 180 / M_PI;
    fsh_timetostr(&wpd->ts, tbuf, sizeof(tbuf));
 
-   fprintf(out, "%s, %.7f, %.7f, %d, ",
-         guid_to_string(guid), cd.lat, cd.lon, wpd->sym);
-         
+   p = fmt_str(ob_reserve(out, LBUFLEN), guid_to_string(guid));
+   p = fmt_str(p, ", ");
+   p = fmt_dbl(p, cd.lat, 7);
+   p = fmt_str(p, ", ");
+   p = fmt_dbl(p, cd.lon, 7);
+   p = fmt_str(p, ", ");
+   p = fmt_int(p, wpd->sym);
+   p = fmt_str(p, ", ");
+
    if (wpd->tempr == TEMPR_NA)
-      fprintf(out, "N/A, ");
+      p = fmt_str(p, "N/A, ");
    else
-      fprintf(out, "%.1f, ", CELSIUS(wpd->tempr));
+   {
+      p = fmt_dbl(p, CELSIUS(wpd->tempr), 1);
+      p = fmt_str(p, ", ");
+   }
 
    if (wpd->depth == DEPTH_NA)
-      fprintf(out, "N/A, ");
+      p = fmt_str(p, "N/A, ");
    else
-      fprintf(out, "%d, ", wpd->depth);
+   {
+      p = fmt_int(p, wpd->depth);
+      p = fmt_str(p, ", ");
+   }
 
-   fprintf(out, "%.*s, %.*s, %s\n", 
-         wpd->name_len, wpd->txt_data, wpd->cmt_len, wpd->txt_data + wpd->name_len, tbuf);
+   p = fmt_strn(p, wpd->txt_data, wpd->name_len);
+   p = fmt_str(p, ", ");
+   p = fmt_strn(p, wpd->txt_data + wpd->name_len, wpd->cmt_len);
+   p = fmt_str(p, ", ");
+   p = fmt_str(p, tbuf);
+   *p++ = '\n';
+   ob_commit(out, p);
 }
 
 
-void output_osm_nodes(FILE *out, const fsh_wpt_data_t *wpd, const ellipsoid_t *el, int id, const char *wpt_type)
+/*! Output a node in OSM format.
+ * @param cd0 Pointer to the already projected coordinates of the node or NULL
+ * if they shall be derived from wpd.
+ */
+void output_osm_nodes(obuf_t *out, const fsh_wpt_data_t *wpd, const struct coord *cd0, const ellipsoid_t *el, int id, const char *wpt_type)
 {
-   char tbuf[TBUFLEN], name[64], cmt[64];
+   char tbuf[TBUFLEN], *p;
    struct coord cd;
 
-   raycoord_norm(wpd->north, wpd->east, &cd.lat, &cd.lon);
-   cd.lat = phi_iterate_merc(el, cd.lat) * 180 / M_PI;
+   if (cd0 != NULL)
+      cd = *cd0;
+   else
+   {
+      raycoord_norm(wpd->north, wpd->east, &cd.lat, &cd.lon);
+      cd.lat = phi_merc(el, cd.lat) * 180 / M_PI;
+   }
 
    fsh_timetostr(&wpd->ts, tbuf, sizeof(tbuf));
-   esc_txt(NAME(*wpd), wpd->name_len, name, sizeof(name), "&<>\"");
-   esc_txt(COMMENT(*wpd), wpd->cmt_len, cmt, sizeof(cmt), "&<>\"");
 
-   fprintf(out,
-            "   <node id=\"%d\" lat=\"%.7f\" lon=\"%.7f\" timestamp=\"%s\">\n"
-            "      <tag k=\"fsh:type\" v=\"%s\"/>\n"
-            "      <tag k=\"name\" v=\"%s\"/>\n"
-            "      <tag k=\"description\" v=\"%s\"/>\n",
-            id, cd.lat, cd.lon, tbuf, wpt_type, name, cmt);
+   p = fmt_str(ob_reserve(out, LBUFLEN), "   <node id=\"");
+   p = fmt_int(p, id);
+   p = fmt_str(p, "\" lat=\"");
+   p = fmt_dbl(p, cd.lat, 7);
+   p = fmt_str(p, "\" lon=\"");
+   p = fmt_dbl(p, cd.lon, 7);
+   p = fmt_str(p, "\" timestamp=\"");
+   p = fmt_str(p, tbuf);
+   p = fmt_str(p, "\">\n      <tag k=\"fsh:type\" v=\"");
+   p = fmt_str(p, wpt_type);
+   p = fmt_str(p, "\"/>\n      <tag k=\"name\" v=\"");
+   p = ob_esc(p, NAME(*wpd), wpd->name_len, 1);
+   p = fmt_str(p, "\"/>\n      <tag k=\"description\" v=\"");
+   p = ob_esc(p, COMMENT(*wpd), wpd->cmt_len, 1);
+   p = fmt_str(p, "\"/>\n");
 
    if (wpd->depth != -1)
-      fprintf(out, 
-            "      <tag k=\"seamark:sounding\" v=\"%.1f\"/>\n"
-            "      <tag k=\"seamark:type\" v=\"sounding\"/>\n",
-            (double) wpd->depth / 100.0);
+   {
+      p = fmt_str(p, "      <tag k=\"seamark:sounding\" v=\"");
+      p = fmt_dbl(p, (double) wpd->depth / 100.0, 1);
+      p = fmt_str(p, "\"/>\n      <tag k=\"seamark:type\" v=\"sounding\"/>\n");
+   }
    if (wpd->tempr != TEMPR_NA)
-      fprintf(out, 
-           "      <tag k=\"temperature\" v=\"%.1f\"/>\n",
-           CELSIUS(wpd->tempr));
+   {
+      p = fmt_str(p, "      <tag k=\"temperature\" v=\"");
+      p = fmt_dbl(p, CELSIUS(wpd->tempr), 1);
+      p = fmt_str(p, "\"/>\n");
+   }
+
+   p = fmt_str(p, "   </node>\n");
+   ob_commit(out, p);
+}
+
+
+/*! Wrapper around fsh_next_track() which terminates the program on errors.
+ */
+static int next_track(fsh_cursor_t *cur, track_t *trk)
+{
+   int err;
+
+   if ((err = fsh_next_track(cur, trk)) < 0)
+      fprintf(stderr, "# %s\n", fsh_strerror(err)), exit(EXIT_FAILURE);
+   return err;
+}
+
+
+// output cache, NULL if disabled, see option -C
+static cache_t *cache_;
+
+// recorded output of a single item, see item_start()
+typedef struct item_rec
+{
+   char *buf;        //!< state of the output followed by the recorded output
+   size_t len;       //!< number of bytes in buf
+   size_t size;      //!< size of buf
+   uint64_t key;     //!< cache key of the item
+} item_rec_t;
+
+
+/*! Tap callback which appends the output of an item to the record.
+ */
+static void item_tap(void *p, const void *buf, size_t len)
+{
+   item_rec_t *ir = p;
+
+   if (!len)
+      return;
+   if (ir->len + len > ir->size)
+   {
+      ir->size = (ir->len + len) * 2;
+      if ((ir->buf = realloc(ir->buf, ir->size)) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+   }
+   memcpy(ir->buf + ir->len, buf, len);
+   ir->len += len;
+}
+
+
+/*! Calculate the cache key of an item. It covers all data of the item which
+ * appears in the output.
+ * @param type FSH_BLK_WPT, FSH_BLK_TRK, or FSH_BLK_RTE.
+ * @param item Pointer to fsh_wpt01_t, track_t, or route21_t.
+ * @param state Output state the item depends on or NULL.
+ * @param slen Length of state.
+ */
+static uint64_t item_key(int type, const void *item, const void *state, size_t slen)
+{
+   const fsh_wpt01_t *wpt = item;
+   const route21_t *rte = item;
+   const track_t *trk = item;
+   uint64_t h;
+   int k;
+
+   h = cache_hash(type, state, slen);
+   switch (type)
+   {
+      case FSH_BLK_WPT:
+         return cache_hash(h, wpt, sizeof(*wpt) + wpt->wpd.name_len + wpt->wpd.cmt_len);
+
+      case FSH_BLK_RTE:
+         h = cache_hash(h, rte->bhdr, sizeof(*rte->bhdr));
+         return cache_hash(h, rte->hdr, rte->bhdr->len);
+
+      case FSH_BLK_TRK:
+         h = cache_hash(h, trk->bhdr, sizeof(*trk->bhdr));
+         h = cache_hash(h, trk->mta, sizeof(*trk->mta) + sizeof(*trk->mta->guid) * trk->mta->guid_cnt);
+         // segments may be simplified or dropped by the filter
+         for (k = 0; k < trk->mta->guid_cnt; k++)
+         {
+            if (trk->tseg[k].hdr == NULL)
+            {
+               h = cache_hash(h, &k, sizeof(k));
+               continue;
+            }
+            h = cache_hash(h, trk->tseg[k].hdr, sizeof(*trk->tseg[k].hdr));
+            h = cache_hash(h, trk->tseg[k].pt, sizeof(*trk->tseg[k].pt) * trk->tseg[k].hdr->cnt);
+         }
+         return h;
+   }
+   return h;
+}
+
+
+/*! Look up the output of an item in the cache. If it is found, it is written
+ * to out and the output state is restored. Otherwise the output of the item
+ * is recorded until item_end() is called.
+ * @param type Type of the item, see item_key().
+ * @param state Pointer to the state of the output which is carried over from
+ * one item to the next, or NULL.
+ * @param slen Length of state.
+ * @return Returns 1 if the item was written from the cache, otherwise 0. In
+ * the latter case the caller has to output the item and call item_end().
+ */
+static int item_start(obuf_t *out, item_rec_t *ir, int type, const void *item, void *state, size_t slen)
+{
+   const char *data;
+   size_t len;
+
+   if (cache_ == NULL)
+      return 0;
+
+   ir->key = item_key(type, item, state, slen);
+   if ((data = cache_get(cache_, ir->key, &len)) != NULL && len >= slen)
+   {
+      if (slen)
+         memcpy(state, data, slen);
+      ob_write(out, data + slen, len - slen);
+      return 1;
+   }
+
+   // space for the state after the item
+   ir->len = 0;
+   item_tap(ir, state, slen);
+   ob_tap(out, item_tap, ir);
+   return 0;
+}
+
+
+/*! Add the recorded output of an item and the output state after it to the
+ * cache.
+ */
+static void item_end(obuf_t *out, item_rec_t *ir, const void *state, size_t slen)
+{
+   if (cache_ == NULL)
+      return;
 
-   fprintf(out, "   </node>\n");
+   ob_tap(out, NULL, NULL);
+   if (slen)
+      memcpy(ir->buf, state, slen);
+   cache_put(cache_, ir->key, ir->buf, ir->len);
 }
 
 
-int track_output_osm_nodes(FILE *out, track_t *trk, int cnt, const ellipsoid_t *el)
+/*! Output the points of all tracks as OSM nodes.
+ * @param ids Pointer to a variable which receives the list of the first and
+ * last node ID of each track as needed by track_output_osm_ways(). It must be
+ * freed by the caller.
+ * @return Returns the number of tracks.
+ */
+int track_output_osm_nodes(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el, int **ids)
 {
+   fsh_cursor_t cur;
    fsh_wpt_data_t wpd;
+   track_t trk;
+   struct coord cd;
+   const double *ll;
+   double *buf = NULL;
    int i, j, k;
 
    memset(&wpd, 0, sizeof(wpd));
    wpd.tempr = TEMPR_NA;
 
-   for (j = 0; j < cnt; j++)
+   fsh_cursor_init(&cur, ctx);
+   for (j = 0, *ids = NULL; next_track(&cur, &trk); j++)
    {
-      trk[j].first_id = get_id();
-      for (k = 0; k < trk[j].mta->guid_cnt; k++)
-         for (i = 0; i < trk[j].tseg[k].hdr->cnt; i++)
+      if ((*ids = realloc(*ids, sizeof(**ids) * 2 * (j + 1))) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+
+      (*ids)[2 * j] = get_id();
+      for (k = 0; k < trk.mta->guid_cnt; k++)
+      {
+         if (trk.tseg[k].hdr == NULL)
+            continue;
+
+         ll = tseg_project(&trk.tseg[k], el, &buf);
+         for (i = 0; i < trk.tseg[k].hdr->cnt; i++)
          {
-            if (trk[j].tseg[k].pt[i].c == -1)
+            if (trk.tseg[k].pt[i].c == -1)
                continue;
 
-            wpd.north = trk[j].tseg[k].pt[i].north;
-            wpd.east = trk[j].tseg[k].pt[i].east;
-            wpd.depth = trk[j].tseg[k].pt[i].depth;
-            output_osm_nodes(out, &wpd, el, get_id() + 1, "trackpoint");
+            wpd.north = trk.tseg[k].pt[i].north;
+            wpd.east = trk.tseg[k].pt[i].east;
+            wpd.depth = trk.tseg[k].pt[i].depth;
+            cd.lat = ll[i];
+            cd.lon = ll[trk.tseg[k].hdr->cnt + i];
+            output_osm_nodes(out, &wpd, &cd, el, get_id() + 1, "trackpoint");
          }
-      trk[j].last_id = get_id() + 2;
+      }
+      (*ids)[2 * j + 1] = get_id() + 2;
    }
 
-   return 0;
+   fsh_cursor_free(&cur);
+   free(buf);
+   return j;
 }
 
 
-int track_output_osm_ways(FILE *out, track_t *trk, int cnt)
+int track_output_osm_ways(obuf_t *out, const fsh_ctx_t *ctx, const int *ids)
 {
-   char ts[TBUFLEN] = "0000-00-00T00:00:00Z";
-   struct tm *tm;
-   time_t t;
+   fsh_cursor_t cur;
+   track_t trk;
+   char ts[TBUFLEN];
    int i, j;
 
-   time(&t);
-   if ((tm = gmtime(&t)) != NULL)
-      strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", tm);
+   *fmt_time(ts, time(NULL)) = '\0';
 
-   for (j = 0; j < cnt; j++)
+   fsh_cursor_init(&cur, ctx);
+   for (j = 0; next_track(&cur, &trk); j++)
    {
-      fprintf(out, "   <way id=\"%d\" version =\"1\" timestamp=\"%s\">\n", get_id(), ts);
-      if (trk[j].mta != NULL)
-         fprintf(out, "      <tag k=\"name\" v=\"%s\"/>\n", trk[j].mta->name);
-      fprintf(out, "      <tag k=\"fsh:type\" v=\"track\"/>\n");
-      for (i = trk[j].first_id; i >= trk[j].last_id; i--)
+      ob_printf(out, "   <way id=\"%d\" version =\"1\" timestamp=\"%s\">\n", get_id(), ts);
+      if (trk.mta != NULL)
+         ob_printf(out, "      <tag k=\"name\" v=\"%s\"/>\n", trk.mta->name);
+      ob_printf(out, "      <tag k=\"fsh:type\" v=\"track\"/>\n");
+      for (i = ids[2 * j]; i >= ids[2 * j + 1]; i--)
       {
-         fprintf(out, "      <nd ref=\"%d\"/>\n", i);
+         ob_printf(out, "      <nd ref=\"%d\"/>\n", i);
       }
-      fprintf(out, "   </way>\n");
+      ob_printf(out, "   </way>\n");
    }
+   fsh_cursor_free(&cur);
    return 0;
 }
 
 
-int track_output_gpx(FILE *out, const track_t *trk, int cnt, const ellipsoid_t *el)
+/*! Output a single track in GPX format.
+ * @param buf Pointer to the projection buffer, see tseg_project().
+ */
+static void track_output_gpx0(obuf_t *out, const track_t *trk, const ellipsoid_t *el, double **buf)
 {
    struct coord cd, cd0;
-   int i, j, k, n;
+   const double *ll;
+   char *p;
+   int i, k, n;
 
-   for (j = 0; j < cnt; j++)
+   ob_printf(out, " <trk>\n");
+   if (trk->mta != NULL)
    {
-      fprintf(out, " <trk>\n");
-      if (trk[j].mta != NULL)
-      {
-         fprintf(out, "  <name>%.*s</name>\n  <trkseg>\n",
-               (int) sizeof(trk[j].mta->name), trk[j].mta->name);
-      }
+      ob_printf(out, "  <name>%.*s</name>\n  <trkseg>\n",
+            (int) sizeof(trk->mta->name), trk->mta->name);
+   }
 
-      for (k = 0, n = 0; k < trk[j].mta->guid_cnt; k++)
-         for (i = 0; i < trk[j].tseg[k].hdr->cnt; i++, n++)
-         {
-            if (trk[j].tseg[k].pt[i].c == -1)
-               continue;
+   for (k = 0, n = 0; k < trk->mta->guid_cnt; k++)
+   {
+      if (trk->tseg[k].hdr == NULL)
+         continue;
 
-            cd0 = cd;
-            raycoord_norm(trk[j].tseg[k].pt[i].north, trk[j].tseg[k].pt[i].east, &cd.lat, &cd.lon);
-            cd.lat = phi_iterate_merc(el, cd.lat) * 180 / M_PI;
+      ll = tseg_project(&trk->tseg[k], el, buf);
+      for (i = 0; i < trk->tseg[k].hdr->cnt; i++, n++)
+      {
+         if (trk->tseg[k].pt[i].c == -1)
+            continue;
+
+         cd0 = cd;
+         cd.lat = ll[i];
+         cd.lon = ll[trk->tseg[k].hdr->cnt + i];
+
+         if (i)
+            coord_diff(&cd0, &cd);
+
+         p = fmt_str(ob_reserve(out, LBUFLEN), "   <trkpt lat=\"");
+         p = fmt_dbl(p, cd.lat, 8);
+         p = fmt_str(p, "\" lon=\"");
+         p = fmt_dbl(p, cd.lon, 8);
+         p = fmt_str(p, "\">\n    <ele>");
+         p = fmt_dbl(p, (double) trk->tseg[k].pt[i].depth / -100, 1);
+         p = fmt_str(p, "</ele>\n   </trkpt>\n");
+         ob_commit(out, p);
+      }
+   }
+   ob_printf(out, "  </trkseg>\n </trk>\n");
+}
 
-            if (i)
-               coord_diff(&cd0, &cd);
 
-            fprintf(out, "   <trkpt lat=\"%.8f\" lon=\"%.8f\">\n    <ele>%.1f</ele>\n   </trkpt>\n",
-                  cd.lat, cd.lon, (double) trk[j].tseg[k].pt[i].depth / -100);
-         }
-      fprintf(out, "  </trkseg>\n </trk>\n");
+int track_output_gpx(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el)
+{
+   fsh_cursor_t cur;
+   item_rec_t ir;
+   track_t trk;
+   double *buf = NULL;
+
+   memset(&ir, 0, sizeof(ir));
+   fsh_cursor_init(&cur, ctx);
+   while (next_track(&cur, &trk))
+   {
+      if (item_start(out, &ir, FSH_BLK_TRK, &trk, NULL, 0))
+         continue;
+      track_output_gpx0(out, &trk, el, &buf);
+      item_end(out, &ir, NULL, 0);
    }
+   fsh_cursor_free(&cur);
+   free(ir.buf);
+   free(buf);
    return 0;
 }
 
 
-int track_output(FILE *out, const track_t *trk, int cnt, const ellipsoid_t *el)
+// state of the CSV track output which is carried over from one track to the next
+struct trk_state
 {
-   struct coord cd, cd0;
-   struct pcoord pc = {0, 0};
+   struct coord cd;     //!< coordinates of the previous point
+   struct pcoord pc;    //!< bearing and distance to the previous point
+   double *buf;         //!< projection buffer, see tseg_project()
+};
+
+// length of the part of struct trk_state which affects the output
+#define TRK_STATE_LEN offsetof(struct trk_state, buf)
+
+
+/*! Output a single track in CSV format.
+ * @param ts Pointer to the output state, it must be zeroed before the first
+ * track.
+ */
+static void track_output0(obuf_t *out, const track_t *trk, const ellipsoid_t *el, struct trk_state *ts)
+{
+   struct coord cd0;
+   const double *ll;
    double dist, dist_seg;
-   int i, j, k, n;
+   char *p;
+   int i, k, n;
 
-   for (j = 0; j < cnt; j++)
+   ob_printf(out, "# ----- BEGIN TRACK -----\n");
+   if (trk->mta != NULL)
    {
-      fprintf(out, "# ----- BEGIN TRACK -----\n");
-      if (trk[j].mta != NULL)
-      {
-         fprintf(out, "# name = '%.*s', tempr_start = %.1f, depth_start = %d, tempr_end = %.1f, depth_end = %d, length = %d m, guid_cnt = %d\n",
-               (int) sizeof(trk[j].mta->name), trk[j].mta->name,
-               CELSIUS(trk[j].mta->tempr_start), trk[j].mta->depth_start,
-               CELSIUS(trk[j].mta->tempr_end), trk[j].mta->depth_end,
-               trk[j].mta->length, trk[j].mta->guid_cnt);
-         for (i = 0; i < trk[j].mta->guid_cnt; i++)
-            fprintf(out, "# guid[%d] = %s\n", i, guid_to_string(trk[j].mta->guid[i]));
-      }
-      else
-         fprintf(out, "# no track meta data\n");
+      ob_printf(out, "# name = '%.*s', tempr_start = %.1f, depth_start = %d, tempr_end = %.1f, depth_end = %d, length = %d m, guid_cnt = %d\n",
+            (int) sizeof(trk->mta->name), trk->mta->name,
+            CELSIUS(trk->mta->tempr_start), trk->mta->depth_start,
+            CELSIUS(trk->mta->tempr_end), trk->mta->depth_end,
+            trk->mta->length, trk->mta->guid_cnt);
+      for (i = 0; i < trk->mta->guid_cnt; i++)
+         ob_printf(out, "# guid[%d] = %s\n", i, guid_to_string(trk->mta->guid[i]));
+   }
+   else
+      ob_printf(out, "# no track meta data\n");
 
-      fprintf(out, "# CNT, NR, FSH-N, FSH-E, lat, lon, DEPTH [cm], TEMPR [C], C, bearing, distance [m], TRACKNAME\n");
+   ob_printf(out, "# CNT, NR, FSH-N, FSH-E, lat, lon, DEPTH [cm], TEMPR [C], C, bearing, distance [m], TRACKNAME\n");
 
-      for (k = 0, n = 0, dist = 0; k < trk[j].mta->guid_cnt; k++, dist += dist_seg)
+   for (k = 0, n = 0, dist = 0; k < trk->mta->guid_cnt; k++, dist += dist_seg)
+   {
+      dist_seg = 0;
+      if (trk->tseg[k].hdr == NULL)
+         continue;
+
+      ob_printf(out, "# ----- BEGIN TRACKSEG -----\n");
+      ll = tseg_project(&trk->tseg[k], el, &ts->buf);
+      for (i = 0; i < trk->tseg[k].hdr->cnt; i++, n++)
       {
-         fprintf(out, "# ----- BEGIN TRACKSEG -----\n");
-         for (i = 0, dist_seg = 0; i < trk[j].tseg[k].hdr->cnt; i++, n++)
+         if (trk->tseg[k].pt[i].c == -1)
+            continue;
+
+         cd0 = ts->cd;
+         ts->cd.lat = ll[i];
+         ts->cd.lon = ll[trk->tseg[k].hdr->cnt + i];
+
+         if (i)
+            ts->pc = coord_diff(&cd0, &ts->cd);
+
+         p = fmt_int(ob_reserve(out, LBUFLEN), n);
+         p = fmt_str(p, ", ");
+         p = fmt_int(p, i);
+         p = fmt_str(p, ", ");
+         p = fmt_int(p, trk->tseg[k].pt[i].north);
+         p = fmt_str(p, ", ");
+         p = fmt_int(p, trk->tseg[k].pt[i].east);
+         p = fmt_str(p, ", ");
+         p = fmt_dbl(p, ts->cd.lat, 8);
+         p = fmt_str(p, ", ");
+         p = fmt_dbl(p, ts->cd.lon, 8);
+         p = fmt_str(p, ", ");
+         p = fmt_int(p, trk->tseg[k].pt[i].depth);
+         p = fmt_str(p, ", ");
+         p = fmt_dbl(p, CELSIUS(trk->tseg[k].pt[i].tempr), 1);
+         p = fmt_str(p, ", ");
+         p = fmt_int(p, trk->tseg[k].pt[i].c);
+         p = fmt_str(p, ", ");
+         p = fmt_dbl(p, ts->pc.bearing, 1);
+         p = fmt_str(p, ", ");
+         p = fmt_dbl(p, DEG2M(ts->pc.dist), 1);
+         if (trk->mta)
          {
-            if (trk[j].tseg[k].pt[i].c == -1)
-               continue;
-
-            cd0 = cd;
-            raycoord_norm(trk[j].tseg[k].pt[i].north, trk[j].tseg[k].pt[i].east, &cd.lat, &cd.lon);
-            cd.lat = phi_iterate_merc(el, cd.lat) * 180 / M_PI;
-
-            if (i)
-               pc = coord_diff(&cd0, &cd);
-
-            fprintf(out, "%d, %d, %d, %d, %.8f, %.8f, %d, %.1f, %d, %.1f, %.1f",
-                  n, i, trk[j].tseg[k].pt[i].north, trk[j].tseg[k].pt[i].east,
-                  cd.lat, cd.lon, trk[j].tseg[k].pt[i].depth, CELSIUS(trk[j].tseg[k].pt[i].tempr),
-                  trk[j].tseg[k].pt[i].c, pc.bearing, DEG2M(pc.dist));
-            if (trk[j].mta)
-               fprintf(out, ", %.*s\n",
-                  (int) sizeof(trk[j].mta->name), trk[j].mta->name);
-            else
-               fprintf(out, "\n");
-            dist_seg += pc.dist;
+            p = fmt_str(p, ", ");
+            p = fmt_strn(p, trk->mta->name, sizeof(trk->mta->name));
          }
-         fprintf(out, "# distance = %.1f nm, %.1f m\n", dist_seg * 60, DEG2M(dist_seg));
-         fprintf(out, "# ----- END TRACKSEG -----\n");
+         *p++ = '\n';
+         ob_commit(out, p);
+         dist_seg += ts->pc.dist;
       }
-      fprintf(out, "# total distance = %.1f nm, %.1f m\n", dist * 60, DEG2M(dist));
-      fprintf(out, "# ----- END TRACK -----\n");
+      ob_printf(out, "# distance = %.1f nm, %.1f m\n", dist_seg * 60, DEG2M(dist_seg));
+      ob_printf(out, "# ----- END TRACKSEG -----\n");
+   }
+   ob_printf(out, "# total distance = %.1f nm, %.1f m\n", dist * 60, DEG2M(dist));
+   ob_printf(out, "# ----- END TRACK -----\n");
+}
+
+
+int track_output(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el)
+{
+   fsh_cursor_t cur;
+   item_rec_t ir;
+   track_t trk;
+   struct trk_state ts;
+
+   memset(&ir, 0, sizeof(ir));
+   memset(&ts, 0, sizeof(ts));
+   fsh_cursor_init(&cur, ctx);
+   while (next_track(&cur, &trk))
+   {
+      if (item_start(out, &ir, FSH_BLK_TRK, &trk, &ts, TRK_STATE_LEN))
+         continue;
+      track_output0(out, &trk, el, &ts);
+      item_end(out, &ir, &ts, TRK_STATE_LEN);
    }
+   fsh_cursor_free(&cur);
+   free(ir.buf);
+   free(ts.buf);
    return 0;
 }
 
 
-int route_output_osm_nodes(FILE *out, route21_t *rte, int cnt, const ellipsoid_t *el)
+/*! Output the waypoints of all routes as OSM nodes.
+ * @param ids Pointer to a variable which receives the list of the first and
+ * last node ID of each route, see track_output_osm_nodes().
+ * @return Returns the number of routes.
+ */
+int route_output_osm_nodes(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el, int **ids)
 {
+   fsh_cursor_t cur;
    fsh_route_wpt_t *wpt;
+   route21_t rte;
    int i, j;
 
-   for (j = 0; j < cnt; j++)
+   fsh_cursor_init(&cur, ctx);
+   for (j = 0, *ids = NULL; fsh_next_route(&cur, &rte) > 0; j++)
    {
-      rte[j].first_id = get_id();
-      for (i = 0, wpt = rte[j].wpt; i < rte[j].hdr3->wpt_cnt; i++)
+      if ((*ids = realloc(*ids, sizeof(**ids) * 2 * (j + 1))) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+
+      (*ids)[2 * j] = get_id();
+      for (i = 0, wpt = rte.wpt; i < rte.hdr3->wpt_cnt; i++)
       {
-         output_osm_nodes(out, &wpt->wpt.wpd, el, get_id() + 1, "routepoint");
+         output_osm_nodes(out, &wpt->wpt.wpd, NULL, el, get_id() + 1, "routepoint");
          wpt = (fsh_route_wpt_t*) ((char*) wpt + wpt->wpt.wpd.name_len + wpt->wpt.wpd.cmt_len + sizeof(*wpt));
       }
-      rte[j].last_id = get_id() + 2;
+      (*ids)[2 * j + 1] = get_id() + 2;
    }
-   return 0;
+   fsh_cursor_free(&cur);
+   return j;
 }
 
 
-int route_output_osm_ways(FILE *out, route21_t *rte, int cnt)
+int route_output_osm_ways(obuf_t *out, const fsh_ctx_t *ctx, const int *ids)
 {
-   char ts[TBUFLEN] = "0000-00-00T00:00:00Z";
-   char name[64];
-   struct tm *tm;
-   time_t t;
+   fsh_cursor_t cur;
+   route21_t rte;
+   char *p;
+   char ts[TBUFLEN];
    int i, j;
 
-   time(&t);
-   if ((tm = gmtime(&t)) != NULL)
-      strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", tm);
+   *fmt_time(ts, time(NULL)) = '\0';
 
-   for (j = 0; j < cnt; j++)
+   fsh_cursor_init(&cur, ctx);
+   for (j = 0; fsh_next_route(&cur, &rte) > 0; j++)
    {
-      esc_txt(NAME(*rte[j].hdr), rte[j].hdr->name_len, name, sizeof(name), "&<>\"");
-      fprintf(out,
+      ob_printf(out,
             "   <way id=\"%d\" version =\"1\" timestamp=\"%s\">\n"
-            "      <tag k=\"name\" v=\"%s\"/>\n"
-            "      <tag k=\"fsh:type\" v=\"route\"/>\n",
-            get_id(), ts, name);
-      for (i = rte[j].first_id; i >= rte[j].last_id; i--)
-         fprintf(out, "      <nd ref=\"%d\"/>\n", i);
-      fprintf(out, "   </way>\n");
+            "      <tag k=\"name\" v=\"",
+            get_id(), ts);
+      p = ob_esc(ob_reserve(out, LBUFLEN), NAME(*rte.hdr), rte.hdr->name_len, 1);
+      ob_commit(out, p);
+      ob_printf(out,
+            "\"/>\n"
+            "      <tag k=\"fsh:type\" v=\"route\"/>\n");
+      for (i = ids[2 * j]; i >= ids[2 * j + 1]; i--)
+         ob_printf(out, "      <nd ref=\"%d\"/>\n", i);
+      ob_printf(out, "   </way>\n");
    }
+   fsh_cursor_free(&cur);
    return 0;
 }
 
 
-int route_output(FILE *out, const route21_t *rte, int cnt, const ellipsoid_t *el)
+/*! Output a single route in CSV format. */
+static void route_output0(obuf_t *out, const route21_t *rte, const ellipsoid_t *el)
 {
    fsh_route_wpt_t *wpt;
-   int i, j;
+   int i;
 
-   for (j = 0; j < cnt; j++)
-   {
-      fprintf(out, "# route '%.*s', guid_cnt = %d\n", rte[j].hdr->name_len, NAME(*rte[j].hdr), rte[j].hdr->guid_cnt);
-      for (i = 0; i < rte[j].hdr->guid_cnt; i++)
-         fprintf(out, "#   %s\n", guid_to_string(rte[j].guid[i]));
+   ob_printf(out, "# route '%.*s', guid_cnt = %d\n", rte->hdr->name_len, NAME(*rte->hdr), rte->hdr->guid_cnt);
+   for (i = 0; i < rte->hdr->guid_cnt; i++)
+      ob_printf(out, "#   %s\n", guid_to_string(rte->guid[i]));
 
-      fprintf(out, "# lat0 = %.7f, lon0 = %.7f, lat1 = %.7f, lon1 = %.7f\n# hdr2: ",
-            (double) rte[j].hdr2->lat0 / 1E7, (double) rte[j].hdr2->lon0 / 1E7,
-            (double) rte[j].hdr2->lat1 / 1E7, (double) rte[j].hdr2->lon1 / 1E7);
-      hexdump((char*) rte[j].hdr2 + 16, sizeof(*rte[j].hdr2) - 16);
-      fprintf(out, "# hdr2 [dec]: %d, %d\n", rte[j].hdr2->a, rte[j].hdr2->c);
+   ob_printf(out, "# lat0 = %.7f, lon0 = %.7f, lat1 = %.7f, lon1 = %.7f\n# hdr2: ",
+         (double) rte->hdr2->lat0 / 1E7, (double) rte->hdr2->lon0 / 1E7,
+         (double) rte->hdr2->lat1 / 1E7, (double) rte->hdr2->lon1 / 1E7);
+   hexdump(out, (char*) rte->hdr2 + 16, sizeof(*rte->hdr2) - 16);
+   ob_printf(out, "# hdr2 [dec]: %d, %d\n", rte->hdr2->a, rte->hdr2->c);
 
-      for (i = 0; i < rte[j].hdr->guid_cnt; i++)
-         fprintf(out, "# %d, %d, %d, %d, %d\n", rte[j].pt[i].a, rte[j].pt[i].b, rte[j].pt[i].c, rte[j].pt[i].d, rte[j].pt[i].sym);
+   for (i = 0; i < rte->hdr->guid_cnt; i++)
+      ob_printf(out, "# %d, %d, %d, %d, %d\n", rte->pt[i].a, rte->pt[i].b, rte->pt[i].c, rte->pt[i].d, rte->pt[i].sym);
 
-      fprintf(out, "# wpt_cnt %d\n", rte[j].hdr3->wpt_cnt);
-      fprintf(out, "# guid_cnt %d\n", rte[j].hdr->guid_cnt);
+   ob_printf(out, "# wpt_cnt %d\n", rte->hdr3->wpt_cnt);
+   ob_printf(out, "# guid_cnt %d\n", rte->hdr->guid_cnt);
 
-      for (i = 0, wpt = rte[j].wpt; i < rte[j].hdr3->wpt_cnt; i++)
-      {
-         output_wpt(out, &wpt->wpt.wpd, el, wpt->guid);
-         wpt = (fsh_route_wpt_t*) ((char*) wpt + wpt->wpt.wpd.name_len + wpt->wpt.wpd.cmt_len + sizeof(*wpt));
-      }
+   for (i = 0, wpt = rte->wpt; i < rte->hdr3->wpt_cnt; i++)
+   {
+      output_wpt(out, &wpt->wpt.wpd, el, wpt->guid);
+      wpt = (fsh_route_wpt_t*) ((char*) wpt + wpt->wpt.wpd.name_len + wpt->wpt.wpd.cmt_len + sizeof(*wpt));
    }
-   return 0;
 }
 
 
-int wpt_01_output(FILE *out, const fsh_block_t *blk, const ellipsoid_t *el)
+int route_output(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el)
 {
-   fsh_wpt01_t *wpt;
+   fsh_cursor_t cur;
+   item_rec_t ir;
+   route21_t rte;
 
-   fprintf(out, "# ----- BEGIN WAYPOINTS TYPE 0x01 -----\n"
-                "# GUID, LAT, LON, SYM, TEMPR [C], DEPTH [cm], NAME, COMMENT, TIMESTAMP\n");
-   for (; blk->hdr.type != 0xffff; blk++)
+   memset(&ir, 0, sizeof(ir));
+   fsh_cursor_init(&cur, ctx);
+   while (fsh_next_route(&cur, &rte) > 0)
    {
-      if (blk->hdr.type != 0x01)
+      if (item_start(out, &ir, FSH_BLK_RTE, &rte, NULL, 0))
          continue;
-
-      wpt = blk->data;
-      output_wpt(out, &wpt->wpd, el, wpt->guid);
+      route_output0(out, &rte, el);
+      item_end(out, &ir, NULL, 0);
    }
-   fprintf(out, "# ----- END WAYPOINTS TYPE 0x01 -----\n");
+   fsh_cursor_free(&cur);
+   free(ir.buf);
    return 0;
 }
 
 
-int wpt_01_output_osm_nodes(FILE *out, const fsh_block_t *blk, const ellipsoid_t *el)
+int wpt_01_output(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el)
 {
-   fsh_wpt01_t *wpt;
+   fsh_cursor_t cur;
+   const fsh_wpt01_t *wpt;
+   item_rec_t ir;
 
-   for (; blk->hdr.type != 0xffff; blk++)
+   ob_printf(out, "# ----- BEGIN WAYPOINTS TYPE 0x01 -----\n"
+                "# GUID, LAT, LON, SYM, TEMPR [C], DEPTH [cm], NAME, COMMENT, TIMESTAMP\n");
+   memset(&ir, 0, sizeof(ir));
+   fsh_cursor_init(&cur, ctx);
+   while (fsh_next_wpt(&cur, &wpt) > 0)
    {
-      if (blk->hdr.type != 0x01)
+      if (item_start(out, &ir, FSH_BLK_WPT, wpt, NULL, 0))
          continue;
-
-      wpt = blk->data;
-      output_osm_nodes(out, &wpt->wpd, el, get_id(), "waypoint");
+      output_wpt(out, &wpt->wpd, el, wpt->guid);
+      item_end(out, &ir, NULL, 0);
    }
+   fsh_cursor_free(&cur);
+   free(ir.buf);
+   ob_printf(out, "# ----- END WAYPOINTS TYPE 0x01 -----\n");
+   return 0;
+}
+
+
+int wpt_01_output_osm_nodes(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el)
+{
+   fsh_cursor_t cur;
+   const fsh_wpt01_t *wpt;
+
+   fsh_cursor_init(&cur, ctx);
+   while (fsh_next_wpt(&cur, &wpt) > 0)
+      output_osm_nodes(out, &wpt->wpd, NULL, el, get_id(), "waypoint");
+   fsh_cursor_free(&cur);
    return 0;
 }
 
 
-static void output_gpx_wpt(FILE *out, const fsh_wpt_data_t *wpd, const ellipsoid_t *el, int type)
+static void output_gpx_wpt(obuf_t *out, const fsh_wpt_data_t *wpd, const ellipsoid_t *el, int type)
 {
    struct coord cd;
-   char tbuf[64], *t, name[64], cmt[64];
+   char tbuf[64], *t, *p;
 
    t = type == FSH_BLK_WPT ? "wpt" : "rtept";
    raycoord_norm(wpd->north, wpd->east, &cd.lat, &cd.lon);
-   cd.lat = phi_iterate_merc(el, cd.lat) * 180 / M_PI;
+   cd.lat = phi_merc(el, cd.lat) * 180 / M_PI;
 
    fsh_timetostr(&wpd->ts, tbuf, sizeof(tbuf));
-   esc_txt(NAME(*wpd), wpd->name_len, name, sizeof(name), "&<>");
-   esc_txt(COMMENT(*wpd), wpd->cmt_len, cmt, sizeof(cmt), "&<>");
-
-   fprintf(out,
-            "   <%s lat=\"%.7f\" lon=\"%.7f\">\n"
-            "      <time>%s</time>\n"
-            "      <name>%s</name>\n"
-            "      <cmt>%s</cmt>\n",
-            //get_id() + 1, wpt->lat / 1E7, wpt->lon / 1E7, ts, wpt->name_len, wpt->name);
-            t,
-            cd.lat, cd.lon, tbuf, name, cmt);
+
+   p = fmt_str(ob_reserve(out, LBUFLEN), "   <");
+   p = fmt_str(p, t);
+   p = fmt_str(p, " lat=\"");
+   p = fmt_dbl(p, cd.lat, 7);
+   p = fmt_str(p, "\" lon=\"");
+   p = fmt_dbl(p, cd.lon, 7);
+   p = fmt_str(p, "\">\n      <time>");
+   p = fmt_str(p, tbuf);
+   p = fmt_str(p, "</time>\n      <name>");
+   p = ob_esc(p, NAME(*wpd), wpd->name_len, 0);
+   p = fmt_str(p, "</name>\n      <cmt>");
+   p = ob_esc(p, COMMENT(*wpd), wpd->cmt_len, 0);
+   p = fmt_str(p, "</cmt>\n");
 
    if (wpd->depth != -1)
-      fprintf(out, 
-            "      <ele>%.1f</ele>\n",
-            (double) wpd->depth / -100.0);
+   {
+      p = fmt_str(p, "      <ele>");
+      p = fmt_dbl(p, (double) wpd->depth / -100.0, 1);
+      p = fmt_str(p, "</ele>\n");
+   }
 #if 0
    if (wpt->wpd.tempr != TEMPR_NA)
-      fprintf(out, 
+      ob_printf(out, 
            "      <tag k=\"temperature\" v=\"%.1f\"/>\n",
            CELSIUS(wpt->wpd.tempr));
 #endif
-   fprintf(out, "   </%s>\n", t);
+   p = fmt_str(p, "   </");
+   p = fmt_str(p, t);
+   p = fmt_str(p, ">\n");
+   ob_commit(out, p);
 }
 
 
-int route_output_gpx_ways(FILE *out, route21_t *rte, int cnt, const ellipsoid_t *el)
+/*! Output a single route in GPX format. */
+static void route_output_gpx0(obuf_t *out, const route21_t *rte, const ellipsoid_t *el)
 {
-   char name[64], cmt[64];
    fsh_route_wpt_t *wpt;
+   char *p;
    int i;
 
-   for (int j = 0; j < cnt; j++)
+   p = fmt_str(ob_reserve(out, LBUFLEN), "   <rte>\n      <name>");
+   p = ob_esc(p, NAME(*rte->hdr), rte->hdr->name_len, 0);
+   p = fmt_str(p, "</name>\n      <cmt>");
+   p = ob_esc(p, COMMENT(*rte->hdr), rte->hdr->cmt_len, 0);
+   p = fmt_str(p, "</cmt>\n");
+   ob_commit(out, p);
+
+   for (wpt = rte->wpt, i = 0; i < rte->hdr3->wpt_cnt; i++)
    {
-      esc_txt(NAME(*rte[j].hdr), rte[j].hdr->name_len, name, sizeof(name), "&<>");
-      esc_txt(COMMENT(*rte[j].hdr), rte[j].hdr->cmt_len, cmt, sizeof(cmt), "&<>");
-      fprintf(out,
-            "   <rte>\n"
-            "      <name>%s</name>\n"
-            "      <cmt>%s</cmt>\n",
-            name, cmt);
+      output_gpx_wpt(out, &wpt->wpt.wpd, el, FSH_BLK_RTE);
+      wpt = (fsh_route_wpt_t*) ((char*) wpt + wpt->wpt.wpd.name_len + wpt->wpt.wpd.cmt_len + sizeof(*wpt));
+   }
 
-      for (wpt = rte[j].wpt, i = 0; i < rte[j].hdr3->wpt_cnt; i++)
-      {
-         output_gpx_wpt(out, &wpt->wpt.wpd, el, FSH_BLK_RTE);
-         wpt = (fsh_route_wpt_t*) ((char*) wpt + wpt->wpt.wpd.name_len + wpt->wpt.wpd.cmt_len + sizeof(*wpt));
-      }
+   ob_printf(out,
+         "   </rte>\n");
+}
 
-      fprintf(out,
-            "   </rte>\n");
+
+int route_output_gpx_ways(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el)
+{
+   fsh_cursor_t cur;
+   item_rec_t ir;
+   route21_t rte;
+
+   memset(&ir, 0, sizeof(ir));
+   fsh_cursor_init(&cur, ctx);
+   while (fsh_next_route(&cur, &rte) > 0)
+   {
+      if (item_start(out, &ir, FSH_BLK_RTE, &rte, NULL, 0))
+         continue;
+      route_output_gpx0(out, &rte, el);
+      item_end(out, &ir, NULL, 0);
    }
+   fsh_cursor_free(&cur);
+   free(ir.buf);
    return 0;
 }
 
 
-int wpt_01_output_gpx_nodes(FILE *out, const fsh_block_t *blk, const ellipsoid_t *el)
-
+int wpt_01_output_gpx_nodes(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el)
 {
-   fsh_wpt01_t *wpt;
+   fsh_cursor_t cur;
+   const fsh_wpt01_t *wpt;
+   item_rec_t ir;
 
-   for (; blk->hdr.type != 0xffff; blk++)
+   memset(&ir, 0, sizeof(ir));
+   fsh_cursor_init(&cur, ctx);
+   while (fsh_next_wpt(&cur, &wpt) > 0)
    {
-      if (blk->hdr.type != 0x01)
+      if (item_start(out, &ir, FSH_BLK_WPT, wpt, NULL, 0))
          continue;
-
-      wpt = blk->data;
       output_gpx_wpt(out, &wpt->wpd, el, FSH_BLK_WPT);
+      item_end(out, &ir, NULL, 0);
    }
+   fsh_cursor_free(&cur);
+   free(ir.buf);
    return 0;
 }
 
 
-static void check_endian(void)
+/*! Add a waypoint or route point as row to the Arrow output.
+ * @param kind "wpt" or "rtept".
+ * @param item Number of the waypoint or route.
+ * @param name Name of the item of nlen characters.
+ * @param pt Number of the point within the route.
+ */
+static void arrow_wpt(arrow_t *ar, const char *kind, int item, const char *name, int nlen, int pt, const fsh_wpt_data_t *wpd, const ellipsoid_t *el)
 {
-   int c = 1;
+   struct coord cd;
 
-   if (!*((char*) &c))
-      fprintf(stderr, "# parsefsh currently only works on little endian machines (such as Intel)\n"),
-         exit(EXIT_FAILURE);
+   raycoord_norm(wpd->north, wpd->east, &cd.lat, &cd.lon);
+   cd.lat = phi_merc(el, cd.lat) * 180 / M_PI;
+
+   ar_str(ar, AC_KIND, kind, strlen(kind));
+   ar_int(ar, AC_ITEM, item);
+   ar_str(ar, AC_NAME, name, strnlen(name, nlen));
+   ar_int(ar, AC_SEG, 0);
+   ar_int(ar, AC_PT, pt);
+   ar_dbl(ar, AC_LAT, cd.lat);
+   ar_dbl(ar, AC_LON, cd.lon);
+   if (wpd->depth == DEPTH_NA)
+      ar_null(ar, AC_DEPTH);
+   else
+      ar_int(ar, AC_DEPTH, wpd->depth);
+   if (wpd->tempr == TEMPR_NA)
+      ar_null(ar, AC_TEMPR);
+   else
+      ar_dbl(ar, AC_TEMPR, CELSIUS(wpd->tempr));
+   ar_time(ar, AC_TIME, (int64_t) wpd->ts.date * 3600 * 24 + wpd->ts.timeofday);
+   ar_row(ar);
 }
 
 
-static void usage(const char *s)
+/*! Output all waypoints, track points, and route points as rows of Arrow
+ * record batches with the columns ar_field_. The schema is written by
+ * doc_start().
+ */
+int arrow_output(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el)
 {
-   printf(
-         "%s\n"
-         "usage: %s [OPTIONS]\n"
-         "   -c ............. Output CSV format instead of OSM.\n"
-         "   -f <format> .... Define output format. Available formats: csv, gpx, osm.\n"
-         "   -h ............. This help.\n"
-         "   -q ............. Quiet. No informational output.\n",
-         COPYLEFT, s);
-}
-
+   const fsh_wpt01_t *wpt;
+   const fsh_track_point_t *pt;
+   fsh_route_wpt_t *rwpt;
+   fsh_cursor_t cur;
+   track_t trk;
+   route21_t rte;
+   arrow_t *ar;
+   const double *ll;
+   double *buf = NULL;
+   int i, j, k, cnt;
+
+   ar = ar_open(out, ar_field_, AC_CNT, AR_BATCH_ROWS);
+
+   fsh_cursor_init(&cur, ctx);
+   for (j = 0; fsh_next_wpt(&cur, &wpt) > 0; j++)
+      arrow_wpt(ar, "wpt", j, NAME(wpt->wpd), wpt->wpd.name_len, 0, &wpt->wpd, el);
+
+   fsh_cursor_init(&cur, ctx);
+   for (j = 0; next_track(&cur, &trk); j++)
+      for (k = 0; k < trk.mta->guid_cnt; k++)
+      {
+         if (trk.tseg[k].hdr == NULL)
+            continue;
 
-int main(int argc, char **argv)
-{
-   fsh_file_header_t fhdr;
-   fsh_flob_header_t flobhdr;
-   track_t *trk;
-   route21_t *rte;
-   fsh_block_t *blk = NULL;
-   ellipsoid_t el = WGS84;
-   int fd = 0, trk_cnt = 0, fmt_out = FMT_OSM, rte_cnt = 0, flob_cnt = 0;
-   FILE *out = stdout;
-   int c;
+         cnt = trk.tseg[k].hdr->cnt;
+         ll = tseg_project(&trk.tseg[k], el, &buf);
+         for (i = 0; i < cnt; i++)
+         {
+            pt = &trk.tseg[k].pt[i];
+            if (pt->c == -1)
+               continue;
 
-   while ((c = getopt(argc, argv, "cf:hq")) != -1)
-      switch (c)
-      {
-         case 'c':
-            fmt_out = FMT_CSV;
-            break;
- 
-         case 'f':
-            if (!strcasecmp(optarg, "csv"))
-               fmt_out = FMT_CSV;
-            else if (!strcasecmp(optarg, "osm"))
-               fmt_out = FMT_OSM;
-            else if (!strcasecmp(optarg, "gpx"))
-               fmt_out = FMT_GPX;
+            ar_str(ar, AC_KIND, "trkpt", 5);
+            ar_int(ar, AC_ITEM, j);
+            ar_str(ar, AC_NAME, trk.mta->name, strnlen(trk.mta->name, sizeof(trk.mta->name)));
+            ar_int(ar, AC_SEG, k);
+            ar_int(ar, AC_PT, i);
+            ar_dbl(ar, AC_LAT, ll[i]);
+            ar_dbl(ar, AC_LON, ll[cnt + i]);
+            if (pt->depth == DEPTH_NA)
+               ar_null(ar, AC_DEPTH);
             else
-               fprintf(stderr, "# unknown format '%s', defaults to OSM\n", optarg);
-            break;
-
-         case 'h':
-            usage(argv[0]);
-            return 0;
+               ar_int(ar, AC_DEPTH, pt->depth);
+            if (pt->tempr == TEMPR_NA)
+               ar_null(ar, AC_TEMPR);
+            else
+               ar_dbl(ar, AC_TEMPR, CELSIUS(pt->tempr));
+            ar_null(ar, AC_TIME);
+            ar_row(ar);
+         }
+      }
+   fsh_cursor_free(&cur);
+   free(buf);
 
-         case 'q':
-            if ((logout_ = fopen("/dev/null", "w")) == NULL)
-            {
-               logout_ = stderr;
-               vlog("warning: failed to open /dev/null: %s\n", strerror(errno));
-            }
-            break;
-     }
+   fsh_cursor_init(&cur, ctx);
+   for (j = 0; fsh_next_route(&cur, &rte) > 0; j++)
+      for (i = 0, rwpt = rte.wpt; i < rte.hdr3->wpt_cnt; i++)
+      {
+         arrow_wpt(ar, "rtept", j, NAME(*rte.hdr), rte.hdr->name_len, i, &rwpt->wpt.wpd, el);
+         rwpt = (fsh_route_wpt_t*) ((char*) rwpt + rwpt->wpt.wpd.name_len + rwpt->wpt.wpd.cmt_len + sizeof(*rwpt));
+      }
+   fsh_cursor_free(&cur);
 
-   vlog("%s\n", COPYLEFT);
+   vlog("%lld rows in %d Arrow record batches\n", ar->total + ar->rows, ar->batches + (ar->rows > 0));
+   ar_close(ar);
+   return 0;
+}
 
-   check_endian();
-   init_ellipsoid(&el);
 
-   if (fsh_read_file_header(fd, &fhdr) == -1)
-      fprintf(stderr, "# no RL90 header\n"), exit(EXIT_FAILURE);
-   vlog("filer header values 0x%04x\n", fhdr.flobs);
+/*! Add a waypoint, track point, or route point as node with the same tags
+ * as output_osm_nodes() to the PBF output. Tags with empty values are
+ * omitted.
+ * @param cd0 Pointer to the already projected coordinates of the node or NULL
+ * if they shall be derived from wpd.
+ */
+static void pbf_wpt(pbf_t *pbf, const fsh_wpt_data_t *wpd, const struct coord *cd0, const ellipsoid_t *el, int id, const char *wpt_type)
+{
+   char depth[32], tempr[32];
+   pbf_tag_t tag[6];
+   struct coord cd;
+   int n = 0;
 
-   vlog("reading flob %d\n", flob_cnt);
-   while (fsh_read_flob_header(fd, &flobhdr) != -1)
+   if (cd0 != NULL)
+      cd = *cd0;
+   else
    {
-      vlog("flob header values 0x%04x\n", flobhdr.h & 0xffff);
-      blk = fsh_block_read(fd, blk);
+      raycoord_norm(wpd->north, wpd->east, &cd.lat, &cd.lon);
+      cd.lat = phi_merc(el, cd.lat) * 180 / M_PI;
+   }
 
-      // try to read next FLOB
-      flob_cnt++;
-      vlog("looking for next flob %d\n", flob_cnt);
-      if (flob_cnt >= fhdr.flobs)
-         break;
-      if (lseek(fd, flob_cnt * FLOB_SIZE + sizeof(fhdr), SEEK_SET) == -1)
-         perror("fseek"), exit(EXIT_FAILURE);
+   tag[n++] = (pbf_tag_t) {"fsh:type", wpt_type, strlen(wpt_type)};
+   tag[n++] = (pbf_tag_t) {"name", NAME(*wpd), strnlen(NAME(*wpd), wpd->name_len)};
+   tag[n++] = (pbf_tag_t) {"description", COMMENT(*wpd), strnlen(COMMENT(*wpd), wpd->cmt_len)};
+   if (wpd->depth != -1)
+   {
+      tag[n++] = (pbf_tag_t) {"seamark:sounding", depth, fmt_dbl(depth, (double) wpd->depth / 100.0, 1) - depth};
+      tag[n++] = (pbf_tag_t) {"seamark:type", "sounding", 8};
    }
+   if (wpd->tempr != TEMPR_NA)
+      tag[n++] = (pbf_tag_t) {"temperature", tempr, fmt_dbl(tempr, CELSIUS(wpd->tempr), 1) - tempr};
 
-   rte_cnt = fsh_route_decode(blk, &rte);
-   trk_cnt = fsh_track_decode(blk, &trk);
+   pbf_node(pbf, id, cd.lat, cd.lon, (int64_t) wpd->ts.date * 3600 * 24 + wpd->ts.timeofday, tag, n);
+}
 
-   switch (fmt_out)
-   {
-      default:
-      case FMT_OSM:
-         osm_start(out);
-         wpt_01_output_osm_nodes(out, blk, &el);
-         track_output_osm_nodes(out, trk, trk_cnt, &el);
-         route_output_osm_nodes(out, rte, rte_cnt, &el);
-         track_output_osm_ways(out, trk, trk_cnt);
-         route_output_osm_ways(out, rte, rte_cnt);
-         osm_end(out);
-         break;
 
-      case FMT_CSV:
-         wpt_01_output(out, blk, &el);
-         track_output(out, trk, trk_cnt, &el);
-         route_output(out, rte, rte_cnt, &el);
-         break;
+/*! Add a way of the nodes first down to last to the PBF output, see
+ * track_output_osm_ways().
+ * @param ref Pointer to the buffer of the node ids of size elements.
+ */
+static void pbf_osm_way(pbf_t *pbf, int first, int last, int64_t ts, const pbf_tag_t *tag, int ntag, int64_t **ref, int *size)
+{
+   int i, n = first - last + 1;
+
+   if (n > *size)
+   {
+      *size = n * 2;
+      if ((*ref = realloc(*ref, sizeof(**ref) * *size)) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+   }
+   for (i = 0; i < n; i++)
+      (*ref)[i] = first - i;
+   pbf_way(pbf, get_id(), ts, tag, ntag, *ref, n);
+}
+
+
+/*! Output all waypoints, tracks, and routes as OSM PBF. The nodes and ways
+ * are written in the same order and with the same ids as the OSM XML output
+ * (see convert()). The header is written by doc_start().
+ */
+int pbf_output(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el)
+{
+   const fsh_wpt01_t *wpt;
+   fsh_route_wpt_t *rwpt;
+   fsh_wpt_data_t wpd;
+   fsh_cursor_t cur;
+   track_t trk;
+   route21_t rte;
+   struct coord cd;
+   pbf_tag_t tag[2];
+   pbf_t *pbf;
+   const double *ll;
+   double *buf = NULL;
+   int64_t *ref = NULL, now = time(NULL);
+   int *trk_ids = NULL, *rte_ids = NULL;
+   int i, j, k, cnt, size = 0;
+
+   pbf = pbf_open(out, PBF_BLOCK_ENTITIES);
+
+   fsh_cursor_init(&cur, ctx);
+   while (fsh_next_wpt(&cur, &wpt) > 0)
+      pbf_wpt(pbf, &wpt->wpd, NULL, el, get_id(), "waypoint");
+
+   memset(&wpd, 0, sizeof(wpd));
+   wpd.tempr = TEMPR_NA;
+   fsh_cursor_init(&cur, ctx);
+   for (j = 0; next_track(&cur, &trk); j++)
+   {
+      if ((trk_ids = realloc(trk_ids, sizeof(*trk_ids) * 2 * (j + 1))) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+
+      trk_ids[2 * j] = get_id();
+      for (k = 0; k < trk.mta->guid_cnt; k++)
+      {
+         if (trk.tseg[k].hdr == NULL)
+            continue;
+
+         cnt = trk.tseg[k].hdr->cnt;
+         ll = tseg_project(&trk.tseg[k], el, &buf);
+         for (i = 0; i < cnt; i++)
+         {
+            if (trk.tseg[k].pt[i].c == -1)
+               continue;
+
+            wpd.depth = trk.tseg[k].pt[i].depth;
+            cd.lat = ll[i];
+            cd.lon = ll[cnt + i];
+            pbf_wpt(pbf, &wpd, &cd, el, get_id() + 1, "trackpoint");
+         }
+      }
+      trk_ids[2 * j + 1] = get_id() + 2;
+   }
+   fsh_cursor_free(&cur);
+   free(buf);
+
+   fsh_cursor_init(&cur, ctx);
+   for (j = 0; fsh_next_route(&cur, &rte) > 0; j++)
+   {
+      if ((rte_ids = realloc(rte_ids, sizeof(*rte_ids) * 2 * (j + 1))) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+
+      rte_ids[2 * j] = get_id();
+      for (i = 0, rwpt = rte.wpt; i < rte.hdr3->wpt_cnt; i++)
+      {
+         pbf_wpt(pbf, &rwpt->wpt.wpd, NULL, el, get_id() + 1, "routepoint");
+         rwpt = (fsh_route_wpt_t*) ((char*) rwpt + rwpt->wpt.wpd.name_len + rwpt->wpt.wpd.cmt_len + sizeof(*rwpt));
+      }
+      rte_ids[2 * j + 1] = get_id() + 2;
+   }
+
+   fsh_cursor_init(&cur, ctx);
+   tag[1] = (pbf_tag_t) {"fsh:type", "track", 5};
+   for (j = 0; next_track(&cur, &trk); j++)
+   {
+      tag[0] = (pbf_tag_t) {"name", trk.mta->name, strnlen(trk.mta->name, sizeof(trk.mta->name))};
+      pbf_osm_way(pbf, trk_ids[2 * j], trk_ids[2 * j + 1], now, tag, 2, &ref, &size);
+   }
+   fsh_cursor_free(&cur);
+
+   fsh_cursor_init(&cur, ctx);
+   tag[1] = (pbf_tag_t) {"fsh:type", "route", 5};
+   for (j = 0; fsh_next_route(&cur, &rte) > 0; j++)
+   {
+      tag[0] = (pbf_tag_t) {"name", NAME(*rte.hdr), strnlen(NAME(*rte.hdr), rte.hdr->name_len)};
+      pbf_osm_way(pbf, rte_ids[2 * j], rte_ids[2 * j + 1], now, tag, 2, &ref, &size);
+   }
+   fsh_cursor_free(&cur);
+
+   pbf_flush(pbf);
+   vlog("%lld entities in %d PBF blocks, %lld bytes compressed to %lld bytes\n",
+         pbf->total, pbf->blocks, pbf->raw, pbf->zipped);
+   pbf_close(pbf);
+   free(trk_ids);
+   free(rte_ids);
+   free(ref);
+   return 0;
+}
+
+
+/*! Start a GeoJSON text sequence record (RFC 8142) of a feature. A record
+ * starts with the record separator RS and ends with a newline.
+ * @param p Pointer to the output buffer.
+ * @param type Value of the property "type".
+ * @param guid GUID of the item which is used as feature id.
+ * @return Returns a pointer to the first byte after the written data.
+ */
+static char *geojson_start(char *p, const char *type, uint64_t guid)
+{
+   char gbuf[32];
+
+   p = fmt_str(p, "\x1e{\"type\":\"Feature\",\"id\":\"");
+   p = fmt_str(p, fsh_guid_str(guid, gbuf, sizeof(gbuf)));
+   p = fmt_str(p, "\",\"properties\":{\"type\":\"");
+   p = fmt_str(p, type);
+   return fmt_str(p, "\"");
+}
+
+
+/*! Append a string property to a GeoJSON feature.
+ * @param p Pointer to the output buffer. It must have room for
+ * OB_JESC_MAX * len bytes in addition to the key.
+ * @return Returns a pointer to the first byte after the written data.
+ */
+static char *geojson_str(char *p, const char *key, const char *val, int len)
+{
+   p = fmt_str(p, ",\"");
+   p = fmt_str(p, key);
+   p = fmt_str(p, "\":\"");
+   p = ob_jesc(p, val, len);
+   return fmt_str(p, "\"");
+}
+
+
+/*! Append the position of a track or route point to a GeoJSON geometry.
+ * The depth is written as negative altitude.
+ */
+static char *geojson_pos(char *p, const struct coord *cd, int depth)
+{
+   *p++ = '[';
+   p = fmt_dbl(p, cd->lon, 8);
+   *p++ = ',';
+   p = fmt_dbl(p, cd->lat, 8);
+   if (depth != DEPTH_NA)
+   {
+      *p++ = ',';
+      p = fmt_dbl(p, (double) depth / -100, 1);
+   }
+   *p++ = ']';
+   return p;
+}
+
+
+/*! Output a waypoint as GeoJSON Point feature. */
+static void geojson_wpt(obuf_t *out, const fsh_wpt01_t *wpt, const ellipsoid_t *el)
+{
+   const fsh_wpt_data_t *wpd = &wpt->wpd;
+   char tbuf[TBUFLEN], *p;
+   struct coord cd;
+
+   raycoord_norm(wpd->north, wpd->east, &cd.lat, &cd.lon);
+   cd.lat = phi_merc(el, cd.lat) * 180 / M_PI;
+   fsh_timetostr(&wpd->ts, tbuf, sizeof(tbuf));
+
+   p = geojson_start(ob_reserve(out, LBUFLEN), "waypoint", wpt->guid);
+   p = geojson_str(p, "name", NAME(*wpd), wpd->name_len);
+   p = geojson_str(p, "comment", COMMENT(*wpd), wpd->cmt_len);
+   p = fmt_str(p, ",\"sym\":");
+   p = fmt_int(p, wpd->sym);
+   p = fmt_str(p, ",\"depth\":");
+   if (wpd->depth == DEPTH_NA)
+      p = fmt_str(p, "null");
+   else
+      p = fmt_dbl(p, (double) wpd->depth / 100, 2);
+   p = fmt_str(p, ",\"temperature\":");
+   if (wpd->tempr == TEMPR_NA)
+      p = fmt_str(p, "null");
+   else
+      p = fmt_dbl(p, CELSIUS(wpd->tempr), 1);
+   p = fmt_str(p, ",\"time\":\"");
+   p = fmt_str(p, tbuf);
+   p = fmt_str(p, "\"},\"geometry\":{\"type\":\"Point\",\"coordinates\":[");
+   p = fmt_dbl(p, cd.lon, 7);
+   *p++ = ',';
+   p = fmt_dbl(p, cd.lat, 7);
+   p = fmt_str(p, "]}}\n");
+   ob_commit(out, p);
+}
+
+
+/*! Return 1 if the segment has at least 2 valid points, which a GeoJSON
+ * line string requires (RFC 7946), otherwise 0.
+ */
+static int geojson_line(const track_segment_t *tseg)
+{
+   int i, n;
+
+   if (tseg->hdr == NULL)
+      return 0;
+   for (i = 0, n = 0; i < tseg->hdr->cnt && n < 2; i++)
+      if (tseg->pt[i].c != -1)
+         n++;
+   return n >= 2;
+}
+
+
+/*! Output a single track as GeoJSON feature. A track with a single segment
+ * is written as LineString, otherwise as MultiLineString with one line
+ * string per segment. Segments with less than 2 valid points are skipped.
+ */
+static void geojson_track0(obuf_t *out, const track_t *trk, const ellipsoid_t *el, double **buf)
+{
+   struct coord cd;
+   const double *ll;
+   int i, j, k, n, cnt, multi;
+   char *p;
+
+   for (k = 0, n = 0; k < trk->mta->guid_cnt; k++)
+      n += geojson_line(&trk->tseg[k]);
+   multi = n != 1;
+
+   p = geojson_start(ob_reserve(out, LBUFLEN), "track", trk->bhdr->guid);
+   p = geojson_str(p, "name", trk->mta->name, strnlen(trk->mta->name, sizeof(trk->mta->name)));
+   p = fmt_str(p, ",\"length\":");
+   p = fmt_int(p, trk->mta->length);
+   p = fmt_str(p, ",\"color\":");
+   p = fmt_int(p, trk->mta->col);
+   p = fmt_str(p, multi ? "},\"geometry\":{\"type\":\"MultiLineString\",\"coordinates\":["
+         : "},\"geometry\":{\"type\":\"LineString\",\"coordinates\":[");
+   ob_commit(out, p);
+
+   for (k = 0, n = 0; k < trk->mta->guid_cnt; k++)
+   {
+      if (!geojson_line(&trk->tseg[k]))
+         continue;
+
+      p = ob_reserve(out, LBUFLEN);
+      if (n++)
+         *p++ = ',';
+      if (multi)
+         *p++ = '[';
+      ob_commit(out, p);
+
+      ll = tseg_project(&trk->tseg[k], el, buf);
+      cnt = trk->tseg[k].hdr->cnt;
+      for (i = 0, j = 0; i < cnt; i++)
+      {
+         if (trk->tseg[k].pt[i].c == -1)
+            continue;
+
+         cd.lat = ll[i];
+         cd.lon = ll[cnt + i];
+         p = ob_reserve(out, LBUFLEN);
+         if (j++)
+            *p++ = ',';
+         p = geojson_pos(p, &cd, trk->tseg[k].pt[i].depth);
+         ob_commit(out, p);
+      }
+
+      if (multi)
+         ob_write(out, "]", 1);
+   }
+   ob_puts(out, "]}}\n");
+}
+
+
+/*! Output a single route as GeoJSON LineString feature. */
+static void geojson_route0(obuf_t *out, const route21_t *rte, const ellipsoid_t *el)
+{
+   fsh_route_wpt_t *wpt;
+   struct coord cd;
+   char *p;
+   int i;
+
+   p = geojson_start(ob_reserve(out, LBUFLEN), "route", rte->bhdr->guid);
+   p = geojson_str(p, "name", NAME(*rte->hdr), rte->hdr->name_len);
+   p = geojson_str(p, "comment", COMMENT(*rte->hdr), rte->hdr->cmt_len);
+   p = fmt_str(p, "},\"geometry\":{\"type\":\"LineString\",\"coordinates\":[");
+   ob_commit(out, p);
+
+   for (i = 0, wpt = rte->wpt; i < rte->hdr3->wpt_cnt; i++)
+   {
+      raycoord_norm(wpt->wpt.wpd.north, wpt->wpt.wpd.east, &cd.lat, &cd.lon);
+      cd.lat = phi_merc(el, cd.lat) * 180 / M_PI;
+      p = ob_reserve(out, LBUFLEN);
+      if (i)
+         *p++ = ',';
+      p = geojson_pos(p, &cd, wpt->wpt.wpd.depth);
+      ob_commit(out, p);
+      wpt = (fsh_route_wpt_t*) ((char*) wpt + wpt->wpt.wpd.name_len + wpt->wpt.wpd.cmt_len + sizeof(*wpt));
+   }
+   ob_puts(out, "]}}\n");
+}
+
+
+int geojson_wpt_output(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el)
+{
+   const fsh_wpt01_t *wpt;
+   fsh_cursor_t cur;
+   item_rec_t ir;
+
+   memset(&ir, 0, sizeof(ir));
+   fsh_cursor_init(&cur, ctx);
+   while (fsh_next_wpt(&cur, &wpt) > 0)
+   {
+      if (item_start(out, &ir, FSH_BLK_WPT, wpt, NULL, 0))
+         continue;
+      geojson_wpt(out, wpt, el);
+      item_end(out, &ir, NULL, 0);
+   }
+   fsh_cursor_free(&cur);
+   free(ir.buf);
+   return 0;
+}
+
+
+int geojson_track_output(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el)
+{
+   fsh_cursor_t cur;
+   item_rec_t ir;
+   track_t trk;
+   double *buf = NULL;
+
+   memset(&ir, 0, sizeof(ir));
+   fsh_cursor_init(&cur, ctx);
+   while (next_track(&cur, &trk))
+   {
+      if (item_start(out, &ir, FSH_BLK_TRK, &trk, NULL, 0))
+         continue;
+      geojson_track0(out, &trk, el, &buf);
+      item_end(out, &ir, NULL, 0);
+   }
+   fsh_cursor_free(&cur);
+   free(ir.buf);
+   free(buf);
+   return 0;
+}
+
+
+int geojson_route_output(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el)
+{
+   fsh_cursor_t cur;
+   item_rec_t ir;
+   route21_t rte;
+
+   memset(&ir, 0, sizeof(ir));
+   fsh_cursor_init(&cur, ctx);
+   while (fsh_next_route(&cur, &rte) > 0)
+   {
+      if (item_start(out, &ir, FSH_BLK_RTE, &rte, NULL, 0))
+         continue;
+      geojson_route0(out, &rte, el);
+      item_end(out, &ir, NULL, 0);
+   }
+   fsh_cursor_free(&cur);
+   free(ir.buf);
+   return 0;
+}
+
+
+/*! Write the header line of the statistics table. */
+static void stats_header(obuf_t *out)
+{
+   static const int limit[] = {FSH_STATS_LIMITS};
+   int i;
+
+   ob_printf(out, "# file\ttrack\tname\tsegments\tpoints\tgaps\tmax_gap_m\tlength_m\tsouth\twest\tnorth\teast"
+         "\tdepth_min_m\tdepth_mean_m\tdepth_max_m\ttempr_min_c\ttempr_mean_c\ttempr_max_c\t0-%dm", limit[0]);
+   for (i = 1; i < FSH_STATS_BINS - 1; i++)
+      ob_printf(out, "\t%d-%dm", limit[i - 1], limit[i]);
+   ob_printf(out, "\t>%dm\n", limit[i - 1]);
+}
+
+
+/*! Append a value to a row of the statistics table (FMT_STATS) or to a JSON
+ * object (FMT_STATSJSON). Missing values are written as "-" or null.
+ * @param valid 0 if the value is missing.
+ * @param prec Number of digits after the decimal point.
+ * @return Returns a pointer to the first byte after the written data.
+ */
+static char *stats_val(char *p, int fmt, const char *key, int valid, double x, int prec)
+{
+   if (fmt == FMT_STATS)
+      *p++ = '\t';
+   else
+   {
+      p = fmt_str(p, ",\"");
+      p = fmt_str(p, key);
+      p = fmt_str(p, "\":");
+   }
+
+   if (!valid)
+      return fmt_str(p, fmt == FMT_STATS ? "-" : "null");
+   return fmt_dbl(p, x, prec);
+}
+
+
+/*! Write the statistics of the track number n as a table row or as JSON
+ * object, one per line.
+ * @param path Name of the input file.
+ */
+static void stats_output0(obuf_t *out, int fmt, const char *path, int n, const track_t *trk, const fsh_track_stats_t *st)
+{
+   int i, plen = strlen(path), nlen = strnlen(trk->mta->name, sizeof(trk->mta->name));
+   char *p;
+
+   p = ob_reserve(out, LBUFLEN + OB_JESC_MAX * (plen + nlen));
+   if (fmt == FMT_STATS)
+   {
+      p = fmt_str(p, path);
+      *p++ = '\t';
+      p = fmt_int(p, n);
+      *p++ = '\t';
+      p = fmt_strn(p, trk->mta->name, nlen);
+   }
+   else
+   {
+      p = fmt_str(p, "{\"file\":\"");
+      p = ob_jesc(p, path, plen);
+      p = fmt_str(p, "\",\"track\":");
+      p = fmt_int(p, n);
+      p = fmt_str(p, ",\"name\":\"");
+      p = ob_jesc(p, trk->mta->name, nlen);
+      *p++ = '"';
+   }
+
+   p = stats_val(p, fmt, "segments", 1, st->segs, 0);
+   p = stats_val(p, fmt, "points", 1, st->pts, 0);
+   p = stats_val(p, fmt, "gaps", 1, st->gaps, 0);
+   p = stats_val(p, fmt, "max_gap_m", st->gaps, st->gap_max, 1);
+   p = stats_val(p, fmt, "length_m", 1, st->length, 1);
+   p = stats_val(p, fmt, "south", st->pts, st->south, 6);
+   p = stats_val(p, fmt, "west", st->pts, st->west, 6);
+   p = stats_val(p, fmt, "north", st->pts, st->north, 6);
+   p = stats_val(p, fmt, "east", st->pts, st->east, 6);
+   p = stats_val(p, fmt, "depth_min_m", st->depth_cnt, st->depth_min / 100.0, 2);
+   p = stats_val(p, fmt, "depth_mean_m", st->depth_cnt, st->depth_mean / 100.0, 2);
+   p = stats_val(p, fmt, "depth_max_m", st->depth_cnt, st->depth_max / 100.0, 2);
+   p = stats_val(p, fmt, "tempr_min_c", st->tempr_cnt, st->tempr_min, 1);
+   p = stats_val(p, fmt, "tempr_mean_c", st->tempr_cnt, st->tempr_mean, 1);
+   p = stats_val(p, fmt, "tempr_max_c", st->tempr_cnt, st->tempr_max, 1);
+
+   if (fmt == FMT_STATSJSON)
+      p = fmt_str(p, ",\"depth_hist\":[");
+   for (i = 0; i < FSH_STATS_BINS; i++)
+   {
+      if (fmt == FMT_STATS || i)
+         *p++ = fmt == FMT_STATS ? '\t' : ',';
+      p = fmt_int(p, st->hist[i]);
+   }
+   if (fmt == FMT_STATSJSON)
+      p = fmt_str(p, "]}");
+   *p++ = '\n';
+   ob_commit(out, p);
+}
+
+
+/*! Write the statistics of all tracks, see stats_output0(). No track point
+ * is formatted.
+ * @param path Name of the input file.
+ */
+int stats_output(obuf_t *out, const fsh_ctx_t *ctx, const ellipsoid_t *el, int fmt, const char *path)
+{
+   fsh_track_stats_t st;
+   fsh_cursor_t cur;
+   track_t trk;
+   int n, err;
+
+   fsh_cursor_init(&cur, ctx);
+   for (n = 0; next_track(&cur, &trk); n++)
+   {
+      if ((err = fsh_track_stats(&trk, el, &st)) < 0)
+         fprintf(stderr, "# %s\n", fsh_strerror(err)), exit(EXIT_FAILURE);
+      stats_output0(out, fmt, path, n, &trk, &st);
+   }
+   fsh_cursor_free(&cur);
+   return 0;
+}
+
+
+/*! This function flushes the output stream after the first record was
+ * written and logs the time since program start (time to first byte). It
+ * does nothing on subsequent calls.
+ */
+static void first_byte(obuf_t *out)
+{
+   static __thread int done = 0;
+   struct timespec ts;
+
+   if (done)
+      return;
+   done = 1;
+
+   ob_flush(out);
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   vlog("time to first byte = %.3f ms\n",
+         (ts.tv_sec - start_.tv_sec) * 1E3 + (ts.tv_nsec - start_.tv_nsec) / 1E6);
+}
+
+
+// state of the streaming converter
+typedef struct stream
+{
+   obuf_t *out;
+   int fmt;
+   const ellipsoid_t *el;
+   int wpt_sect;        //!< 1 if the CSV waypoint section is open
+   struct trk_state ts; //!< CSV track output state, its buffer is used by all formats
+} stream_t;
+
+
+/*! Open or close the waypoint section of the CSV output. In contrast to the
+ * normal mode, waypoints may be interleaved with tracks and routes, thus the
+ * section is closed before other items and opened again with the next
+ * waypoint.
+ */
+static void stream_wpt_sect(stream_t *st, int open)
+{
+   if (st->fmt != FMT_CSV || st->wpt_sect == open)
+      return;
+   if (open)
+      ob_printf(st->out, "# ----- BEGIN WAYPOINTS TYPE 0x01 -----\n"
+                "# GUID, LAT, LON, SYM, TEMPR [C], DEPTH [cm], NAME, COMMENT, TIMESTAMP\n");
+   else
+      ob_printf(st->out, "# ----- END WAYPOINTS TYPE 0x01 -----\n");
+   st->wpt_sect = open;
+}
+
+
+static void stream_wpt(stream_t *st, const fsh_wpt01_t *wpt)
+{
+   if (st->fmt == FMT_GPX)
+      output_gpx_wpt(st->out, &wpt->wpd, st->el, FSH_BLK_WPT);
+   else if (st->fmt == FMT_GEOJSONSEQ)
+      geojson_wpt(st->out, wpt, st->el);
+   else
+   {
+      stream_wpt_sect(st, 1);
+      output_wpt(st->out, &wpt->wpd, st->el, wpt->guid);
+   }
+}
+
+
+static void stream_track(stream_t *st, const track_t *trk)
+{
+   if (st->fmt == FMT_GPX)
+      track_output_gpx0(st->out, trk, st->el, &st->ts.buf);
+   else if (st->fmt == FMT_GEOJSONSEQ)
+      geojson_track0(st->out, trk, st->el, &st->ts.buf);
+   else
+   {
+      // like track_output() the state is carried over from the previous
+      // track, which is the previous one in the order of completion
+      stream_wpt_sect(st, 0);
+      track_output0(st->out, trk, st->el, &st->ts);
+   }
+}
+
+
+static void stream_route(stream_t *st, const route21_t *rte)
+{
+   if (st->fmt == FMT_GPX)
+      route_output_gpx0(st->out, rte, st->el);
+   else if (st->fmt == FMT_GEOJSONSEQ)
+      geojson_route0(st->out, rte, st->el);
+   else
+   {
+      stream_wpt_sect(st, 0);
+      route_output0(st->out, rte, st->el);
+   }
+}
+
+
+/*! Log the reduction of the track points by the simplification. */
+static void simpl_log(const fsh_simplify_t *sp)
+{
+   if (sp->tol > 0 && sp->pts)
+      vlog("simplified %ld track points to %ld (%.1f%%)\n", sp->pts, sp->kept, 100.0 * sp->kept / sp->pts);
+}
+
+
+/*! Return 1 if the input fd is a snapshot, otherwise 0. Only regular files
+ * are checked because this does not change the file offset.
+ */
+static int is_snapshot(int fd)
+{
+   char magic[sizeof(FSH_SNAP_MAGIC)];
+   struct stat st;
+
+   return fstat(fd, &st) != -1 && S_ISREG(st.st_mode) && pread(fd, magic, sizeof(magic), 0) == sizeof(magic)
+      && !memcmp(magic, FSH_SNAP_MAGIC, sizeof(magic));
+}
+
+
+/*! Convert the FSH file on fd in streaming mode. The items are written as
+ * soon as fsh_stream_next() returns them, see there. The file is read
+ * sequentially without seeking, hence it may be a pipe.
+ */
+static void stream_convert(int fd, obuf_t *out, int fmt, const ellipsoid_t *el, fsh_simplify_t *sp, const fsh_filter_t *flt)
+{
+   fsh_stream_t fs;
+   fsh_item_t item;
+   stream_t st;
+   int err;
+
+   memset(&st, 0, sizeof(st));
+   st.out = out;
+   st.fmt = fmt;
+   st.el = el;
+
+   if ((err = fsh_stream_open(&fs, fd)) < 0)
+   {
+      // regular files are checked before, see is_snapshot()
+      if (err == FSH_ERR_SNAP)
+         fprintf(stderr, "# snapshots cannot be streamed from a pipe, omit -S\n"), exit(EXIT_FAILURE);
+      fprintf(stderr, "# %s\n", fsh_strerror(err)), exit(EXIT_FAILURE);
+   }
+   fsh_stream_set_filter(&fs, flt);
+   if (sp->tol > 0)
+      fsh_stream_set_simplify(&fs, sp);
+
+   if (fmt == FMT_GPX)
+      gpx_start(out);
+   // the waypoints come first like in the normal mode
+   stream_wpt_sect(&st, 1);
+
+   while ((err = fsh_stream_next(&fs, &item)) > 0)
+   {
+      switch (err)
+      {
+         case FSH_BLK_WPT:
+            stream_wpt(&st, item.wpt);
+            break;
+         case FSH_BLK_MTA:
+            stream_track(&st, &item.trk);
+            break;
+         case FSH_BLK_RTE:
+            stream_route(&st, &item.rte);
+            break;
+      }
+      first_byte(out);
+      // pass on the items of this FLOB before reading the next one
+      if (fsh_stream_flob_done(&fs))
+         ob_flush(out);
+   }
+   if (err < 0)
+      fprintf(stderr, "# %s\n", fsh_strerror(err)), exit(EXIT_FAILURE);
+
+   stream_wpt_sect(&st, 0);
+   free(st.ts.buf);
+
+   if (fmt == FMT_GPX)
+      gpx_end(out);
 
+   vlog("max. pending track blocks = %d\n", fs.max_pending);
+   vlog("arena: %ld allocations in %ld chunks, %ld kB\n", fs.arena.allocs, fs.arena.chunks, (long) (fs.arena.size / 1024));
+   fsh_stream_close(&fs);
+   simpl_log(sp);
+}
+
+
+/*! Write the document header of the output format fmt. */
+static void doc_start(obuf_t *out, int fmt)
+{
+   switch (fmt)
+   {
+      case FMT_OSM:
+         osm_start(out);
+         break;
       case FMT_GPX:
          gpx_start(out);
-         wpt_01_output_gpx_nodes(out, blk, &el);
-         track_output_gpx(out, trk, trk_cnt, &el);
-         route_output_gpx_ways(out, rte, rte_cnt, &el);
-         gpx_end(out);
+         break;
+      case FMT_ARROW:
+         ar_schema(out, ar_field_, AC_CNT);
+         break;
+      case FMT_PBF:
+         pbf_header(out);
+         break;
+      case FMT_STATS:
+         stats_header(out);
          break;
    }
+}
+
+
+/*! Write the document trailer of the output format fmt. */
+static void doc_end(obuf_t *out, int fmt)
+{
+   switch (fmt)
+   {
+      case FMT_OSM:
+         osm_end(out);
+         break;
+      case FMT_GPX:
+         gpx_end(out);
+         break;
+      case FMT_ARROW:
+         ar_eos(out);
+         break;
+   }
+}
+
+
+/*! Convert all items of the decoded archive ctx into the output format fmt
+ * without the document header and trailer.
+ * @param path Name of the input file, "-" for stdin.
+ */
+static void convert(obuf_t *out, const fsh_ctx_t *ctx, int fmt, const ellipsoid_t *el, const char *path)
+{
+   int *trk_ids, *rte_ids;
+
+   switch (fmt)
+   {
+      default:
+      case FMT_OSM:
+         wpt_01_output_osm_nodes(out, ctx, el);
+         first_byte(out);
+         track_output_osm_nodes(out, ctx, el, &trk_ids);
+         route_output_osm_nodes(out, ctx, el, &rte_ids);
+         track_output_osm_ways(out, ctx, trk_ids);
+         route_output_osm_ways(out, ctx, rte_ids);
+         free(trk_ids);
+         free(rte_ids);
+         break;
+
+      case FMT_CSV:
+         wpt_01_output(out, ctx, el);
+         first_byte(out);
+         track_output(out, ctx, el);
+         route_output(out, ctx, el);
+         break;
+
+      case FMT_GPX:
+         wpt_01_output_gpx_nodes(out, ctx, el);
+         first_byte(out);
+         track_output_gpx(out, ctx, el);
+         route_output_gpx_ways(out, ctx, el);
+         break;
+
+      case FMT_ARROW:
+         arrow_output(out, ctx, el);
+         first_byte(out);
+         break;
+
+      case FMT_PBF:
+         pbf_output(out, ctx, el);
+         first_byte(out);
+         break;
+
+      case FMT_GEOJSONSEQ:
+         geojson_wpt_output(out, ctx, el);
+         first_byte(out);
+         geojson_track_output(out, ctx, el);
+         geojson_route_output(out, ctx, el);
+         break;
+
+      case FMT_STATS:
+      case FMT_STATSJSON:
+         stats_output(out, ctx, el, fmt, path);
+         first_byte(out);
+         break;
+   }
+}
+
+
+// number of items of an archive
+struct item_cnt
+{
+   long wpt, trk, trkpt, rte, rtept;
+};
+
+
+/*! Count the items of the decoded archive ctx as they are written by
+ * convert().
+ */
+static void item_count(const fsh_ctx_t *ctx, struct item_cnt *ic)
+{
+   fsh_cursor_t cur;
+   const fsh_wpt01_t *wpt;
+   track_t trk;
+   route21_t rte;
+   int i, k;
+
+   memset(ic, 0, sizeof(*ic));
+
+   fsh_cursor_init(&cur, ctx);
+   while (fsh_next_wpt(&cur, &wpt) > 0)
+      ic->wpt++;
+
+   fsh_cursor_init(&cur, ctx);
+   while (next_track(&cur, &trk))
+   {
+      ic->trk++;
+      for (k = 0; k < trk.mta->guid_cnt; k++)
+         for (i = 0; trk.tseg[k].hdr != NULL && i < trk.tseg[k].hdr->cnt; i++)
+            if (trk.tseg[k].pt[i].c != -1)
+               ic->trkpt++;
+   }
+   fsh_cursor_free(&cur);
+
+   fsh_cursor_init(&cur, ctx);
+   while (fsh_next_route(&cur, &rte) > 0)
+   {
+      ic->rte++;
+      ic->rtept += rte.hdr3->wpt_cnt;
+   }
+}
+
+
+/*! Return the number of OSM IDs which are used by convert(). Each track and
+ * route uses 3 IDs (2 while writing its nodes and 1 for its way) in addition
+ * to its nodes.
+ */
+static long osm_id_count(const struct item_cnt *ic)
+{
+   return ic->wpt + ic->trk * 3 + ic->trkpt + ic->rte * 3 + ic->rtept;
+}
+
+
+// state of a batch conversion shared by all workers
+typedef struct batch
+{
+   char **path;         //!< list of input files
+   int cnt;             //!< number of input files
+   int next;            //!< next input file to be converted
+   int fmt;             //!< output format
+   int ctx_flags;       //!< flags for fsh_ctx_open_fd()
+   int zmethod;         //!< compression method of the output files, see ob_compress()
+   int zlevel;          //!< compression level
+   const ellipsoid_t *el;
+   const char *outdir;  //!< output directory or NULL for combined output
+   fsh_simplify_t sp;   //!< track simplification and total point counts
+   const fsh_filter_t *flt;   //!< filter or NULL
+   int direct;          //!< 1 if files are written to out directly (only one worker)
+
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   obuf_t *out;         //!< combined output
+   int *tmp;            //!< file descriptors of converted files waiting for output
+   int next_out;        //!< next file to be written to the combined output
+   long *ids;           //!< number of OSM IDs of each file, -1 if unknown yet
+   long *id_base;       //!< OSM ID counter to start each file with
+   int ids_known;       //!< number of leading files with known IDs
+   long id_next;        //!< OSM ID counter to start file ids_known with
+
+   long long bytes;     //!< total number of input bytes
+   struct item_cnt ic;  //!< total number of items
+   int failed;          //!< number of failed files
+} batch_t;
+
+
+/*! Publish the number of OSM IDs used by file k and wait until the IDs of all
+ * previous files are known. The files are taken in ascending order by the
+ * workers, thus this does not deadlock. This makes the IDs of a combined OSM
+ * output unique.
+ * @return Returns the OSM ID counter to start file k with.
+ */
+static long batch_id_base(batch_t *b, int k, long ids)
+{
+   long base;
+
+   pthread_mutex_lock(&b->mutex);
+   b->ids[k] = ids;
+   for (; b->ids_known < b->cnt && b->ids[b->ids_known] != -1; b->ids_known++)
+   {
+      b->id_base[b->ids_known] = b->id_next;
+      b->id_next -= b->ids[b->ids_known];
+   }
+   pthread_cond_broadcast(&b->cond);
+   while (b->ids_known <= k)
+      pthread_cond_wait(&b->cond, &b->mutex);
+   base = b->id_base[k];
+   pthread_mutex_unlock(&b->mutex);
+
+   return base;
+}
+
+
+/*! Mark file k as done. Its converted output, which is kept in the temporary
+ * file fd (or -1 if there is none), and all following files which are done
+ * already are appended to the combined output in input order.
+ */
+static void batch_commit(batch_t *b, int k, int fd)
+{
+   char buf[FLOB_SIZE];
+   ssize_t len;
+
+   pthread_mutex_lock(&b->mutex);
+   b->tmp[k] = fd;
+   for (; b->next_out < b->cnt && b->tmp[b->next_out] != -2; b->next_out++)
+   {
+      if ((fd = b->tmp[b->next_out]) == -1)
+         continue;
+
+      if (lseek(fd, 0, SEEK_SET) == -1)
+         perror("lseek"), exit(EXIT_FAILURE);
+      while ((len = read(fd, buf, sizeof(buf))) > 0)
+         ob_write(b->out, buf, len);
+      if (len == -1)
+         perror("read"), exit(EXIT_FAILURE);
+      close(fd);
+   }
+   pthread_mutex_unlock(&b->mutex);
+}
+
+
+/*! Create the output file for the input file path in the output directory.
+ * Slashes of the path are replaced by '_' because inputs of different
+ * directories usually have the same name.
+ * @return Returns the file descriptor or -1 on error.
+ */
+static int batch_open_out(const batch_t *b, const char *path)
+{
+   char name[PATH_MAX], *s;
+   int fd;
+
+   for (;;)
+   {
+      if (path[0] == '/')
+         path++;
+      else if (path[0] == '.' && path[1] == '/')
+         path += 2;
+      else
+         break;
+   }
+   snprintf(name, sizeof(name), "%s/", b->outdir);
+   for (s = name + strlen(name); *path && s < name + sizeof(name) - 16; path++, s++)
+      *s = *path == '/' ? '_' : *path;
+   snprintf(s, 16, ".%s%s", fmt_ext_[b->fmt], z_ext_[b->zmethod]);
+
+   if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+      fprintf(stderr, "# cannot create %s: %s\n", name, strerror(errno));
+   return fd;
+}
+
+
+/*! Convert input file number k of the batch.
+ * @return Returns 0 on success or -1 on error.
+ */
+static int batch_file(batch_t *b, int k)
+{
+   fsh_ctx_t *ctx = NULL;
+   fsh_simplify_t sp;
+   struct item_cnt ic;
+   FILE *tmp;
+   obuf_t *out;
+   char *path = b->path[k];
+   int fd, err;
+
+   memset(&ic, 0, sizeof(ic));
+   // only the settings are copied, the totals of b->sp are updated by the
+   // other workers
+   memset(&sp, 0, sizeof(sp));
+   sp.el = b->sp.el;
+   sp.tol = b->sp.tol;
+   sp.dtol = b->sp.dtol;
+   if ((fd = open(path, O_RDONLY)) == -1)
+      err = FSH_ERR_IO;
+   else
+   {
+      err = fsh_ctx_open_fd(&ctx, fd, b->ctx_flags);
+      close(fd);
+      if (!err)
+         fsh_ctx_set_filter(ctx, b->flt);
+      if (!err && ((err = fsh_ctx_decode(ctx, 1)) < 0 || (sp.tol > 0 && (err = fsh_ctx_simplify(ctx, &sp)) < 0)))
+         fsh_ctx_close(ctx);
+      else if (err >= 0)
+         fsh_snap_projection(ctx, b->el);
+   }
+
+   if (err < 0)
+      fprintf(stderr, "# %s: %s\n", path, err == FSH_ERR_IO ? strerror(errno) : fsh_strerror(err));
+   else
+      item_count(ctx, &ic);
+
+   osm_id_ = 0;
+   if (b->outdir == NULL && (b->fmt == FMT_OSM || b->fmt == FMT_PBF))
+      osm_id_ = batch_id_base(b, k, osm_id_count(&ic));
+
+   fd = -1;
+   if (err >= 0)
+   {
+      if (b->outdir != NULL)
+         fd = batch_open_out(b, path);
+      else if (b->direct)
+         fd = b->out->fd;
+      else
+      {
+         if ((tmp = tmpfile()) == NULL || (fd = dup(fileno(tmp))) == -1)
+            perror("tmpfile"), exit(EXIT_FAILURE);
+         fclose(tmp);
+      }
+   }
+
+   if (fd != -1)
+   {
+      out = b->direct ? b->out : ob_open(fd, OBUF_SIZE);
+      // the files are converted concurrently already, thus each one is
+      // compressed by its worker
+      if (b->outdir != NULL && b->zmethod != OB_PLAIN)
+         ob_compress(out, b->zmethod, b->zlevel, 0);
+      // Arrow, GeoJSON sequences, and PBF have no comments, the records of
+      // all files are simply concatenated
+      if (b->outdir != NULL)
+         doc_start(out, b->fmt);
+      else if (b->fmt == FMT_CSV)
+         ob_printf(out, "# ----- BEGIN FILE %s -----\n", path);
+      else if (b->fmt == FMT_OSM || b->fmt == FMT_GPX)
+         ob_printf(out, "<!-- BEGIN FILE %s -->\n", path);
+
+      convert(out, ctx, b->fmt, b->el, path);
+
+      if (b->outdir != NULL)
+         doc_end(out, b->fmt);
+      else if (b->fmt == FMT_CSV)
+         ob_printf(out, "# ----- END FILE %s -----\n", path);
+      else if (b->fmt == FMT_OSM || b->fmt == FMT_GPX)
+         ob_printf(out, "<!-- END FILE %s -->\n", path);
+      if (!b->direct)
+         ob_close(out);
+   }
+
+   pthread_mutex_lock(&b->mutex);
+   if (fd == -1)
+      b->failed++;
+   else
+   {
+      b->bytes += ctx->size;
+      b->ic.wpt += ic.wpt;
+      b->ic.trk += ic.trk;
+      b->ic.trkpt += ic.trkpt;
+      b->ic.rte += ic.rte;
+      b->ic.rtept += ic.rtept;
+      b->sp.pts += sp.pts;
+      b->sp.kept += sp.kept;
+   }
+   pthread_mutex_unlock(&b->mutex);
+
+   if (err >= 0)
+      fsh_ctx_close(ctx);
+
+   if (b->outdir != NULL)
+   {
+      if (fd != -1)
+         close(fd);
+   }
+   else if (!b->direct)
+      batch_commit(b, k, fd);
+
+   return fd == -1 ? -1 : 0;
+}
+
+
+static void *batch_worker(void *p)
+{
+   batch_t *b = p;
+   int k;
+
+   while ((k = __sync_fetch_and_add(&b->next, 1)) < b->cnt)
+      batch_file(b, k);
+
+   return NULL;
+}
+
+
+static int cmp_str(const void *a, const void *b)
+{
+   return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+
+/*! Append the input path to the list of input files. Directories are
+ * scanned for files with the extension ".fsh" (case-insensitive) which are
+ * added in alphabetical order.
+ * @return Returns the new number of files.
+ */
+static int batch_add(char ***list, int cnt, const char *path)
+{
+   struct dirent *de;
+   struct stat st;
+   DIR *dir;
+   char *s;
+   int n, len;
+
+   if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode) || (dir = opendir(path)) == NULL)
+   {
+      if ((*list = realloc(*list, sizeof(**list) * (cnt + 1))) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+      if (((*list)[cnt] = strdup(path)) == NULL)
+         perror("strdup"), exit(EXIT_FAILURE);
+      return cnt + 1;
+   }
+
+   for (n = cnt; (de = readdir(dir)) != NULL; )
+   {
+      if ((len = strlen(de->d_name)) < 4 || strcasecmp(de->d_name + len - 4, ".fsh"))
+         continue;
+      if ((s = malloc(strlen(path) + len + 2)) == NULL)
+         perror("malloc"), exit(EXIT_FAILURE);
+      sprintf(s, "%s/%s", path, de->d_name);
+      if (stat(s, &st) == -1 || !S_ISREG(st.st_mode))
+      {
+         free(s);
+         continue;
+      }
+      if ((*list = realloc(*list, sizeof(**list) * (n + 1))) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+      (*list)[n++] = s;
+   }
+   closedir(dir);
+
+   qsort(*list + cnt, n - cnt, sizeof(**list), cmp_str);
+   return n;
+}
+
+
+/*! Convert many files concurrently on nthreads worker threads. Every worker
+ * takes the next unconverted file of the list, thus workers which finish
+ * early just pick up more files. The output is either written to one file
+ * per input within outdir or to out, in the order of the input files and
+ * tagged with their path.
+ * @return Returns the number of files which failed.
+ */
+static int batch_convert(char **path, int cnt, int nthreads, const char *outdir, obuf_t *out, int fmt, int ctx_flags, int zmethod, int zlevel, const ellipsoid_t *el, const fsh_simplify_t *sp, const fsh_filter_t *flt)
+{
+   struct timespec t0, t1;
+   struct rusage ru;
+   pthread_t *th;
+   batch_t b;
+   double t;
+   int i;
+
+   memset(&b, 0, sizeof(b));
+   b.path = path;
+   b.cnt = cnt;
+   b.fmt = fmt;
+   b.ctx_flags = ctx_flags;
+   b.zmethod = zmethod;
+   b.zlevel = zlevel;
+   b.el = el;
+   b.sp = *sp;
+   b.flt = flt;
+   b.outdir = outdir;
+   b.out = out;
+   pthread_mutex_init(&b.mutex, NULL);
+   pthread_cond_init(&b.cond, NULL);
+   if ((b.tmp = malloc(sizeof(*b.tmp) * cnt)) == NULL || (b.ids = malloc(sizeof(*b.ids) * cnt)) == NULL
+         || (b.id_base = malloc(sizeof(*b.id_base) * cnt)) == NULL)
+      perror("malloc"), exit(EXIT_FAILURE);
+   for (i = 0; i < cnt; i++)
+   {
+      b.tmp[i] = -2;
+      b.ids[i] = -1;
+   }
+   if (nthreads > cnt)
+      nthreads = cnt;
+   // a single worker converts the files in order anyway
+   b.direct = outdir == NULL && nthreads == 1;
+   if ((th = malloc(sizeof(*th) * nthreads)) == NULL)
+      perror("malloc"), exit(EXIT_FAILURE);
+
+   vlog("converting %d files on %d threads\n", cnt, nthreads);
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+
+   if (outdir == NULL)
+      doc_start(out, fmt);
+
+   for (i = 0; i < nthreads; i++)
+      if ((errno = pthread_create(&th[i], NULL, batch_worker, &b)))
+         perror("pthread_create"), exit(EXIT_FAILURE);
+   for (i = 0; i < nthreads; i++)
+      pthread_join(th[i], NULL);
+
+   if (outdir == NULL)
+      doc_end(out, fmt);
+   ob_flush(out);
+
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   t = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1E9;
+   if (getrusage(RUSAGE_SELF, &ru) == -1)
+      ru.ru_maxrss = 0;
+   // the summary is written also with -q, bench.sh parses it
+   fprintf(stderr, "# files = %d, failed = %d, bytes = %lld, waypoints = %ld, tracks = %ld, "
+         "trackpoints = %ld, routes = %ld, routepoints = %ld, time = %.3f s, %.1f files/s, %.2f MB/s, "
+         "%.0f points/s, peak RSS = %ld kB\n",
+         cnt, b.failed, b.bytes, b.ic.wpt, b.ic.trk, b.ic.trkpt, b.ic.rte, b.ic.rtept, t,
+         cnt / t, b.bytes / t / 1E6, (b.ic.wpt + b.ic.trkpt + b.ic.rtept) / t, ru.ru_maxrss);
+   simpl_log(&b.sp);
+
+   pthread_cond_destroy(&b.cond);
+   pthread_mutex_destroy(&b.mutex);
+   free(th);
+   free(b.id_base);
+   free(b.ids);
+   free(b.tmp);
+   return b.failed;
+}
+
+
+/*! Open the output cache in the directory dir. All settings which change
+ * the output of an item are encoded in the name of the cache file.
+ */
+static void out_cache_open(const char *dir, int fmt, const ellipsoid_t *el)
+{
+   char name[64];
+   uint64_t h;
+
+   // OSM IDs and Arrow record batches span several items
+   if (fmt != FMT_CSV && fmt != FMT_GPX && fmt != FMT_GEOJSONSEQ)
+   {
+      vlog("cache not supported for %s output\n", fmt_ext_[fmt]);
+      return;
+   }
+
+   h = cache_hash(fmt, &el->a, sizeof(el->a));
+   h = cache_hash(h, &el->b, sizeof(el->b));
+   h = cache_hash(h, &el->merc_inv, sizeof(el->merc_inv));
+   snprintf(name, sizeof(name), "parsefsh-%s-%016llx", fmt_ext_[fmt], (unsigned long long) h);
+   if ((cache_ = cache_open(dir, name)) == NULL)
+      perror(dir), exit(EXIT_FAILURE);
+}
+
+
+/*! Log the hit rate of the output cache and write it. */
+static void out_cache_close(void)
+{
+   long cnt;
+
+   if (cache_ == NULL)
+      return;
+
+   cnt = cache_->hits + cache_->misses;
+   vlog("cache: %ld of %ld items hit (%.1f%%), %lld bytes reused\n",
+         cache_->hits, cnt, cnt ? 100.0 * cache_->hits / cnt : 0.0, cache_->hit_bytes);
+   if (cache_close(cache_) == -1)
+      vlog("cannot write cache: %s\n", strerror(errno));
+   cache_ = NULL;
+}
+
+
+/*! Flush and free the output buffer and log the compression ratio. */
+static void out_close(obuf_t *out)
+{
+   ob_flush(out);
+   if (out->z != NULL && out->raw)
+      vlog("compressed %lld bytes to %lld bytes (%.1f%%)\n", out->raw, out->total, 100.0 * out->total / out->raw);
+   ob_close(out);
+}
+
+
+/*! Open and decode the input file path for gridding, "-" is stdin.
+ * @return Returns the decoded context or NULL on error.
+ */
+static fsh_ctx_t *grid_open(const char *path, int ctx_flags, int nthreads, const fsh_filter_t *flt)
+{
+   fsh_ctx_t *ctx = NULL;
+   int fd, err;
+
+   if ((fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO) == -1)
+      err = FSH_ERR_IO;
+   else
+   {
+      err = fsh_ctx_open_fd(&ctx, fd, ctx_flags);
+      if (fd != STDIN_FILENO)
+         close(fd);
+      if (!err)
+      {
+         fsh_ctx_set_filter(ctx, flt);
+         if ((err = fsh_ctx_decode(ctx, nthreads)) < 0)
+            fsh_ctx_close(ctx);
+      }
+   }
+
+   if (err < 0)
+   {
+      fprintf(stderr, "# %s: %s\n", path, err == FSH_ERR_IO ? strerror(errno) : fsh_strerror(err));
+      return NULL;
+   }
+   return ctx;
+}
+
+
+/*! Write the header of an ESRI ASCII grid, which is also the header file of
+ * a float grid.
+ */
+static void grid_header(obuf_t *out, const fsh_grid_t *g)
+{
+   ob_printf(out, "ncols %d\nnrows %d\nxllcorner %.3f\nyllcorner %.3f\ncellsize %.6f\nNODATA_value %d\n",
+         g->ncols, g->nrows, g->x0, g->y0, g->size, GRID_NODATA);
+}
+
+
+/*! Write the statistic stat of all cells of the grid as ESRI ASCII grid. */
+static void grid_output_asc(obuf_t *out, const fsh_grid_t *g, int stat)
+{
+   const fsh_grid_cell_t *c = g->cell;
+   double v;
+   char *p;
+   int i, j;
+
+   grid_header(out, g);
+   for (j = 0; j < g->nrows; j++)
+   {
+      for (i = 0; i < g->ncols; i++, c++)
+      {
+         p = ob_reserve(out, 32);
+         if (i)
+            *p++ = ' ';
+         if (isnan(v = fsh_grid_value(c, stat)))
+            p = fmt_int(p, GRID_NODATA);
+         else
+            p = fmt_dbl(p, v, stat == FSH_GRID_COUNT ? 0 : stat == FSH_GRID_VAR ? 4 : 2);
+         ob_commit(out, p);
+      }
+      ob_write(out, "\n", 1);
+   }
+}
+
+
+/*! Write the statistic stat of all cells of the grid as raw 32 bit floats
+ * in the byte order of the machine (little endian, see check_endian()).
+ */
+static void grid_output_flt(obuf_t *out, const fsh_grid_t *g, int stat)
+{
+   const fsh_grid_cell_t *c = g->cell;
+   float *row;
+   double v;
+   int i, j;
+
+   if ((row = malloc(sizeof(*row) * g->ncols)) == NULL)
+      perror("malloc"), exit(EXIT_FAILURE);
+   for (j = 0; j < g->nrows; j++)
+   {
+      for (i = 0; i < g->ncols; i++, c++)
+         row[i] = isnan(v = fsh_grid_value(c, stat)) ? GRID_NODATA : v;
+      ob_write(out, row, sizeof(*row) * g->ncols);
+   }
+   free(row);
+}
+
+
+/*! Create the file depth_<stat>.<ext> in the directory outdir.
+ * @return Returns the output buffer of the file. Its file descriptor has to
+ * be closed after ob_close().
+ */
+static obuf_t *grid_create(const char *outdir, const char *stat, const char *ext)
+{
+   char name[PATH_MAX];
+   int fd;
+
+   snprintf(name, sizeof(name), "%s/depth_%s.%s", outdir, stat, ext);
+   if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+      perror(name), exit(EXIT_FAILURE);
+   return ob_open(fd, OBUF_SIZE);
+}
+
+
+static void grid_close(obuf_t *out)
+{
+   int fd = out->fd;
+
+   if (ob_close(out) == -1 || close(fd) == -1)
+      perror("grid output"), exit(EXIT_FAILURE);
+}
+
+
+/*! Write all statistics of the grid into the directory outdir, each one as
+ * depth_<stat>.asc or as depth_<stat>.flt together with its header file
+ * depth_<stat>.hdr, and with the projection file depth_<stat>.prj.
+ */
+static void grid_write(const fsh_grid_t *g, const char *outdir, int fmt)
+{
+   obuf_t *out;
+   int i;
+
+   for (i = 0; i < FSH_GRID_STATS; i++)
+   {
+      out = grid_create(outdir, grid_stat_[i], fmt_ext_[fmt]);
+      if (fmt == FMT_ASC)
+         grid_output_asc(out, g, i);
+      else
+         grid_output_flt(out, g, i);
+      grid_close(out);
+
+      if (fmt == FMT_FLT)
+      {
+         out = grid_create(outdir, grid_stat_[i], "hdr");
+         grid_header(out, g);
+         ob_puts(out, "byteorder LSBFIRST\n");
+         grid_close(out);
+      }
+
+      out = grid_create(outdir, grid_stat_[i], "prj");
+      ob_puts(out, GRID_PRJ "\n");
+      grid_close(out);
+   }
+}
+
+
+/*! Grid the soundings of all input files into one grid of cells of size
+ * metres. Unless the extent is given by the bounding box bbox (degrees), the
+ * extent of all soundings is determined in a first pass over the files. The
+ * files are decoded one after the other and released again, thus the memory
+ * is bound by the largest file and the number of cells. Stdin ("-") is read
+ * only once and kept for both passes.
+ * @param outdir Directory which receives all statistics, or NULL to write
+ * the statistic stat to out (ASCII grid only).
+ * @return Returns 0 on success or -1 if any of the files failed.
+ */
+static int grid_convert(char **path, int cnt, int nthreads, const char *outdir, obuf_t *out, int fmt, int ctx_flags, const ellipsoid_t *el, fsh_simplify_t *sp, const fsh_filter_t *flt, const double *bbox, double size, int stat)
+{
+   double ext[4] = {HUGE_VAL, HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+   fsh_ctx_t *ctx = NULL;
+   fsh_grid_t g;
+   char *failed;
+   int i, err, nfail = 0;
+
+   if ((failed = calloc(cnt, 1)) == NULL)
+      perror("calloc"), exit(EXIT_FAILURE);
+
+   if (bbox != NULL)
+      fsh_grid_bbox(el, bbox[0], bbox[1], bbox[2], bbox[3], ext);
+   else
+      for (i = 0; i < cnt; i++)
+      {
+         if ((ctx = grid_open(path[i], ctx_flags, nthreads, flt)) == NULL)
+         {
+            failed[i] = 1;
+            continue;
+         }
+         if ((err = fsh_grid_extent(ctx, el, ext)) < 0)
+         {
+            fprintf(stderr, "# %s: %s\n", path[i], fsh_strerror(err));
+            failed[i] = 1;
+         }
+         // stdin cannot be read again
+         if (strcmp(path[i], "-") || failed[i])
+         {
+            fsh_ctx_close(ctx);
+            ctx = NULL;
+         }
+      }
+
+   if (ext[0] > ext[2] || ext[1] > ext[3])
+   {
+      fprintf(stderr, "# no soundings found\n");
+      free(failed);
+      return -1;
+   }
+   if ((err = fsh_grid_init(&g, el, ext, size)) < 0)
+      fprintf(stderr, "# grid of %g m cells too large: %s\n", size, fsh_strerror(err)), exit(EXIT_FAILURE);
+   vlog("grid of %d x %d cells of %g m (%.3f m Mercator)\n", g.ncols, g.nrows, size, g.size);
+
+   for (i = 0; i < cnt; i++)
+   {
+      if (failed[i] || (ctx == NULL && (ctx = grid_open(path[i], ctx_flags, nthreads, flt)) == NULL))
+      {
+         nfail++;
+         continue;
+      }
+      if ((sp->tol > 0 && (err = fsh_ctx_simplify(ctx, sp)) < 0) || (err = fsh_grid_ctx(&g, ctx, el)) < 0)
+      {
+         fprintf(stderr, "# %s: %s\n", path[i], fsh_strerror(err));
+         nfail++;
+      }
+      fsh_ctx_close(ctx);
+      ctx = NULL;
+   }
+   free(failed);
+
+   if (sp->tol > 0)
+      simpl_log(sp);
+   vlog("%ld soundings gridded, %ld outside of the grid, %d of %d files failed\n", g.pts, g.outside, nfail, cnt);
+
+   if (outdir != NULL)
+      grid_write(&g, outdir, fmt);
+   else
+      grid_output_asc(out, &g, stat);
+   fsh_grid_free(&g);
+
+   return nfail ? -1 : 0;
+}
+
+
+static void check_endian(void)
+{
+   int c = 1;
+
+   if (!*((char*) &c))
+      fprintf(stderr, "# parsefsh currently only works on little endian machines (such as Intel)\n"),
+         exit(EXIT_FAILURE);
+}
+
+
+static void usage(const char *s)
+{
+   printf(
+         "%s\n"
+         "usage: %s [OPTIONS] [FILE|DIR ...]\n"
+         "   -b <s>,<w>,<n>,<e>\n"
+         "                    Output only items within this bounding box (degrees).\n"
+         "                    Track segments without points within are dropped.\n"
+         "   -c ............. Output CSV format instead of OSM.\n"
+         "   -C <dir> ....... Cache the output of each item in <dir> and reuse it if\n"
+         "                    the item is unchanged (CSV, GeoJSON, and GPX only).\n"
+         "   -f <format> .... Define output format. Available formats: arrow, csv,\n"
+         "                    geojsonseq, gpx, osm, pbf (OSM binary format), stats\n"
+         "                    (statistics of the tracks as table), statsjson (as\n"
+         "                    JSON, one track per line), asc (ESRI ASCII grid of the\n"
+         "                    depths), flt (float grid, -o).\n"
+         "   -g <m>[:<stat>]  Cell size of the grid output (default 10 m) and the\n"
+         "                    statistic written to stdout: count, mean (default),\n"
+         "                    min, max, or var. With -o all are written to <dir>.\n"
+         "   -h ............. This help.\n"
+         "   -j <n> ......... Decode FLOBs in parallel on <n> threads. In batch mode\n"
+         "                    convert <n> files concurrently.\n"
+         "   -m <n> ......... Output only tracks with at least <n> points.\n"
+         "   -n <regex> ..... Output only items of which the name matches the extended\n"
+         "                    regular expression <regex>.\n"
+         "   -o <dir> ....... Batch mode: write one output file per input into <dir>\n"
+         "                    instead of a combined output to stdout.\n"
+         "   -p <method> .... Reverse Mercator method: iterate (default), series,\n"
+         "                    or check to compare both methods.\n"
+         "   -q ............. Quiet. No informational output except the summary of\n"
+         "                    the batch mode.\n"
+         "   -r ............. Use read() instead of mmap() to read the input.\n"
+         "   -s <m>[:<m>] ... Simplify tracks with Douglas-Peucker. Points are kept if\n"
+         "                    they deviate more than <m> metres horizontally or more\n"
+         "                    than the depth tolerance (default <m>/10) in depth.\n"
+         "   -S ............. Streaming mode. Write items as soon as they are decoded\n"
+         "                    (CSV, GeoJSON, and GPX only).\n"
+         "   -w <file> ...... Write a snapshot of the decoded input to <file> instead\n"
+         "                    of converting it. Snapshots are read like archives.\n"
+         "   -z <method>[:<level>]\n"
+         "                    Compress the output with gzip (default level 6) or zstd\n"
+         "                    (default level 3) on all CPU cores.\n"
+         "If FILEs or DIRs are given they are converted in batch mode, directories are\n"
+         "scanned for *.fsh files. Otherwise the input is read from stdin.\n",
+         COPYLEFT, s);
+}
+
+
+int main(int argc, char **argv)
+{
+   fsh_ctx_t *ctx;
+   ellipsoid_t el = WGS84;
+   fsh_simplify_t sp;
+   fsh_filter_t flt, *fltp = NULL;
+   regex_t re;
+   double bbox[4];
+   char ebuf[256];
+   int fd = 0, fmt_out = FMT_OSM, ctx_flags = 0;
+   int zmethod = OB_PLAIN, zlevel = 0, zmin, zmax;
+   int nthreads = 1, stream = 0, merc_check = 0;
+   char **path = NULL, *outdir = NULL, *cachedir = NULL, *snapfile = NULL, *s;
+   int path_cnt = 0;
+   double dev, grid_size = 10;
+   int grid_stat = FSH_GRID_MEAN;
+   obuf_t *out;
+   int c, err;
+
+   memset(&sp, 0, sizeof(sp));
+   sp.el = &el;
+   memset(&flt, 0, sizeof(flt));
+   flt.el = &el;
+   while ((c = getopt(argc, argv, "b:cC:f:g:hj:m:n:o:p:qrs:Sw:z:")) != -1)
+      switch (c)
+      {
+         case 'b':
+            if (sscanf(optarg, "%lf,%lf,%lf,%lf", &bbox[0], &bbox[1], &bbox[2], &bbox[3]) != 4 || bbox[0] > bbox[2])
+               fprintf(stderr, "# illegal bounding box '%s'\n", optarg), exit(EXIT_FAILURE);
+            flt.bbox = 1;
+            break;
+
+         case 'c':
+            fmt_out = FMT_CSV;
+            break;
+
+         case 'C':
+            cachedir = optarg;
+            break;
+ 
+         case 'f':
+            if (!strcasecmp(optarg, "csv"))
+               fmt_out = FMT_CSV;
+            else if (!strcasecmp(optarg, "osm"))
+               fmt_out = FMT_OSM;
+            else if (!strcasecmp(optarg, "pbf"))
+               fmt_out = FMT_PBF;
+            else if (!strcasecmp(optarg, "gpx"))
+               fmt_out = FMT_GPX;
+            else if (!strcasecmp(optarg, "arrow"))
+               fmt_out = FMT_ARROW;
+            else if (!strcasecmp(optarg, "geojsonseq"))
+               fmt_out = FMT_GEOJSONSEQ;
+            else if (!strcasecmp(optarg, "stats"))
+               fmt_out = FMT_STATS;
+            else if (!strcasecmp(optarg, "statsjson"))
+               fmt_out = FMT_STATSJSON;
+            else if (!strcasecmp(optarg, "asc"))
+               fmt_out = FMT_ASC;
+            else if (!strcasecmp(optarg, "flt"))
+               fmt_out = FMT_FLT;
+            else
+               fprintf(stderr, "# unknown format '%s', defaults to OSM\n", optarg);
+            break;
+
+         case 'g':
+            if ((grid_size = strtod(optarg, &s)) <= 0 || (*s != '\0' && *s != ':'))
+               fprintf(stderr, "# illegal cell size '%s'\n", optarg), exit(EXIT_FAILURE);
+            if (*s == ':')
+            {
+               for (grid_stat = 0; grid_stat < FSH_GRID_STATS && strcasecmp(s + 1, grid_stat_[grid_stat]); grid_stat++);
+               if (grid_stat >= FSH_GRID_STATS)
+                  fprintf(stderr, "# unknown statistic '%s'\n", s + 1), exit(EXIT_FAILURE);
+            }
+            break;
+
+         case 'h':
+            usage(argv[0]);
+            return 0;
+
+         case 'j':
+            if ((nthreads = atoi(optarg)) < 1)
+               nthreads = 1;
+            break;
+
+         case 'm':
+            flt.min_pts = atoi(optarg);
+            break;
+
+         case 'n':
+            if ((err = regcomp(&re, optarg, REG_EXTENDED | REG_NOSUB)))
+            {
+               regerror(err, &re, ebuf, sizeof(ebuf));
+               fprintf(stderr, "# illegal pattern '%s': %s\n", optarg, ebuf), exit(EXIT_FAILURE);
+            }
+            flt.name = &re;
+            break;
+
+         case 'o':
+            outdir = optarg;
+            break;
+
+         case 'p':
+            if (!strcasecmp(optarg, "iterate"))
+               el.merc_inv = MERC_ITERATE;
+            else if (!strcasecmp(optarg, "series"))
+               el.merc_inv = MERC_SERIES;
+            else if (!strcasecmp(optarg, "check"))
+               merc_check = 1;
+            else
+               fprintf(stderr, "# unknown method '%s', defaults to iterate\n", optarg);
+            break;
+
+         case 'q':
+            if ((logout_ = fopen("/dev/null", "w")) == NULL)
+            {
+               logout_ = stderr;
+               vlog("warning: failed to open /dev/null: %s\n", strerror(errno));
+            }
+            break;
+
+         case 'r':
+            ctx_flags |= FSH_CTX_READ;
+            break;
+
+         case 's':
+            // the depth tolerance defaults to a tenth of the horizontal one
+            sp.tol = strtod(optarg, &s);
+            sp.dtol = sp.tol / 10;
+            if (s != optarg && *s == ':' && s[1] != '\0')
+               sp.dtol = strtod(s + 1, &s);
+            if (s == optarg || *s != '\0' || sp.tol < 0 || sp.dtol < 0)
+               fprintf(stderr, "# illegal tolerance '%s'\n", optarg), exit(EXIT_FAILURE);
+            break;
+
+         case 'S':
+            stream = 1;
+            break;
+
+         case 'w':
+            snapfile = optarg;
+            break;
+
+         case 'z':
+            if (!strncasecmp(optarg, "gzip", 4))
+               zmethod = OB_GZIP, zlevel = 6;
+            else if (!strncasecmp(optarg, "zstd", 4))
+               zmethod = OB_ZSTD, zlevel = 3;
+            else
+               fprintf(stderr, "# unknown compression '%s'\n", optarg), exit(EXIT_FAILURE);
+            s = optarg + 4;
+            if (*s == ':' && s[1] != '\0')
+               zlevel = strtol(s + 1, &s, 10);
+            if (*s != '\0')
+               fprintf(stderr, "# unknown compression '%s'\n", optarg), exit(EXIT_FAILURE);
+            if (ob_zlevels(zmethod, &zmin, &zmax) == -1)
+               fprintf(stderr, "# zstd not supported, recompile with HAVE_ZSTD\n"), exit(EXIT_FAILURE);
+            if (zlevel < zmin || zlevel > zmax)
+               fprintf(stderr, "# illegal compression level %d, must be %d to %d\n", zlevel, zmin, zmax), exit(EXIT_FAILURE);
+            break;
+     }
+
+   fsh_set_log(vlog);
+   vlog("%s\n", COPYLEFT);
+
+   check_endian();
+   init_ellipsoid(&el);
+
+   // the check prints its result directly, thus it returns before the output
+   // buffer and the compression threads are set up
+   if (merc_check)
+   {
+      dev = phi_merc_check(&el);
+      printf("max. deviation of series from iteration = %e rad, %s\n",
+            dev, dev <= IT_ACCURACY ? "ok" : "FAILED");
+      return dev <= IT_ACCURACY ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+
+   if (flt.bbox)
+      fsh_filter_bbox(&flt, bbox[0], bbox[1], bbox[2], bbox[3]);
+   if (flt.bbox || flt.name != NULL || flt.min_pts > 0)
+      fltp = &flt;
+   out = ob_open(STDOUT_FILENO, OBUF_SIZE);
+   // per-file outputs are compressed by the batch workers
+   if (zmethod != OB_PLAIN && outdir == NULL && ob_compress(out, zmethod, zlevel, sysconf(_SC_NPROCESSORS_ONLN)) == -1)
+      fprintf(stderr, "# zstd not supported, recompile with HAVE_ZSTD\n"), exit(EXIT_FAILURE);
+
+   if (fmt_out == FMT_ASC || fmt_out == FMT_FLT)
+   {
+      if (fmt_out == FMT_FLT && outdir == NULL)
+         fprintf(stderr, "# flt output needs an output directory (-o)\n"), exit(EXIT_FAILURE);
+      // the grid is a single rectangle in Mercator coordinates
+      if (flt.bbox && bbox[1] > bbox[3])
+         fprintf(stderr, "# bounding box across the antimeridian (west > east) not supported for grid output\n"), exit(EXIT_FAILURE);
+      if (stream || snapfile != NULL || cachedir != NULL)
+         vlog("streaming, snapshots, and cache not supported for grid output\n");
+      if (optind >= argc)
+         path_cnt = batch_add(&path, path_cnt, "-");
+      for (; optind < argc; optind++)
+         path_cnt = batch_add(&path, path_cnt, argv[optind]);
+      if (!path_cnt)
+         fprintf(stderr, "# no input files\n"), exit(EXIT_FAILURE);
+
+      err = grid_convert(path, path_cnt, nthreads, outdir, out, fmt_out, ctx_flags, &el, &sp, fltp, flt.bbox ? bbox : NULL, grid_size, grid_stat);
+      out_close(out);
+      if (flt.name != NULL)
+         regfree(&re);
+      for (c = 0; c < path_cnt; c++)
+         free(path[c]);
+      free(path);
+      return err ? EXIT_FAILURE : EXIT_SUCCESS;
+   }
+
+   if (optind < argc)
+   {
+      for (; optind < argc; optind++)
+         path_cnt = batch_add(&path, path_cnt, argv[optind]);
+      if (!path_cnt)
+         fprintf(stderr, "# no input files\n"), exit(EXIT_FAILURE);
+      if (stream)
+         vlog("streaming not supported in batch mode\n");
+      if (snapfile != NULL)
+         vlog("snapshots not supported in batch mode\n");
+      if (cachedir != NULL)
+         out_cache_open(cachedir, fmt_out, &el);
+
+      err = batch_convert(path, path_cnt, nthreads, outdir, out, fmt_out, ctx_flags, zmethod, zlevel, &el, &sp, fltp);
+      out_cache_close();
+      out_close(out);
+      if (flt.name != NULL)
+         regfree(&re);
+      for (c = 0; c < path_cnt; c++)
+         free(path[c]);
+      free(path);
+      return err ? EXIT_FAILURE : EXIT_SUCCESS;
+   }
+
+   if (stream && (snapfile != NULL || is_snapshot(fd)))
+   {
+      vlog("streaming not supported with snapshots\n");
+      stream = 0;
+   }
+
+   if (stream)
+   {
+      if (fmt_out == FMT_CSV || fmt_out == FMT_GPX || fmt_out == FMT_GEOJSONSEQ)
+      {
+         if (cachedir != NULL)
+            vlog("cache not supported in streaming mode\n");
+         stream_convert(fd, out, fmt_out, &el, &sp, fltp);
+         out_close(out);
+         if (flt.name != NULL)
+            regfree(&re);
+         return 0;
+      }
+      vlog("streaming not supported for %s output\n", fmt_ext_[fmt_out]);
+   }
+
+   if ((err = fsh_ctx_open_fd(&ctx, fd, ctx_flags)) < 0)
+      perror("fsh_ctx_open_fd"), exit(EXIT_FAILURE);
+   fsh_ctx_set_filter(ctx, fltp);
+   if ((err = fsh_ctx_decode(ctx, nthreads)) < 0)
+      fprintf(stderr, "# %s\n", fsh_strerror(err)), exit(EXIT_FAILURE);
+   if (sp.tol > 0)
+   {
+      if ((err = fsh_ctx_simplify(ctx, &sp)) < 0)
+         fprintf(stderr, "# %s\n", fsh_strerror(err)), exit(EXIT_FAILURE);
+      simpl_log(&sp);
+   }
+
+   if (snapfile != NULL)
+   {
+      if ((fd = open(snapfile, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+         perror(snapfile), exit(EXIT_FAILURE);
+      if ((err = fsh_snap_write(ctx, fd, &el)) < 0)
+         fprintf(stderr, "# %s: %s\n", snapfile, err == FSH_ERR_IO ? strerror(errno) : fsh_strerror(err)), exit(EXIT_FAILURE);
+      close(fd);
+      vlog("snapshot of %d blocks written to %s\n", ctx->blk_cnt, snapfile);
+
+      fsh_ctx_close(ctx);
+      out_close(out);
+      if (flt.name != NULL)
+         regfree(&re);
+      return 0;
+   }
+   fsh_snap_projection(ctx, &el);
+
+   if (cachedir != NULL)
+      out_cache_open(cachedir, fmt_out, &el);
+   doc_start(out, fmt_out);
+   convert(out, ctx, fmt_out, &el, "-");
+   doc_end(out, fmt_out);
+   out_cache_close();
 
-   free(rte);
-   free(trk);
-   fsh_free_block_data(blk);
-   free(blk);
+   fsh_ctx_close(ctx);
 
+   out_close(out);
+   if (flt.name != NULL)
+      regfree(&re);
    return 0;
 }
 
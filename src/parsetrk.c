@@ -26,6 +26,7 @@
 #include <math.h>
 
 #include "admfunc.h"
+#include "numfmt.h"
 
 
 #define vlog(x...) fprintf(stderr, ## x)
@@ -54,14 +55,10 @@ static void hexdump(const void *buf, int len)
 
 void output_node(const adm_track_point_t *tp)
 {
-   char ts[TBUFLEN] = "";
+   char ts[TBUFLEN];
    double tempr, depth;
-   struct tm *tm;
-   time_t t;
 
-   t = tp->timestamp + ADM_EPOCH;
-   if ((tm = gmtime(&t)) != NULL)
-      strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", tm);
+   *fmt_time(ts, tp->timestamp + ADM_EPOCH) = '\0';
 
    if (tp->tempr != ADM_DEPTH_NA)
       //tempr = (double) tp->tempr / 1E7;
@@ -81,14 +78,10 @@ void output_node(const adm_track_point_t *tp)
 
 void output_osm_node(const adm_track_point_t *tp)
 {
-   char ts[TBUFLEN] = "";
+   char ts[TBUFLEN];
    static int id = 0;
-   struct tm *tm;
-   time_t t;
 
-   t = tp->timestamp + ADM_EPOCH;
-   if ((tm = gmtime(&t)) != NULL)
-      strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", tm);
+   *fmt_time(ts, tp->timestamp + ADM_EPOCH) = '\0';
 
    printf("<node id='%d' timestamp='%s' version='1' lat='%.7f' lon='%.7f'>\n"
           "<tag k='seamark:sounding' v='%.1f'/>\n"
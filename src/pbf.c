@@ -0,0 +1,460 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains a writer for the OSM PBF format
+ *  (https://wiki.openstreetmap.org/wiki/PBF_Format). The file consists of an
+ *  OSMHeader blob followed by OSMData blobs, each of which contains a zlib
+ *  compressed PrimitiveBlock. Nodes are written as DenseNodes, ways as
+ *  separate blocks. The ids, coordinates, and timestamps are delta coded and
+ *  the keys and values of the tags refer to the string table of their block.
+ *  The protobuf messages are encoded by a few functions which just support
+ *  what is needed here.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <zlib.h>
+
+#include "pbf.h"
+
+// wire types
+#define PB_VARINT 0
+#define PB_LEN 2
+#define ZIGZAG(x) (((uint64_t) (x) << 1) ^ (uint64_t) ((x) >> 63))
+// compression level of the blobs, higher levels hardly reduce the size
+// further but take much longer
+#define PBF_ZLEVEL Z_BEST_SPEED
+// initial size of the hash table of the string table
+#define PBF_HASH_SIZE 1024
+
+
+/*! Make sure that there is space for at least n more bytes in the buffer.
+ * @return Returns a pointer to the end of the data.
+ */
+static char *pb_reserve(pb_buf_t *b, size_t n)
+{
+   if (b->len + n > b->size)
+   {
+      b->size = (b->len + n) * 2;
+      if ((b->buf = realloc(b->buf, b->size)) == NULL)
+         perror("realloc"), exit(EXIT_FAILURE);
+   }
+   return b->buf + b->len;
+}
+
+
+static void pb_varint(pb_buf_t *b, uint64_t v)
+{
+   char *p = pb_reserve(b, 10);
+
+   for (; v >= 0x80; v >>= 7)
+      *p++ = v | 0x80;
+   *p++ = v;
+   b->len = p - b->buf;
+}
+
+
+static void pb_sint(pb_buf_t *b, int64_t v)
+{
+   pb_varint(b, ZIGZAG(v));
+}
+
+
+/*! Append the field of number field with the varint value v. */
+static void pb_uint(pb_buf_t *b, int field, uint64_t v)
+{
+   pb_varint(b, field << 3 | PB_VARINT);
+   pb_varint(b, v);
+}
+
+
+/*! Append the length-delimited field of number field, i.e. bytes, a string,
+ * an embedded message, or a packed repeated field.
+ */
+static void pb_bytes(pb_buf_t *b, int field, const void *data, size_t len)
+{
+   pb_varint(b, field << 3 | PB_LEN);
+   pb_varint(b, len);
+   if (len)
+      memcpy(pb_reserve(b, len), data, len);
+   b->len += len;
+}
+
+
+/*! Write a blob of the type "OSMHeader" or "OSMData" preceded by its blob
+ * header to out. The data is compressed with zlib.
+ * @return Returns the number of compressed bytes.
+ */
+static size_t pbf_blob(obuf_t *out, const char *type, const void *data, size_t len)
+{
+   pb_buf_t blob, hdr;
+   uLongf zlen;
+   uint32_t n;
+   char *z;
+
+   memset(&blob, 0, sizeof(blob));
+   memset(&hdr, 0, sizeof(hdr));
+
+   zlen = compressBound(len);
+   if ((z = malloc(zlen)) == NULL)
+      perror("malloc"), exit(EXIT_FAILURE);
+   if (compress2((Bytef*) z, &zlen, data, len, PBF_ZLEVEL) != Z_OK)
+      fprintf(stderr, "# zlib compression failed\n"), exit(EXIT_FAILURE);
+
+   pb_uint(&blob, 2, len);
+   pb_bytes(&blob, 3, z, zlen);
+   free(z);
+
+   pb_bytes(&hdr, 1, type, strlen(type));
+   pb_uint(&hdr, 3, blob.len);
+
+   // the length of the blob header is a 4 byte integer in network byte order
+   n = hdr.len;
+   n = (n >> 24) | ((n >> 8) & 0xff00) | ((n << 8) & 0xff0000) | (n << 24);
+   ob_write(out, &n, sizeof(n));
+   ob_write(out, hdr.buf, hdr.len);
+   ob_write(out, blob.buf, blob.len);
+
+   free(hdr.buf);
+   free(blob.buf);
+   return zlen;
+}
+
+
+/*! Write the OSMHeader blob to out. This starts the file.
+ */
+void pbf_header(obuf_t *out)
+{
+   pb_buf_t hb;
+
+   memset(&hb, 0, sizeof(hb));
+   pb_bytes(&hb, 4, "OsmSchema-V0.6", 14);
+   pb_bytes(&hb, 4, "DenseNodes", 10);
+   pb_bytes(&hb, 16, "parsefsh", 8);
+   pbf_blob(out, "OSMHeader", hb.buf, hb.len);
+   free(hb.buf);
+}
+
+
+static uint32_t pbf_hash(const char *s, int len)
+{
+   uint32_t h = 2166136261u;
+
+   for (; len > 0; len--, s++)
+      h = (h ^ (uint8_t) *s) * 16777619u;
+   return h;
+}
+
+
+/*! Find the slot of the string s of len characters in the hash table.
+ * @return Returns the slot, which is empty if the string is not in the
+ * table.
+ */
+static uint32_t pbf_slot(const pbf_t *pbf, const char *s, int len)
+{
+   uint32_t i, k;
+
+   for (i = pbf_hash(s, len) & (pbf->hsize - 1); pbf->hash[i]; i = (i + 1) & (pbf->hsize - 1))
+   {
+      k = pbf->hash[i] - 1;
+      if (pbf->slen[k] == len && !memcmp(pbf->str.buf + pbf->soff[k], s, len))
+         break;
+   }
+   return i;
+}
+
+
+/*! Double the size of the hash table of the string table. */
+static void pbf_rehash(pbf_t *pbf)
+{
+   int k;
+
+   pbf->hsize = pbf->hsize ? pbf->hsize * 2 : PBF_HASH_SIZE;
+   free(pbf->hash);
+   if ((pbf->hash = calloc(pbf->hsize, sizeof(*pbf->hash))) == NULL
+         || (pbf->soff = realloc(pbf->soff, sizeof(*pbf->soff) * pbf->hsize / 2)) == NULL
+         || (pbf->slen = realloc(pbf->slen, sizeof(*pbf->slen) * pbf->hsize / 2)) == NULL)
+      perror("realloc"), exit(EXIT_FAILURE);
+
+   for (k = 0; k < pbf->nstr; k++)
+      pbf->hash[pbf_slot(pbf, pbf->str.buf + pbf->soff[k], pbf->slen[k])] = k + 1;
+}
+
+
+/*! Return the index of the string s of len characters within the string
+ * table of the current block. The string is added if it is not found.
+ */
+static int pbf_str(pbf_t *pbf, const char *s, int len)
+{
+   uint32_t i;
+   int k;
+
+   // the load factor of the hash table is kept below 1/2
+   if (2 * (pbf->nstr + 1) > pbf->hsize)
+      pbf_rehash(pbf);
+
+   if (pbf->hash[i = pbf_slot(pbf, s, len)])
+      return pbf->hash[i] - 1;
+
+   k = pbf->nstr++;
+   pb_bytes(&pbf->str, 1, s, len);
+   pbf->soff[k] = pbf->str.len - len;
+   pbf->slen[k] = len;
+   pbf->hash[i] = k + 1;
+   return k;
+}
+
+
+/*! Start a new block. */
+static void pbf_reset(pbf_t *pbf)
+{
+   int i;
+
+   for (i = 0; i < PBF_DN_CNT; i++)
+      pbf->dn[i].len = 0;
+   memset(pbf->last, 0, sizeof(pbf->last));
+   pbf->last_ts = 0;
+   pbf->way.len = 0;
+   pbf->cnt = 0;
+
+   pbf->str.len = 0;
+   pbf->nstr = 0;
+   if (pbf->hash != NULL)
+      memset(pbf->hash, 0, sizeof(*pbf->hash) * pbf->hsize);
+   // the first string is always empty
+   pbf_str(pbf, "", 0);
+}
+
+
+/*! Create a new PrimitiveBlock writer. The header has to be written before
+ * with pbf_header().
+ * @param out Output buffer the blocks are written to.
+ * @param max_cnt Number of entities of a block, e.g. PBF_BLOCK_ENTITIES.
+ * @return Returns a pointer to the writer. If memory allocation fails the
+ * function does not return.
+ */
+pbf_t *pbf_open(obuf_t *out, int max_cnt)
+{
+   pbf_t *pbf;
+
+   if ((pbf = calloc(1, sizeof(*pbf))) == NULL)
+      perror("calloc"), exit(EXIT_FAILURE);
+   pbf->out = out;
+   pbf->max_cnt = max_cnt;
+   pbf_reset(pbf);
+   return pbf;
+}
+
+
+/*! Write the pending entities and free the writer. The output buffer is not
+ * closed.
+ */
+void pbf_close(pbf_t *pbf)
+{
+   int i;
+
+   pbf_flush(pbf);
+   for (i = 0; i < PBF_DN_CNT; i++)
+      free(pbf->dn[i].buf);
+   free(pbf->way.buf);
+   free(pbf->tmp.buf);
+   free(pbf->pk.buf);
+   free(pbf->str.buf);
+   free(pbf->hash);
+   free(pbf->soff);
+   free(pbf->slen);
+   free(pbf);
+}
+
+
+/*! Write the pending entities as a PrimitiveBlock with a single
+ * PrimitiveGroup. The granularities are the defaults, i.e. 100 nanodegrees
+ * and 1 second.
+ */
+void pbf_flush(pbf_t *pbf)
+{
+   pb_buf_t *t = &pbf->tmp, *pk = &pbf->pk, *dn = pbf->dn;
+
+   if (!pbf->cnt)
+      return;
+
+   t->len = 0;
+   pk->len = 0;
+   if (pbf->ways)
+   {
+      pb_bytes(pk, 1, pbf->str.buf, pbf->str.len);
+      pb_bytes(pk, 2, pbf->way.buf, pbf->way.len);
+   }
+   else
+   {
+      // DenseInfo
+      pb_bytes(t, 1, dn[PBF_DN_VER].buf, dn[PBF_DN_VER].len);
+      pb_bytes(t, 2, dn[PBF_DN_TS].buf, dn[PBF_DN_TS].len);
+      pb_bytes(t, 3, dn[PBF_DN_CS].buf, dn[PBF_DN_CS].len);
+      pb_bytes(t, 4, dn[PBF_DN_UID].buf, dn[PBF_DN_UID].len);
+      pb_bytes(t, 5, dn[PBF_DN_SID].buf, dn[PBF_DN_SID].len);
+      // DenseNodes
+      pb_bytes(pk, 1, dn[PBF_DN_ID].buf, dn[PBF_DN_ID].len);
+      pb_bytes(pk, 5, t->buf, t->len);
+      pb_bytes(pk, 8, dn[PBF_DN_LAT].buf, dn[PBF_DN_LAT].len);
+      pb_bytes(pk, 9, dn[PBF_DN_LON].buf, dn[PBF_DN_LON].len);
+      pb_bytes(pk, 10, dn[PBF_DN_KV].buf, dn[PBF_DN_KV].len);
+      // PrimitiveGroup
+      t->len = 0;
+      pb_bytes(t, 2, pk->buf, pk->len);
+      // PrimitiveBlock
+      pk->len = 0;
+      pb_bytes(pk, 1, pbf->str.buf, pbf->str.len);
+      pb_bytes(pk, 2, t->buf, t->len);
+   }
+
+   pbf->raw += pk->len;
+   pbf->zipped += pbf_blob(pbf->out, "OSMData", pk->buf, pk->len);
+   pbf->total += pbf->cnt;
+   pbf->blocks++;
+   pbf_reset(pbf);
+}
+
+
+/*! Count an entity of the current block and write the block if it is
+ * full.
+ */
+static void pbf_entity(pbf_t *pbf)
+{
+   size_t len;
+   int i;
+
+   for (len = pbf->str.len + pbf->way.len, i = 0; i < PBF_DN_CNT; i++)
+      len += pbf->dn[i].len;
+   if (++pbf->cnt >= pbf->max_cnt || len >= PBF_BLOCK_SIZE)
+      pbf_flush(pbf);
+}
+
+
+/*! Append the keys and values of the tags as indices into the string table.
+ * Tags with an empty value are skipped.
+ * @param kv Buffer of the keys, or NULL if the keys and values are
+ * alternating in v (DenseNodes).
+ * @param v Buffer of the values.
+ */
+static void pbf_tags(pbf_t *pbf, pb_buf_t *kv, pb_buf_t *v, const pbf_tag_t *tag, int ntag)
+{
+   int i;
+
+   for (i = 0; i < ntag; i++)
+   {
+      if (!tag[i].len)
+         continue;
+      pb_varint(kv != NULL ? kv : v, pbf_str(pbf, tag[i].key, strlen(tag[i].key)));
+      pb_varint(v, pbf_str(pbf, tag[i].val, tag[i].len));
+   }
+}
+
+
+/*! Add a node to the current block.
+ * @param id Node id.
+ * @param lat Latitude in degrees.
+ * @param lon Longitude in degrees.
+ * @param ts Timestamp in seconds since the epoch.
+ * @param tag List of ntag tags.
+ */
+void pbf_node(pbf_t *pbf, int64_t id, double lat, double lon, int64_t ts, const pbf_tag_t *tag, int ntag)
+{
+   int64_t v[3] = {id, llround(lat * 1E7), llround(lon * 1E7)};
+   int i;
+
+   if (pbf->ways)
+   {
+      pbf_flush(pbf);
+      pbf->ways = 0;
+   }
+
+   // PBF_DN_ID, PBF_DN_LAT, and PBF_DN_LON are consecutive
+   for (i = 0; i < 3; i++)
+   {
+      pb_sint(&pbf->dn[PBF_DN_ID + i], v[i] - pbf->last[i]);
+      pbf->last[i] = v[i];
+   }
+   pbf_tags(pbf, NULL, &pbf->dn[PBF_DN_KV], tag, ntag);
+   pb_varint(&pbf->dn[PBF_DN_KV], 0);
+
+   pb_varint(&pbf->dn[PBF_DN_VER], 1);
+   pb_sint(&pbf->dn[PBF_DN_TS], ts - pbf->last_ts);
+   pbf->last_ts = ts;
+   pb_sint(&pbf->dn[PBF_DN_CS], 0);
+   pb_sint(&pbf->dn[PBF_DN_UID], 0);
+   pb_sint(&pbf->dn[PBF_DN_SID], 0);
+
+   pbf_entity(pbf);
+}
+
+
+/*! Add a way to the current block.
+ * @param id Way id.
+ * @param ts Timestamp in seconds since the epoch.
+ * @param tag List of ntag tags.
+ * @param ref List of the nref node ids of the way.
+ */
+void pbf_way(pbf_t *pbf, int64_t id, int64_t ts, const pbf_tag_t *tag, int ntag, const int64_t *ref, int nref)
+{
+   pb_buf_t *t = &pbf->tmp, *pk = &pbf->pk;
+   pb_buf_t vals;
+   int64_t last;
+   int i;
+
+   if (!pbf->ways)
+   {
+      pbf_flush(pbf);
+      pbf->ways = 1;
+   }
+
+   t->len = 0;
+   pb_uint(t, 1, id);
+
+   pk->len = 0;
+   memset(&vals, 0, sizeof(vals));
+   pbf_tags(pbf, pk, &vals, tag, ntag);
+   pb_bytes(t, 2, pk->buf, pk->len);
+   pb_bytes(t, 3, vals.buf, vals.len);
+   free(vals.buf);
+
+   // Info
+   pk->len = 0;
+   pb_uint(pk, 1, 1);
+   pb_uint(pk, 2, ts);
+   pb_uint(pk, 3, 0);
+   pb_uint(pk, 4, 0);
+   pb_uint(pk, 5, 0);
+   pb_bytes(t, 4, pk->buf, pk->len);
+
+   pk->len = 0;
+   for (i = 0, last = 0; i < nref; i++)
+   {
+      pb_sint(pk, ref[i] - last);
+      last = ref[i];
+   }
+   pb_bytes(t, 8, pk->buf, pk->len);
+
+   pb_bytes(&pbf->way, 3, t->buf, t->len);
+   pbf_entity(pbf);
+}
+
@@ -0,0 +1,91 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the data structures and prototypes of the OSM PBF
+ *  writer.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#ifndef PBF_H
+#define PBF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "obuf.h"
+
+// default number of entities of a PrimitiveBlock
+#define PBF_BLOCK_ENTITIES 8000
+// a block is written as soon as its data exceeds this size
+#define PBF_BLOCK_SIZE (8 * 1024 * 1024)
+
+// tag of an entity
+typedef struct pbf_tag
+{
+   const char *key;  //!< \0-terminated key
+   const char *val;  //!< value of len characters
+   int len;          //!< length of val
+} pbf_tag_t;
+
+// growing buffer of encoded protobuf data
+typedef struct pb_buf
+{
+   char *buf;
+   size_t len;
+   size_t size;
+} pb_buf_t;
+
+// packed fields of the DenseNodes of the current block
+enum {PBF_DN_ID, PBF_DN_LAT, PBF_DN_LON, PBF_DN_KV, PBF_DN_VER, PBF_DN_TS, PBF_DN_CS, PBF_DN_UID, PBF_DN_SID, PBF_DN_CNT};
+
+// PrimitiveBlock writer
+typedef struct pbf
+{
+   obuf_t *out;         //!< output buffer the blocks are written to
+   int max_cnt;         //!< number of entities after which a block is written
+   int cnt;             //!< number of entities in the current block
+   int ways;            //!< 1 if the current block contains ways, 0 for nodes
+
+   pb_buf_t str;        //!< encoded string table of the current block
+   int nstr;            //!< number of strings in the table
+   uint32_t *hash;      //!< hash table of the string indices + 1, 0 if empty
+   int hsize;           //!< size of the hash table, power of 2
+   size_t *soff;        //!< offset of each string within str
+   int *slen;           //!< length of each string
+
+   pb_buf_t dn[PBF_DN_CNT];   //!< packed fields of the dense nodes
+   int64_t last[3];     //!< last id, lat, and lon (delta coding)
+   int64_t last_ts;     //!< last timestamp (delta coding)
+   pb_buf_t way;        //!< encoded ways
+   pb_buf_t tmp, pk;    //!< scratch buffers
+
+   long long total;     //!< total number of entities written
+   int blocks;          //!< number of blocks written
+   long long raw, zipped;  //!< bytes of the blocks before and after compression
+} pbf_t;
+
+
+void pbf_header(obuf_t *);
+pbf_t *pbf_open(obuf_t *, int );
+void pbf_close(pbf_t *);
+void pbf_flush(pbf_t *);
+void pbf_node(pbf_t *, int64_t , double , double , int64_t , const pbf_tag_t *, int );
+void pbf_way(pbf_t *, int64_t , int64_t , const pbf_tag_t *, int , const int64_t *, int );
+
+#endif
+
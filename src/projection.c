@@ -31,6 +31,7 @@
 #include <time.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include "projection.h"
 
@@ -48,7 +49,20 @@
  */
 void init_ellipsoid(ellipsoid_t *el)
 {
+   double e2, e4, e6, e8;
+
    el->e = sqrt(1 - pow(el->b / el->a, 2));
+
+   // coefficients of the series to derive the geographic from the conformal
+   // latitude
+   e2 = el->e * el->e;
+   e4 = e2 * e2;
+   e6 = e4 * e2;
+   e8 = e6 * e2;
+   el->chi[0] = e2 / 2 + 5 * e4 / 24 + e6 / 12 + 13 * e8 / 360;
+   el->chi[1] = 7 * e4 / 48 + 29 * e6 / 240 + 811 * e8 / 11520;
+   el->chi[2] = 7 * e6 / 120 + 81 * e8 / 1120;
+   el->chi[3] = 4279 * e8 / 161280;
 }
 
 
@@ -90,12 +104,258 @@ double phi_iterate_merc(const ellipsoid_t *el, double N)
 }
 
 
+/*! This function derives the geographic latitude from the Mercator Northing N
+ * without iteration. The conformal latitude is calculated directly from N and
+ * is then converted into the geographic latitude with a series with the
+ * precomputed coefficients el->chi[]. The series is summed up with Clenshaw's
+ * method, thus it needs just a single sin() and cos().
+ * @param el Pointer to the ellipsoid data.
+ * @param N Mercator Northing.
+ * @return Returns the latitude in radians.
+ */
+double phi_series_merc(const ellipsoid_t *el, double N)
+{
+   double chi, s, c, b0, b1, b2;
+   int i;
+
+   chi = M_PI_2 - 2.0 * atan(exp(-N / el->a));
+   s = sin(2 * chi);
+   c = 2 * cos(2 * chi);
+
+   for (b1 = b2 = 0, i = 3; i >= 0; i--, b2 = b1, b1 = b0)
+      b0 = el->chi[i] + c * b1 - b2;
+
+   return chi + b1 * s;
+}
+
+
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__ELF__)
+#define HAVE_MERC_SIMD
+#endif
+
+#ifdef HAVE_MERC_SIMD
+typedef double v4d_t __attribute__((vector_size(32)));
+typedef int64_t v4i_t __attribute__((vector_size(32)));
+
+// select elements of a where mask m is set, otherwise of b
+#define VSEL(m, a, b) ((v4d_t) (((m) & (v4i_t) (a)) | (~(m) & (v4i_t) (b))))
+
+/*! This is the vectorized version of phi_series_merc(). It processes 4
+ * Northings at once. exp() is calculated by a Taylor series after range
+ * reduction to |r| <= ln(2)/2, atan() with the rational approximation of
+ * Cephes. Both are accurate to about 1E-16. The function is compiled for AVX2
+ * and for the default target (SSE2) and the matching version is selected at
+ * runtime.
+ * @param el Pointer to the ellipsoid data.
+ * @param N Pointer to the array of Northings.
+ * @param phi Pointer to the array which receives the latitudes in radians.
+ * It may be the same as N.
+ * @param n Number of elements.
+ */
+__attribute__((target_clones("avx2", "default")))
+static void phi_series_merc_simd(const ellipsoid_t *el, const double *N, double *phi, int n)
+{
+   static const double ex[] = {1.0 / 6227020800, 1.0 / 479001600, 1.0 / 39916800,
+      1.0 / 3628800, 1.0 / 362880, 1.0 / 40320, 1.0 / 5040, 1.0 / 720, 1.0 / 120,
+      1.0 / 24, 1.0 / 6, 1.0 / 2, 1.0, 1.0};
+   static const double P[] = {-8.750608600031904122785E-1, -1.615753718733365076637E1,
+      -7.500855792314704667340E1, -1.228866684490136173410E2, -6.485021904942025371773E1};
+   static const double Q[] = {1.0, 2.485846490142306297962E1, 1.650270098316988542046E2,
+      4.328810604912902668951E2, 4.853903996359136964868E2, 1.945506571482613964425E2};
+   const v4i_t sign = {INT64_MIN, INT64_MIN, INT64_MIN, INT64_MIN};
+   const v4d_t zero = {0, 0, 0, 0};
+   v4d_t psi, k, r, u, t, x, z, y, s, c, b0, b1, b2;
+   v4i_t m, ki;
+   double in[4], out[4];
+   int i, j, l;
+
+   for (i = 0; i < n; i += 4)
+   {
+      if ((l = n - i) >= 4)
+      {
+         l = 4;
+         memcpy(&psi, N + i, sizeof(psi));
+      }
+      else
+      {
+         for (j = 0; j < 4; j++)
+            in[j] = j < l ? N[i + j] : 0;
+         memcpy(&psi, in, sizeof(psi));
+      }
+
+      // isometric latitude, limited to avoid overflows
+      psi = psi / el->a;
+      m = psi > 20.0;
+      psi = VSEL(m, zero + 20.0, psi);
+      m = psi < -20.0;
+      psi = VSEL(m, zero - 20.0, psi);
+
+      // u = exp(psi) = 2^k * exp(r)
+      k = psi * M_LOG2E;
+      m = k < 0;
+      ki = __builtin_convertvector(k + VSEL(m, zero - 0.5, zero + 0.5), v4i_t);
+      k = __builtin_convertvector(ki, v4d_t);
+      r = psi - k * 6.93145751953125E-1 - k * 1.42860682030941723212E-6;
+      for (u = zero, j = 0; j < (int) (sizeof(ex) / sizeof(*ex)); j++)
+         u = u * r + ex[j];
+      u = u * (v4d_t) ((ki + 1023) << 52);
+
+      // t = tanh(psi / 2), chi = 2 * atan(t)
+      t = (u - 1) / (u + 1);
+      x = (v4d_t) ((v4i_t) t & ~sign);
+      m = x > 0.66;
+      z = VSEL(m, (x - 1) / (x + 1), x);
+      x = z * z;
+      for (b0 = zero, j = 0; j < (int) (sizeof(P) / sizeof(*P)); j++)
+         b0 = b0 * x + P[j];
+      for (b1 = zero, j = 0; j < (int) (sizeof(Q) / sizeof(*Q)); j++)
+         b1 = b1 * x + Q[j];
+      y = VSEL(m, zero + M_PI_4, zero) + z + z * x * b0 / b1;
+      y = (v4d_t) ((v4i_t) y | ((v4i_t) t & sign));
+
+      // sin(chi) = tanh(psi), cos(chi) = sech(psi)
+      x = t * t;
+      s = 2 * t / (1 + x);
+      c = (1 - x) / (1 + x);
+      s = 2 * s * c;
+      c = 2 * (2 * c * c - 1);
+
+      // Clenshaw summation, see phi_series_merc()
+      for (b1 = b2 = zero, j = 3; j >= 0; j--, b2 = b1, b1 = b0)
+         b0 = el->chi[j] + c * b1 - b2;
+
+      y = 2 * y + b1 * s;
+      if (l == 4)
+         memcpy(phi + i, &y, sizeof(y));
+      else
+      {
+         memcpy(out, &y, sizeof(out));
+         for (j = 0; j < l; j++)
+            phi[i + j] = out[j];
+      }
+   }
+}
+#endif
+
+
+/*! This function derives the geographic latitudes of n Mercator Northings at
+ * once. If the series method is selected in el->merc_inv, a vectorized
+ * version (AVX2 or SSE2, selected at runtime) of phi_series_merc() is used on
+ * x86-64 platforms.
+ * @param el Pointer to the ellipsoid data.
+ * @param N Pointer to the array of Northings.
+ * @param phi Pointer to the array which receives the latitudes in radians.
+ * It may be the same as N.
+ * @param n Number of elements.
+ */
+void phi_merc_batch(const ellipsoid_t *el, const double *N, double *phi, int n)
+{
+   int i;
+
+   if (el->merc_inv == MERC_SERIES)
+   {
+#ifdef HAVE_MERC_SIMD
+      phi_series_merc_simd(el, N, phi, n);
+#else
+      for (i = 0; i < n; i++)
+         phi[i] = phi_series_merc(el, N[i]);
+#endif
+      return;
+   }
+
+   for (i = 0; i < n; i++)
+      phi[i] = phi_iterate_merc(el, N[i]);
+}
+
+
+/*! Project all points of the track segment tseg to geographic coordinates.
+ * @param lat Array which receives the tseg->hdr->cnt latitudes in degrees.
+ * @param lon Array which receives the longitudes in degrees.
+ */
+void fsh_tseg_project(const track_segment_t *tseg, const ellipsoid_t *el, double *lat, double *lon)
+{
+   int i, cnt = tseg->hdr->cnt;
+
+   for (i = 0; i < cnt; i++)
+   {
+      lat[i] = tseg->pt[i].north / FSH_LAT_SCALE;
+      lon[i] = tseg->pt[i].east / FSH_LON_SCALE * 180.0;
+   }
+   phi_merc_batch(el, lat, lat, cnt);
+   for (i = 0; i < cnt; i++)
+      lat[i] = RAD2DEG(lat[i]);
+}
+
+
+/*! This function derives the geographic latitude from the Mercator Northing N
+ * with the method selected in el->merc_inv.
+ * @param el Pointer to the ellipsoid data.
+ * @param N Mercator Northing.
+ * @return Returns the latitude in radians.
+ */
+double phi_merc(const ellipsoid_t *el, double N)
+{
+   if (el->merc_inv == MERC_SERIES)
+      return phi_series_merc(el, N);
+   return phi_iterate_merc(el, N);
+}
+
+
+/*! This function compares phi_series_merc() to phi_iterate_merc() from -89.5
+ * to 89.5 degrees of latitude in steps of 0.001 degrees.
+ * @param el Pointer to the ellipsoid data.
+ * @return Returns the maximum difference in radians.
+ */
+double phi_merc_check(const ellipsoid_t *el)
+{
+   double N, d, dmax = 0;
+   int i;
+
+   for (i = -89500; i <= 89500; i++)
+   {
+      N = northing(el, DEG2RAD(i / 1000.0));
+      d = fabs(phi_series_merc(el, N) - phi_iterate_merc(el, N));
+      if (d > dmax)
+         dmax = d;
+   }
+
+   return dmax;
+}
+
+
 double northing(const ellipsoid_t *el, double lat)
 {
    return el->a * log(tan(M_PI_4 + lat / 2) * pow((1 - el->e * sin(lat)) / (1 + el->e * sin(lat)), el->e / 2));
 }
 
 
+/*! Convert a latitude in degrees to the prescaled FSH Mercator Northing,
+ * clipped to the int32 range.
+ */
+int32_t fsh_north(const ellipsoid_t *el, double lat)
+{
+   double n;
+
+   if (lat >= 90)
+      return INT32_MAX;
+   if (lat <= -90)
+      return INT32_MIN;
+   n = round(northing(el, DEG2RAD(lat)) * FSH_LAT_SCALE);
+   return n > INT32_MAX ? INT32_MAX : n < INT32_MIN ? INT32_MIN : n;
+}
+
+
+/*! Convert a longitude in degrees to the prescaled FSH Easting, clipped to
+ * the int32 range.
+ */
+int32_t fsh_east(double lon)
+{
+   double e = round(lon / 180.0 * FSH_LON_SCALE);
+
+   return e > INT32_MAX ? INT32_MAX : e < INT32_MIN ? INT32_MIN : e;
+}
+
+
 /*! Calculate bearing and distance from src to dst.
  *  @param src Source coodinates (struct coord).
  *  @param dst Destination coordinates (struct coord).
@@ -125,24 +385,185 @@ struct pcoord coord_diff(const struct coord *src, const struct coord *dst)
 //#define TEST_PROJECTION
 #ifdef TEST_PROJECTION
 
+/* Microbenchmark of the projection kernels. Each function is called for a set
+ * of random but realistic inputs (latitudes from the equator to 80 degrees,
+ * track-like coordinate pairs) in batches of PB_BATCH calls. The duration of
+ * each batch is one latency sample. Finally, the round trip northing() ->
+ * phi_iterate_merc() is checked against IT_ACCURACY. The program exits with
+ * EXIT_FAILURE if the check fails.
+ */
+
+#include <getopt.h>
+
+#define PB_BATCH 16
+#define PB_MAXLAT 80
+#define PB_BANDS 8
+
+
+static uint64_t pb_seed_ = 0x9e3779b97f4a7c15ULL;
+
+
+/*! Random number generator (xorshift64*).
+ * @return Returns a random number within [0, 1[.
+ */
+static double pb_rand(void)
+{
+   pb_seed_ ^= pb_seed_ >> 12;
+   pb_seed_ ^= pb_seed_ << 25;
+   pb_seed_ ^= pb_seed_ >> 27;
+   return (pb_seed_ * 2685821657736338717ULL >> 11) / 9007199254740992.0;
+}
+
+
+static double pb_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1E9 + ts.tv_nsec;
+}
+
+
+static int pb_cmp(const void *a, const void *b)
+{
+   return *(const double*) a < *(const double*) b ? -1 : *(const double*) a > *(const double*) b;
+}
+
+
+/*! Print a line with the average and the distribution of the latency
+ * samples. The samples are sorted in place.
+ * @param name Name of the function.
+ * @param smp Array of latency samples in ns/call.
+ * @param n Number of samples.
+ */
+static void pb_report(const char *name, double *smp, int n)
+{
+   double sum;
+   int i;
+
+   for (sum = 0, i = 0; i < n; i++)
+      sum += smp[i];
+   qsort(smp, n, sizeof(*smp), pb_cmp);
+   printf("%-18s %9d %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, n * PB_BATCH,
+         sum / n, smp[0], smp[n / 2], smp[n * 9 / 10], smp[n * 99 / 100], smp[n - 1]);
+}
+
+
+// time expr for all inputs j = 0..n-1, repeated r times
+#define PB_MEASURE(name, expr) do { \
+   for (k = 0, s = 0; k < rounds; k++) \
+      for (i = 0; i + PB_BATCH <= n; i += PB_BATCH, s++) \
+      { \
+         t = pb_now(); \
+         for (j = i; j < i + PB_BATCH; j++) \
+            sink += (expr); \
+         smp[s] = (pb_now() - t) / PB_BATCH; \
+      } \
+   pb_report(name, smp, s); \
+} while (0)
+
+
+static void usage(const char *s)
+{
+   printf("Microbenchmark of the projection functions.\n"
+         "usage: %s [OPTIONS]\n"
+         "   -h ............ This help.\n"
+         "   -n <inputs> ... Number of random inputs, default = 65536.\n"
+         "   -r <rounds> ... Number of rounds over all inputs, default = 8.\n",
+         s);
+}
+
+
 int main(int argc, char **argv)
 {
-   ellipsoid_t el = WGS84;
-   int north = 6855295; //!< 52.48999447
-   double lat;
+   ellipsoid_t el = WGS84, el0 = WGS84, elt;
+   struct coord *src, *dst;
+   double *lat, *N, *smp, t, sink = 0, phi, err, max_err, max_lat;
+   int i, j, k, s, b, n = 65536, rounds = 8, fail = 0;
+
+   while ((i = getopt(argc, argv, "hn:r:")) != -1)
+      switch (i)
+      {
+         case 'h':
+            usage(argv[0]);
+            return 0;
+
+         case 'n':
+            n = atoi(optarg);
+            break;
+
+         case 'r':
+            rounds = atoi(optarg);
+            break;
+      }
+
+   if (n < PB_BATCH * PB_BANDS || rounds < 1)
+   {
+      fprintf(stderr, "inputs must be at least %d, rounds at least 1\n", PB_BATCH * PB_BANDS);
+      return EXIT_FAILURE;
+   }
+
+   if ((lat = malloc(sizeof(*lat) * n * 2)) == NULL || (src = malloc(sizeof(*src) * n * 2)) == NULL
+         || (smp = malloc(sizeof(*smp) * (n / PB_BATCH) * rounds)) == NULL)
+      perror("malloc"), exit(EXIT_FAILURE);
+   N = lat + n;
+   dst = src + n;
 
    init_ellipsoid(&el);
 
-   lat = phi_iterate_merc(&el, north);
-   printf("northing = %d, latitude = %f\n", north, lat * 180 / M_PI);
-   north = round(northing(&el, lat));
-   printf("northing = %d, latitude = %f\n", north, lat * 180 / M_PI);
+   // latitudes from the equator to PB_MAXLAT, track points not more than
+   // some 100m apart
+   for (i = 0; i < n; i++)
+   {
+      lat[i] = DEG2RAD(pb_rand() * PB_MAXLAT);
+      N[i] = northing(&el, lat[i]);
+      src[i].lat = RAD2DEG(lat[i]);
+      src[i].lon = pb_rand() * 360 - 180;
+      dst[i].lat = src[i].lat + (pb_rand() - 0.5) * 0.002;
+      dst[i].lon = src[i].lon + (pb_rand() - 0.5) * 0.002;
+   }
+
+   printf("# %d inputs, %d rounds, %d calls per sample, latency in ns/call\n", n, rounds, PB_BATCH);
+   printf("# %-16s %9s %9s %9s %9s %9s %9s %9s\n", "function", "calls", "avg", "min", "p50", "p90", "p99", "max");
+   PB_MEASURE("init_ellipsoid", (elt = el0, init_ellipsoid(&elt), elt.e));
+   PB_MEASURE("northing", northing(&el, lat[j]));
+   PB_MEASURE("phi_iterate_merc", phi_iterate_merc(&el, N[j]));
+   PB_MEASURE("phi_series_merc", phi_series_merc(&el, N[j]));
+   PB_MEASURE("coord_diff", coord_diff(&src[j], &dst[j]).dist);
+
+   // the number of iterations of phi_iterate_merc() depends on the latitude
+   printf("# phi_iterate_merc by latitude\n");
+   for (b = 0; b < PB_BANDS; b++)
+   {
+      char name[32];
+
+      for (i = 0; i < n; i++)
+         N[i] = northing(&el, DEG2RAD((b + pb_rand()) * PB_MAXLAT / PB_BANDS));
+      snprintf(name, sizeof(name), "  %2d-%2d deg", b * PB_MAXLAT / PB_BANDS, (b + 1) * PB_MAXLAT / PB_BANDS);
+      PB_MEASURE(name, phi_iterate_merc(&el, N[j]));
+   }
+
+   // round trip over the full range in steps of 0.0001 degrees
+   for (max_err = max_lat = 0, i = -PB_MAXLAT * 10000; i <= PB_MAXLAT * 10000; i++)
+   {
+      phi = DEG2RAD(i / 10000.0);
+      err = fabs(phi_iterate_merc(&el, northing(&el, phi)) - phi);
+      if (err > max_err)
+         max_err = err, max_lat = RAD2DEG(phi);
+   }
+   fail = max_err > IT_ACCURACY;
+   printf("# round trip northing -> phi_iterate_merc, -%d to %d deg: max error = %.3e rad at %.4f deg, limit = %.1e rad, %s\n",
+         PB_MAXLAT, PB_MAXLAT, max_err, max_lat, IT_ACCURACY, fail ? "FAILED" : "ok");
+
+   // keep the compiler from optimizing away the calls
+   if (sink == 0.123)
+      printf("%f\n", sink);
 
-   lat = 54.06193333 / 180 * M_PI;
-   north = round(northing(&el, lat));
-   printf("northing = %d, latitude = %f\n", north, lat * 180 / M_PI);
+   free(smp);
+   free(src);
+   free(lat);
 
-   return 0;
+   return fail ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 #endif
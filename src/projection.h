@@ -33,8 +33,15 @@
 #include <errno.h>
 */
 
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <stdint.h>
+
+#include "fshfunc.h"
+
 // ellipsoid parameters for WGS84. e is calculated by init_ellipsoid()
-#define WGS84 {6378137, 6356752.3142, 0}
+#define WGS84 {6378137, 6356752.3142, 0, MERC_ITERATE, {0, 0, 0, 0}}
 // maximum iterations to prevent from endless loops
 #define MAX_IT 32
 // iteration accuracy for reverse Mercator,
@@ -42,12 +49,17 @@
 #define IT_ACCURACY 1.5E-8
 
 
+// methods of the reverse Mercator, see phi_merc()
+enum {MERC_ITERATE, MERC_SERIES};
+
 // structure to keep ellipsoid data
 typedef struct ellipsoid
 {
    double a;   //!< semi-major axis in m (equatorial)
    double b;   //!< semi-minor axis in m (polar)
    double e;   //!< eccentricity (this is derived from a and b, call init_ellipsoid())
+   int merc_inv;  //!< method used by phi_merc(), MERC_ITERATE or MERC_SERIES
+   double chi[4]; //!< coefficients of the conformal latitude series, set by init_ellipsoid()
 } ellipsoid_t;
 
 
@@ -67,6 +79,14 @@ struct pcoord
 
 void init_ellipsoid(ellipsoid_t *);
 double phi_iterate_merc(const ellipsoid_t *, double );
+double phi_series_merc(const ellipsoid_t *, double );
+double phi_merc(const ellipsoid_t *, double );
+void phi_merc_batch(const ellipsoid_t *, const double *, double *, int );
+void fsh_tseg_project(const track_segment_t *, const ellipsoid_t *, double *, double *);
+double phi_merc_check(const ellipsoid_t *);
 double northing(const ellipsoid_t *, double );
+int32_t fsh_north(const ellipsoid_t *, double );
+int32_t fsh_east(double );
 struct pcoord coord_diff(const struct coord *, const struct coord *);
 
+#endif
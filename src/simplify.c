@@ -0,0 +1,220 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the simplification of track segments with the
+ *  Douglas-Peucker algorithm. The segments are simplified in place within
+ *  the block list, thus all output functions see the simplified tracks.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "simplify.h"
+
+
+/*! Mark the points which are kept by the Douglas-Peucker algorithm. A point
+ * is significant if its horizontal distance to the line between the
+ * surrounding kept points exceeds tol, or if its depth differs by more than
+ * dtol from the depth interpolated along this line. The first and the last
+ * point are always kept.
+ * @param x Easting of the points in m.
+ * @param y Northing of the points in m.
+ * @param d Depth of the points in cm, DEPTH_NA if unknown.
+ * @param keep Array which receives 1 for each point which is kept.
+ * @param n Number of points, at least 2.
+ * @param tol Horizontal tolerance in m.
+ * @param dtol Depth tolerance in cm, 0 to ignore the depth.
+ * @param stack Buffer of 2 * n integers.
+ * @return Returns the number of points kept.
+ */
+static int dp_mark(const double *x, const double *y, const int *d, char *keep, int n, double tol, double dtol, int *stack)
+{
+   double dx, dy, l2, t, ex, ey, e, emax;
+   int a, b, i, imax, sp, kept;
+
+   memset(keep, 0, n);
+   keep[0] = keep[n - 1] = 1;
+   kept = 2;
+   stack[0] = 0;
+   stack[1] = n - 1;
+
+   for (sp = 2; sp; )
+   {
+      b = stack[--sp];
+      a = stack[--sp];
+
+      dx = x[b] - x[a];
+      dy = y[b] - y[a];
+      l2 = dx * dx + dy * dy;
+      // errors are compared relative to the tolerances and squared
+      for (emax = 1, imax = -1, i = a + 1; i < b; i++)
+      {
+         t = l2 > 0 ? ((x[i] - x[a]) * dx + (y[i] - y[a]) * dy) / l2 : 0;
+         t = t < 0 ? 0 : t > 1 ? 1 : t;
+         ex = x[a] + t * dx - x[i];
+         ey = y[a] + t * dy - y[i];
+         e = (ex * ex + ey * ey) / (tol * tol);
+
+         if (dtol > 0 && d[a] != DEPTH_NA && d[b] != DEPTH_NA && d[i] != DEPTH_NA)
+         {
+            ex = (d[a] + t * (d[b] - d[a]) - d[i]) / dtol;
+            if (ex * ex > e)
+               e = ex * ex;
+         }
+
+         if (e > emax)
+         {
+            emax = e;
+            imax = i;
+         }
+      }
+
+      if (imax == -1)
+         continue;
+
+      keep[imax] = 1;
+      kept++;
+      stack[sp++] = a;
+      stack[sp++] = imax;
+      stack[sp++] = imax;
+      stack[sp++] = b;
+   }
+
+   return kept;
+}
+
+
+/*! Simplify the track segment of the block blk (type FSH_BLK_TRK). The
+ * points are converted to the local scale of the Mercator projection at the
+ * mean latitude of the segment, which is accurate enough for the distances
+ * between neighbouring track points. Points which are marked as invalid (c
+ * == -1) are dropped. The block data is replaced by a copy of the kept
+ * points which is allocated from the arena.
+ * @param blk Pointer to the block.
+ * @param sp Pointer to the simplification parameters. The point counters are
+ * incremented.
+ * @param arena Arena of the block list.
+ * @return Returns 0 on success or FSH_ERR_NOMEM.
+ */
+int fsh_tseg_simplify(fsh_block_t *blk, fsh_simplify_t *sp, fsh_arena_t *arena)
+{
+   const fsh_track_header_t *hdr = blk->data;
+   const fsh_track_point_t *pt = (const fsh_track_point_t*) (hdr + 1);
+   fsh_track_header_t *nhdr;
+   fsh_track_point_t *npt;
+   double *x, *y, north, phi, k;
+   int *d, *idx, *stack, i, n, cnt, kept;
+   char *keep;
+
+   if (blk->hdr.type != FSH_BLK_TRK || blk->data == NULL || blk->hdr.len < sizeof(*hdr))
+      return 0;
+
+   cnt = hdr->cnt;
+   if (cnt > (int) ((blk->hdr.len - sizeof(*hdr)) / sizeof(*pt)))
+      cnt = (blk->hdr.len - sizeof(*hdr)) / sizeof(*pt);
+   if (cnt < 1)
+      return 0;
+
+   x = malloc(sizeof(*x) * 2 * cnt);
+   d = malloc(sizeof(*d) * 4 * cnt);
+   keep = malloc(cnt);
+   if (x == NULL || d == NULL || keep == NULL)
+   {
+      free(x);
+      free(d);
+      free(keep);
+      return FSH_ERR_NOMEM;
+   }
+   y = x + cnt;
+   idx = d + cnt;
+   stack = d + 2 * cnt;
+
+   for (i = 0, n = 0, north = 0; i < cnt; i++)
+      if (pt[i].c != -1)
+      {
+         idx[n++] = i;
+         north += pt[i].north;
+      }
+
+   if (n > 2)
+   {
+      // scale of the Mercator projection at the mean latitude
+      phi = phi_merc(sp->el, north / n / FSH_LAT_SCALE);
+      k = cos(phi) / sqrt(1 - pow(sp->el->e * sin(phi), 2));
+      for (i = 0; i < n; i++)
+      {
+         x[i] = pt[idx[i]].east / FSH_LON_SCALE * M_PI * sp->el->a * k;
+         y[i] = pt[idx[i]].north / FSH_LAT_SCALE * k;
+         d[i] = pt[idx[i]].depth;
+      }
+      kept = dp_mark(x, y, d, keep, n, sp->tol, sp->dtol * 100, stack);
+   }
+   else
+   {
+      memset(keep, 1, n);
+      kept = n;
+   }
+
+   if ((nhdr = fsh_arena_alloc(arena, sizeof(*nhdr) + sizeof(*pt) * kept)) == NULL)
+   {
+      free(x);
+      free(d);
+      free(keep);
+      return FSH_ERR_NOMEM;
+   }
+   *nhdr = *hdr;
+   nhdr->cnt = kept;
+   for (npt = (fsh_track_point_t*) (nhdr + 1), i = 0; i < n; i++)
+      if (keep[i])
+         *npt++ = pt[idx[i]];
+
+   sp->pts += n;
+   sp->kept += kept;
+
+   blk->data = nhdr;
+   blk->mapped = 0;
+   blk->hdr.len = sizeof(*nhdr) + sizeof(*pt) * kept;
+
+   free(x);
+   free(d);
+   free(keep);
+   return 0;
+}
+
+
+/*! Simplify all track segments of the decoded archive ctx, see
+ * fsh_tseg_simplify().
+ * @return Returns 0 on success, FSH_ERR_STATE if the context was not decoded
+ * yet, or FSH_ERR_NOMEM.
+ */
+int fsh_ctx_simplify(fsh_ctx_t *ctx, fsh_simplify_t *sp)
+{
+   fsh_block_t *blk;
+   int err;
+
+   if (ctx->blk == NULL)
+      return FSH_ERR_STATE;
+
+   for (blk = ctx->blk; blk->hdr.type != FSH_BLK_ILL; blk++)
+      if (blk->hdr.type == FSH_BLK_TRK && (err = fsh_tseg_simplify(blk, sp, &ctx->arena)) < 0)
+         return err;
+
+   return 0;
+}
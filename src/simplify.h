@@ -0,0 +1,43 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the prototypes of the track simplification.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "fshfunc.h"
+#include "projection.h"
+
+// parameters and statistics of the track simplification
+typedef struct fsh_simplify
+{
+   const ellipsoid_t *el;  //!< ellipsoid of the Mercator projection
+   double tol;             //!< horizontal tolerance in m
+   double dtol;            //!< depth tolerance in m, 0 to ignore the depth
+   long pts;               //!< number of track points before simplification
+   long kept;              //!< number of track points kept
+} fsh_simplify_t;
+
+
+int fsh_tseg_simplify(fsh_block_t *, fsh_simplify_t *, fsh_arena_t *);
+int fsh_ctx_simplify(fsh_ctx_t *, fsh_simplify_t *);
+
+#endif
@@ -0,0 +1,307 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the snapshots of decoded archives. A snapshot keeps
+ *  the blocks of an archive together with the resolved GUID links of the
+ *  tracks and the projected coordinates of all track points. It is loaded
+ *  by fsh_ctx_decode() like an archive, which then only sets up the block
+ *  list without decoding any FLOB.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/uio.h>
+
+#include "fshfunc.h"
+#include "projection.h"
+#include "snapshot.h"
+
+// round x up to a multiple of 8
+#define SNAP_ALIGN(x) (((x) + 7) & ~(uint64_t) 7)
+
+
+/*! Return the length of the auxiliary data of the block blk in the
+ * snapshot. Blocks which are too short for their contents have none.
+ */
+static size_t snap_aux_len(const fsh_block_t *blk)
+{
+   const fsh_track_header_t *hdr = blk->data;
+   const fsh_track_meta_t *mta = blk->data;
+
+   switch (blk->hdr.type)
+   {
+      case FSH_BLK_MTA:
+         if (blk->hdr.len < sizeof(*mta) || blk->hdr.len < sizeof(*mta) + sizeof(*mta->guid) * mta->guid_cnt)
+            return 0;
+         return sizeof(int32_t) * mta->guid_cnt;
+
+      case FSH_BLK_TRK:
+         if (blk->hdr.len < sizeof(*hdr) || hdr->cnt < 0
+               || hdr->cnt > (int) ((blk->hdr.len - sizeof(*hdr)) / sizeof(fsh_track_point_t)))
+            return 0;
+         return sizeof(double) * 2 * hdr->cnt;
+   }
+   return 0;
+}
+
+
+/*! Write len bytes of buf completely to fd followed by zero bytes up to the
+ * next multiple of 8.
+ * @return Returns 0 on success or FSH_ERR_IO.
+ */
+static int snap_write(int fd, const void *buf, size_t len)
+{
+   static const char pad[8];
+   struct iovec iov[2], *v = iov;
+   ssize_t n;
+   int cnt = 2;
+
+   iov[0].iov_base = (void*) buf;
+   iov[0].iov_len = len;
+   iov[1].iov_base = (void*) pad;
+   iov[1].iov_len = SNAP_ALIGN(len) - len;
+
+   while (cnt)
+   {
+      if ((n = writev(fd, v, cnt)) == -1)
+      {
+         if (errno == EINTR)
+            continue;
+         return FSH_ERR_IO;
+      }
+      for (; cnt && (size_t) n >= v->iov_len; v++, cnt--)
+         n -= v->iov_len;
+      if (cnt)
+      {
+         v->iov_base = (char*) v->iov_base + n;
+         v->iov_len -= n;
+      }
+   }
+   return 0;
+}
+
+
+/*! Write a snapshot of the decoded archive ctx to fd. The snapshot contains
+ * the blocks as they are now, e.g. simplified. The track points are
+ * projected with el.
+ * @return Returns 0 on success or a negative error code, FSH_ERR_STATE,
+ * FSH_ERR_IO (errno is set), or FSH_ERR_NOMEM.
+ */
+int fsh_snap_write(const fsh_ctx_t *ctx, int fd, const ellipsoid_t *el)
+{
+   fsh_snap_header_t hdr;
+   fsh_snap_blk_t *tab;
+   const fsh_block_t *blk, *seg;
+   const fsh_track_meta_t *mta;
+   track_segment_t tseg;
+   int32_t *link = NULL;
+   double *ll = NULL;
+   size_t len, size = 0;
+   uint64_t off;
+   int i, j, err;
+
+   if (ctx->blk == NULL)
+      return FSH_ERR_STATE;
+   if ((tab = calloc(ctx->blk_cnt + 1, sizeof(*tab))) == NULL)
+      return FSH_ERR_NOMEM;
+
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, FSH_SNAP_MAGIC, sizeof(hdr.magic));
+   hdr.version = FSH_SNAP_VERSION;
+   hdr.blk_cnt = ctx->blk_cnt;
+   hdr.a = el->a;
+   hdr.b = el->b;
+   hdr.merc_inv = el->merc_inv;
+   hdr.fhdr = ctx->fhdr;
+
+   // the layout is determined before anything is written
+   hdr.tab = SNAP_ALIGN(sizeof(hdr));
+   off = SNAP_ALIGN(hdr.tab + sizeof(*tab) * ctx->blk_cnt);
+   for (i = 0, blk = ctx->blk; i < ctx->blk_cnt; i++, blk++)
+   {
+      tab[i].hdr = blk->hdr;
+      tab[i].data = off;
+      off = SNAP_ALIGN(off + blk->hdr.len);
+      if ((len = snap_aux_len(blk)) > 0)
+      {
+         tab[i].aux = off;
+         off = SNAP_ALIGN(off + len);
+      }
+      if (len > size)
+         size = len;
+   }
+   hdr.size = off;
+
+   if ((link = malloc(size + 1)) == NULL || (ll = malloc(size + 1)) == NULL)
+   {
+      err = FSH_ERR_NOMEM;
+      goto out;
+   }
+
+   if ((err = snap_write(fd, &hdr, sizeof(hdr))) < 0 || (err = snap_write(fd, tab, sizeof(*tab) * ctx->blk_cnt)) < 0)
+      goto out;
+
+   for (i = 0, blk = ctx->blk; i < ctx->blk_cnt; i++, blk++)
+   {
+      if ((err = snap_write(fd, blk->data, blk->hdr.len)) < 0)
+         goto out;
+      if (!tab[i].aux)
+         continue;
+
+      if (blk->hdr.type == FSH_BLK_MTA)
+      {
+         mta = blk->data;
+         for (j = 0; j < mta->guid_cnt; j++)
+         {
+            seg = fsh_guid_lookup(&ctx->idx, mta->guid[j], FSH_BLK_TRK);
+            link[j] = seg != NULL ? seg - ctx->blk : -1;
+         }
+         err = snap_write(fd, link, sizeof(*link) * mta->guid_cnt);
+      }
+      else
+      {
+         tseg.bhdr = (fsh_block_header_t*) &blk->hdr;
+         tseg.hdr = blk->data;
+         tseg.pt = (fsh_track_point_t*) (tseg.hdr + 1);
+         tseg.ll = NULL;
+         fsh_tseg_project(&tseg, el, ll, ll + tseg.hdr->cnt);
+         err = snap_write(fd, ll, sizeof(*ll) * 2 * tseg.hdr->cnt);
+      }
+      if (err < 0)
+         goto out;
+   }
+
+out:
+   free(link);
+   free(ll);
+   free(tab);
+   return err;
+}
+
+
+/*! Set up the block list of the context from the snapshot in ctx->base.
+ * Nothing but the block table is looked at, which is checked for
+ * consistency.
+ * @return Returns the number of blocks or a negative error code,
+ * FSH_ERR_SNAP or FSH_ERR_NOMEM.
+ */
+int fsh_snap_decode(fsh_ctx_t *ctx)
+{
+   const fsh_snap_header_t *hdr = (const fsh_snap_header_t*) ctx->base;
+   const fsh_snap_blk_t *tab;
+   fsh_block_t *blk;
+   uint64_t size = ctx->size, len;
+   int i, err;
+
+   if (size < sizeof(*hdr) || memcmp(hdr->magic, FSH_SNAP_MAGIC, sizeof(hdr->magic)))
+      return FSH_ERR_SNAP;
+   if (hdr->version != FSH_SNAP_VERSION || hdr->size != size || hdr->blk_cnt < 0 || hdr->tab % 8
+         || hdr->tab > size || (uint64_t) hdr->blk_cnt > (size - hdr->tab) / sizeof(*tab))
+      return FSH_ERR_SNAP;
+
+   tab = (const fsh_snap_blk_t*) (ctx->base + hdr->tab);
+   if ((blk = fsh_arena_alloc(&ctx->arena, sizeof(*blk) * (hdr->blk_cnt + 1))) == NULL)
+      return FSH_ERR_NOMEM;
+
+   for (i = 0; i < hdr->blk_cnt; i++)
+   {
+      if (tab[i].data > size || tab[i].hdr.len > size - tab[i].data)
+         break;
+      blk[i].hdr = tab[i].hdr;
+      blk[i].data = (char*) ctx->base + tab[i].data;
+      blk[i].mapped = 1;
+
+      if (!tab[i].aux)
+         continue;
+      len = snap_aux_len(&blk[i]);
+      if (!len || tab[i].aux % 8 || tab[i].aux > size || len > size - tab[i].aux)
+         break;
+   }
+
+   if (i < hdr->blk_cnt)
+   {
+      fsh_arena_free(&ctx->arena);
+      return FSH_ERR_SNAP;
+   }
+   memset(&blk[i], 0, sizeof(blk[i]));
+   blk[i].hdr.type = FSH_BLK_ILL;
+
+   if ((err = fsh_guid_index_init(&ctx->idx, blk)) < 0)
+   {
+      fsh_arena_free(&ctx->arena);
+      return err;
+   }
+
+   ctx->fhdr = hdr->fhdr;
+   ctx->blk = blk;
+   ctx->blk_cnt = err;
+   ctx->snap = tab;
+   return err;
+}
+
+
+/*! Resolve the segments of the track trk through the links of the
+ * snapshot. The projected coordinates of the segments are set if enabled by
+ * fsh_snap_projection() and if the segment was not modified since.
+ * @param n Index of the meta block of the track.
+ */
+void fsh_snap_tseg(const fsh_ctx_t *ctx, int n, track_t *trk)
+{
+   const fsh_snap_blk_t *tab = ctx->snap;
+   const int32_t *link;
+   const fsh_block_t *blk;
+   int i, k;
+
+   link = tab[n].aux ? (const int32_t*) (ctx->base + tab[n].aux) : NULL;
+   for (i = 0; i < trk->mta->guid_cnt; i++)
+   {
+      if (link == NULL || (k = link[i]) < 0 || k >= ctx->blk_cnt || ctx->blk[k].hdr.type != FSH_BLK_TRK)
+      {
+         memset(&trk->tseg[i], 0, sizeof(trk->tseg[i]));
+         continue;
+      }
+      blk = &ctx->blk[k];
+      trk->tseg[i].bhdr = (fsh_block_header_t*) &blk->hdr;
+      trk->tseg[i].hdr = blk->data;
+      trk->tseg[i].pt = (fsh_track_point_t*) (trk->tseg[i].hdr + 1);
+      trk->tseg[i].ll = ctx->snap_ll && blk->mapped && tab[k].aux ? (const double*) (ctx->base + tab[k].aux) : NULL;
+   }
+}
+
+
+/*! Enable the projected coordinates of the snapshot the context was decoded
+ * from. They are used only if they were calculated with the same ellipsoid
+ * and method as el.
+ * @return Returns 1 if they are enabled, otherwise 0.
+ */
+int fsh_snap_projection(fsh_ctx_t *ctx, const ellipsoid_t *el)
+{
+   const fsh_snap_header_t *hdr = (const fsh_snap_header_t*) ctx->base;
+
+   if (ctx->snap == NULL)
+      return 0;
+
+   ctx->snap_ll = hdr->a == el->a && hdr->b == el->b && hdr->merc_inv == el->merc_inv;
+   return ctx->snap_ll;
+}
+
@@ -0,0 +1,73 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the file format and the prototypes of the snapshots
+ *  of decoded archives.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "fshfunc.h"
+#include "projection.h"
+
+#define FSH_SNAP_MAGIC "FSHSNAP"
+#define FSH_SNAP_VERSION 1
+
+/* A snapshot consists of the header, the block table, and the data of the
+ * blocks in the order of the archive. All references are file offsets,
+ * and all offsets are aligned to 8 bytes. The data of each block is
+ * followed by its auxiliary data: the block indexes of the segments of a
+ * track (FSH_BLK_MTA, int32_t per GUID, -1 if missing), or the projected
+ * coordinates of a track segment (FSH_BLK_TRK, cnt latitudes followed by
+ * cnt longitudes in degrees).
+ */
+
+// header of a snapshot
+typedef struct fsh_snap_header
+{
+   char magic[8];          //!< FSH_SNAP_MAGIC
+   uint32_t version;       //!< FSH_SNAP_VERSION
+   int32_t blk_cnt;        //!< number of blocks
+   uint64_t tab;           //!< offset of the block table
+   uint64_t size;          //!< total size of the snapshot
+   double a, b;            //!< axes of the ellipsoid of the projected coordinates
+   int32_t merc_inv;       //!< method of the reverse Mercator projection
+   fsh_file_header_t fhdr; //!< file header of the archive
+} __attribute__ ((packed)) fsh_snap_header_t;
+
+// entry of the block table of a snapshot
+typedef struct fsh_snap_blk
+{
+   uint64_t data;          //!< offset of the block data
+   uint64_t aux;           //!< offset of the auxiliary data, 0 if none
+   fsh_block_header_t hdr; //!< header of the block
+   char pad[2];
+} __attribute__ ((packed)) fsh_snap_blk_t;
+
+
+int fsh_snap_write(const fsh_ctx_t *, int , const ellipsoid_t *);
+int fsh_snap_decode(fsh_ctx_t *);
+void fsh_snap_tseg(const fsh_ctx_t *, int , track_t *);
+int fsh_snap_projection(fsh_ctx_t *, const ellipsoid_t *);
+
+#endif
+
@@ -0,0 +1,182 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the track statistics. All values of a track are
+ *  collected in a single pass over its points without formatting any of
+ *  them.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "stats.h"
+
+
+#define DEG2RAD(x) ((x) * M_PI / 180.0)
+#define DEG2M(x) ((x) * 60 * 1852)
+#define CELSIUS(x) ((double) (x) / 100.0 - 273.15)
+
+
+static const int limit_[FSH_STATS_BINS - 1] = {FSH_STATS_LIMITS};
+
+
+/*! Return the bin of the depth histogram of a depth in cm. */
+static int depth_bin(int depth)
+{
+   int i;
+
+   for (i = 0; i < FSH_STATS_BINS - 1 && depth >= limit_[i] * 100; i++);
+   return i;
+}
+
+
+/*! Calculate the statistics of the track trk. The distance between
+ * neighbouring points is calculated with the equirectangular approximation
+ * on the sphere which is accurate for the short steps of a track and needs
+ * just a single cosine per point. Only the gaps between the segments are
+ * calculated as great circle distances with coord_diff().
+ * @param el Ellipsoid used to project the points unless they are projected
+ * already (see fsh_snap_projection()).
+ * @param st Pointer to the structure which receives the statistics.
+ * @return Returns 0 on success or FSH_ERR_NOMEM.
+ */
+int fsh_track_stats(const track_t *trk, const ellipsoid_t *el, fsh_track_stats_t *st)
+{
+   const track_segment_t *tseg;
+   const fsh_track_point_t *pt;
+   const double *lat, *lon;
+   struct coord last, cd;
+   double *buf = NULL, *b, depth = 0, tempr = 0, c, c0 = 0, dlat, dlon, gap;
+   int i, k, cnt, prev, size = 0;
+
+   memset(st, 0, sizeof(*st));
+   for (k = 0; k < trk->mta->guid_cnt; k++)
+   {
+      tseg = &trk->tseg[k];
+      if (tseg->hdr == NULL)
+         continue;
+      st->segs++;
+
+      cnt = tseg->hdr->cnt;
+      if (tseg->ll != NULL)
+         lat = tseg->ll;
+      else
+      {
+         if (cnt > size)
+         {
+            if ((b = realloc(buf, sizeof(*buf) * 2 * cnt)) == NULL)
+            {
+               free(buf);
+               return FSH_ERR_NOMEM;
+            }
+            buf = b;
+            size = cnt;
+         }
+         if (cnt > 0)
+            fsh_tseg_project(tseg, el, buf, buf + cnt);
+         lat = buf;
+      }
+      lon = lat + cnt;
+
+      for (i = 0, prev = -1; i < cnt; i++)
+      {
+         pt = &tseg->pt[i];
+         if (pt->c == -1)
+            continue;
+
+         c = cos(DEG2RAD(lat[i]));
+         if (prev != -1)
+         {
+            dlat = lat[i] - lat[prev];
+            dlon = lon[i] - lon[prev];
+            if (dlon > 180)
+               dlon -= 360;
+            else if (dlon < -180)
+               dlon += 360;
+            dlon *= (c + c0) / 2;
+            st->length += sqrt(dlat * dlat + dlon * dlon);
+         }
+         else if (st->pts)
+         {
+            // first point of a segment following another one
+            cd.lat = lat[i];
+            cd.lon = lon[i];
+            gap = coord_diff(&last, &cd).dist;
+            st->gaps++;
+            if (gap > st->gap_max)
+               st->gap_max = gap;
+         }
+         prev = i;
+         c0 = c;
+
+         if (!st->pts)
+         {
+            st->south = st->north = lat[i];
+            st->west = st->east = lon[i];
+         }
+         else
+         {
+            st->south = fmin(st->south, lat[i]);
+            st->north = fmax(st->north, lat[i]);
+            st->west = fmin(st->west, lon[i]);
+            st->east = fmax(st->east, lon[i]);
+         }
+         st->pts++;
+
+         if (pt->depth != DEPTH_NA)
+         {
+            if (!st->depth_cnt || pt->depth < st->depth_min)
+               st->depth_min = pt->depth;
+            if (!st->depth_cnt || pt->depth > st->depth_max)
+               st->depth_max = pt->depth;
+            depth += pt->depth;
+            st->depth_cnt++;
+            st->hist[depth_bin(pt->depth)]++;
+         }
+
+         if (pt->tempr != TEMPR_NA)
+         {
+            if (!st->tempr_cnt || CELSIUS(pt->tempr) < st->tempr_min)
+               st->tempr_min = CELSIUS(pt->tempr);
+            if (!st->tempr_cnt || CELSIUS(pt->tempr) > st->tempr_max)
+               st->tempr_max = CELSIUS(pt->tempr);
+            tempr += CELSIUS(pt->tempr);
+            st->tempr_cnt++;
+         }
+      }
+
+      if (prev != -1)
+      {
+         last.lat = lat[prev];
+         last.lon = lon[prev];
+      }
+   }
+
+   st->length = DEG2M(st->length);
+   st->gap_max = DEG2M(st->gap_max);
+   if (st->depth_cnt)
+      st->depth_mean = depth / st->depth_cnt;
+   if (st->tempr_cnt)
+      st->tempr_mean = tempr / st->tempr_cnt;
+
+   free(buf);
+   return 0;
+}
+
@@ -0,0 +1,56 @@
+/* Copyright 2013-2019 Bernhard R. Fischer, 4096R/8E24F29D <bf@abenteuerland.at>
+ *
+ * This file is part of Parsefsh.
+ *
+ * Parsefsh is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * Parsefsh is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Parsefsh. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! This file contains the data structures and prototypes of the track
+ *  statistics.
+ *
+ *  @author Bernhard R. Fischer
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "fshfunc.h"
+#include "projection.h"
+
+// number of bins of the depth histogram
+#define FSH_STATS_BINS 10
+// upper limits of the bins in m, the last bin is open
+#define FSH_STATS_LIMITS 2, 5, 10, 20, 50, 100, 200, 500, 1000
+
+// statistics of a track, points marked as invalid (c == -1) are ignored
+typedef struct fsh_track_stats
+{
+   int segs;               //!< number of segments found
+   long pts;               //!< number of points
+   int gaps;               //!< number of gaps between consecutive segments
+   double gap_max;         //!< length of the longest gap in m
+   double length;          //!< length of all segments in m, the gaps excluded
+   double south, west, north, east; //!< bounding box in degrees, valid if pts > 0
+   long depth_cnt;         //!< number of points with a depth
+   int depth_min, depth_max;  //!< depth in cm, valid if depth_cnt > 0
+   double depth_mean;      //!< mean depth in cm
+   long tempr_cnt;         //!< number of points with a temperature
+   double tempr_min, tempr_max, tempr_mean;  //!< temperature in degrees Celsius, valid if tempr_cnt > 0
+   long hist[FSH_STATS_BINS]; //!< number of points with a depth per bin
+} fsh_track_stats_t;
+
+
+int fsh_track_stats(const track_t *, const ellipsoid_t *, fsh_track_stats_t *);
+
+#endif
+